@@ -0,0 +1,184 @@
+#include <errno.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include <applibs/log.h>
+
+#include "app_options.h"
+
+typedef enum {
+    Option_StepMode = 256,
+    Option_Profile,
+    Option_StartInterval,
+    Option_CruiseInterval,
+    Option_Acceleration,
+    Option_StepsPerRevolution,
+    Option_Pins,
+    Option_Telemetry,
+    Option_TelemetryPeriod,
+    Option_CommandPort,
+    Option_MotorSupply,
+    Option_ThermalResistance
+} OptionId;
+
+static const struct option longOptions[] = {
+    {"step-mode", required_argument, NULL, Option_StepMode},
+    {"profile", required_argument, NULL, Option_Profile},
+    {"start-interval", required_argument, NULL, Option_StartInterval},
+    {"cruise-interval", required_argument, NULL, Option_CruiseInterval},
+    {"acceleration", required_argument, NULL, Option_Acceleration},
+    {"steps-per-revolution", required_argument, NULL, Option_StepsPerRevolution},
+    {"pins", required_argument, NULL, Option_Pins},
+    {"telemetry", required_argument, NULL, Option_Telemetry},
+    {"telemetry-period", required_argument, NULL, Option_TelemetryPeriod},
+    {"command-port", required_argument, NULL, Option_CommandPort},
+    {"motor-supply", required_argument, NULL, Option_MotorSupply},
+    {"thermal-resistance", required_argument, NULL, Option_ThermalResistance},
+    {NULL, 0, NULL, 0}};
+
+// Parse a whole decimal number up to the first character in 'terminators'; *end is left just past it.
+static int ParseUnsigned(const char *text, const char *terminators, uint32_t *value, const char **end)
+{
+    char *stop;
+    errno = 0;
+    unsigned long parsed = strtoul(text, &stop, 10);
+    if (stop == text || errno != 0 || parsed > UINT32_MAX || text[0] == '-' ||
+        (*stop != '\0' && strchr(terminators, *stop) == NULL)) {
+        return -1;
+    }
+    *value = (uint32_t)parsed;
+    if (end != NULL) {
+        *end = *stop == '\0' ? stop : stop + 1;
+    }
+    return 0;
+}
+
+static int ParseName(const char *text, const char *const *names, int count, int *value)
+{
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(text, names[i]) == 0) {
+            *value = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int ParsePins(const char *text, GPIO_Id *pins)
+{
+    for (int coil = 0; coil < COIL_COUNT; ++coil) {
+        uint32_t pin;
+        bool last = coil == COIL_COUNT - 1;
+        if (ParseUnsigned(text, last ? "" : ",", &pin, &text) != 0 || (!last && *text == '\0')) {
+            return -1;
+        }
+        pins[coil] = (GPIO_Id)pin;
+    }
+    return 0;
+}
+
+// A numeric address only: resolving a name could block the event loop
+static int ParseCollector(const char *text, TelemetryConfig *telemetry)
+{
+    const char *colon = strrchr(text, ':');
+    char address[INET_ADDRSTRLEN];
+    size_t length = colon != NULL ? (size_t)(colon - text) : 0;
+    uint32_t port;
+    struct in_addr parsed;
+    if (length == 0 || length >= sizeof(address) || ParseUnsigned(colon + 1, "", &port, NULL) != 0 ||
+        port == 0 || port > UINT16_MAX) {
+        return -1;
+    }
+    memcpy(address, text, length);
+    address[length] = '\0';
+    if (inet_pton(AF_INET, address, &parsed) != 1 || parsed.s_addr == 0) {
+        return -1;
+    }
+    telemetry->address = parsed.s_addr;
+    telemetry->port = (uint16_t)port;
+    return 0;
+}
+
+static int ApplyOption(int id, const char *value, AppOptions *options)
+{
+    StepperMotorConfig *motor = &options->motor;
+    // Names in enum order
+    static const char *const stepModes[] = {"wave", "full", "half"};
+    static const char *const profiles[] = {"trapezoidal", "scurve"};
+    int index;
+    uint32_t port;
+
+    switch (id) {
+    case Option_StepMode:
+        if (ParseName(value, stepModes, StepMode_Count, &index) != 0) {
+            return -1;
+        }
+        motor->stepMode = (StepMode)index;
+        return 0;
+    case Option_Profile:
+        if (ParseName(value, profiles, 2, &index) != 0) {
+            return -1;
+        }
+        motor->profileShape = (MotionProfileShape)index;
+        return 0;
+    case Option_StartInterval:
+        return ParseUnsigned(value, "", &motor->startIntervalNs, NULL);
+    case Option_CruiseInterval:
+        return ParseUnsigned(value, "", &motor->cruiseIntervalNs, NULL);
+    case Option_Acceleration:
+        return ParseUnsigned(value, "", &motor->accelerationStepsPerSec2, NULL);
+    case Option_StepsPerRevolution:
+        return ParseUnsigned(value, "", &motor->fullStepsPerRevolution, NULL);
+    case Option_Pins:
+        return ParsePins(value, motor->coilGpios);
+    case Option_Telemetry:
+        return ParseCollector(value, &options->telemetry);
+    case Option_TelemetryPeriod:
+        return ParseUnsigned(value, "", &options->telemetry.periodMs, NULL);
+    case Option_CommandPort:
+        if (ParseUnsigned(value, "", &port, NULL) != 0 || port == 0 || port > UINT16_MAX) {
+            return -1;
+        }
+        options->commandPort = (uint16_t)port;
+        return 0;
+    case Option_MotorSupply:
+        return ParseUnsigned(value, "", &options->thermal.supplyMillivolts, NULL);
+    case Option_ThermalResistance:
+        return ParseUnsigned(value, "", &options->thermal.thermalResistanceMilliCPerW, NULL);
+    default:
+        return -1;
+    }
+}
+
+int AppOptions_Parse(int argc, char *argv[], AppOptions *options)
+{
+    // Only long options; the leading ':' makes getopt report problems through its return value
+    optind = 1;
+    opterr = 0;
+    int id;
+    while ((id = getopt_long(argc, argv, ":", longOptions, NULL)) != -1) {
+        if (id == '?' || id == ':') {
+            Log_Debug("ERROR: Unknown option or missing value: %s.\n", argv[optind - 1]);
+            return -1;
+        }
+        if (ApplyOption(id, optarg, options) != 0) {
+            Log_Debug("ERROR: Invalid value for %s.\n", argv[optind - 1]);
+            return -1;
+        }
+    }
+    if (optind < argc) {
+        Log_Debug("ERROR: Unexpected argument: %s.\n", argv[optind]);
+        return -1;
+    }
+
+    const StepperMotorConfig *motor = &options->motor;
+    Log_Debug("Motor: step mode %d, profile %d, start %lu ns, cruise %lu ns, acceleration %lu steps/s^2, "
+              "pins %d,%d,%d,%d.\n",
+              motor->stepMode, motor->profileShape, (unsigned long)motor->startIntervalNs,
+              (unsigned long)motor->cruiseIntervalNs, (unsigned long)motor->accelerationStepsPerSec2,
+              motor->coilGpios[0], motor->coilGpios[1], motor->coilGpios[2], motor->coilGpios[3]);
+    return 0;
+}
@@ -0,0 +1,47 @@
+/*
+Command line options.
+Azure Sphere passes the CmdArgs array of app_manifest.json to main, so each installation can tune its motor by
+editing the manifest rather than rebuilding. Every option is optional and overrides the compiled-in default:
+    --step-mode=wave|full|half
+    --profile=trapezoidal|scurve
+    --start-interval=NS           step interval the motor starts from without stalling
+    --cruise-interval=NS          step interval at full speed
+    --acceleration=STEPS_PER_S2
+    --steps-per-revolution=N      full steps per revolution, or 0 for a linear axis
+    --pins=IN1,IN2,IN3,IN4        GPIOs wired to the driver inputs
+    --telemetry=ADDRESS:PORT      send telemetry to this IPv4 address and UDP port
+    --telemetry-period=MS         time between telemetry samples
+    --command-port=PORT           accept motion commands on this TCP port, see remote_command.h
+    --motor-supply=MV             motor supply voltage at the driver, for the thermal governor
+    --thermal-resistance=MC_PER_W settled temperature rise of the motor as mounted, in thousandths of a degree C
+                                  per watt, for the thermal governor
+For example "CmdArgs": [ "--step-mode=half", "--cruise-interval=900000" ]. GPIOs chosen with --pins must also
+be listed in the Gpio capability of the manifest, a collector in its AllowedConnections and a command port in its
+AllowedTcpServerPorts. The manifest allows a collector at 192.168.1.100 and command port 5000, so
+"--telemetry=192.168.1.100:PORT" and "--command-port=5000" work without further changes to it.
+*/
+#pragma once
+
+#include "stepper_motor.h"
+#include "telemetry.h"
+#include "thermal_governor.h"
+
+/// <summary>
+///     Everything that can be set from the command line.
+/// </summary>
+typedef struct {
+    StepperMotorConfig motor;
+    TelemetryConfig telemetry;
+    ThermalGovernorConfig thermal;
+    /// <summary>TCP port for remote commands, or 0 for none.</summary>
+    uint16_t commandPort;
+} AppOptions;
+
+/// <summary>
+///     Applies the command line to a set of options that already holds the defaults.
+/// </summary>
+/// <param name="argc">Argument count passed to main</param>
+/// <param name="argv">Arguments passed to main</param>
+/// <param name="options">Defaults on entry, defaults with the command line applied on return</param>
+/// <returns>0 on success, or -1 if an option is unknown or its value is invalid</returns>
+int AppOptions_Parse(int argc, char *argv[], AppOptions *options);
@@ -0,0 +1,103 @@
+#include <errno.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "button_input.h"
+
+static const struct timespec idlePollPeriod = {0, BUTTON_IDLE_POLL_PERIOD_NS};
+static const struct timespec activePollPeriod = {0, BUTTON_ACTIVE_POLL_PERIOD_NS};
+static const struct timespec debounceLockout = {0, BUTTON_DEBOUNCE_NS};
+
+#define ACTIVE_WINDOW_POLLS ((BUTTON_ACTIVE_WINDOW_NS - BUTTON_DEBOUNCE_NS) / BUTTON_ACTIVE_POLL_PERIOD_NS)
+
+static void ReportError(ButtonInput *button)
+{
+    SoftTimer_Stop(&button->pollTimer);
+    button->callback(button, ButtonEvent_Error);
+}
+
+// Skip the poll that failed and try again on the next one, reopening the GPIO first unless the error goes away
+// by itself. A reopen that fails leaves the fd at -1, so the next poll fails and counts against the budget too.
+static void RecoverGpio(ButtonInput *button, int error)
+{
+    if (!Recovery_Allow(&button->recovery, error)) {
+        ReportError(button);
+        return;
+    }
+    if (Recovery_IsTransient(error)) {
+        return;
+    }
+    CloseFdAndPrintError(button->gpioFd, "Failed button GPIO");
+    button->gpioFd = GPIO_OpenAsInput(button->gpioId);
+}
+
+// The timer wheel records the poll's wakeup latency and execution time in button->stats
+static void ButtonPollEventHandler(SoftTimer *timer)
+{
+    ButtonInput *button = (ButtonInput *)timer;
+
+    GPIO_Value_Type state;
+    if (GPIO_GetValue(button->gpioFd, &state) != 0) {
+        RecoverGpio(button, errno);
+        return;
+    }
+
+    if (state == button->reportedState) {
+        if (button->activePolls > 0 && --button->activePolls == 0 &&
+            SoftTimer_Start(&button->pollTimer, &idlePollPeriod, &idlePollPeriod) != 0) {
+            ReportError(button);
+        }
+        return;
+    }
+
+    // Sit out the bounce, then poll fast from the level the first sample after it sees
+    button->reportedState = state;
+    button->activePolls = ACTIVE_WINDOW_POLLS;
+    if (SoftTimer_Start(&button->pollTimer, &debounceLockout, &activePollPeriod) != 0) {
+        ReportError(button);
+        return;
+    }
+    button->callback(button, state == GPIO_Value_Low ? ButtonEvent_Pressed : ButtonEvent_Released);
+}
+
+int ButtonInput_Open(ButtonInput *button, GPIO_Id gpioId, ButtonEventCallback callback)
+{
+    memset(button, 0, sizeof(*button));
+    SoftTimer_Init(&button->pollTimer, &ButtonPollEventHandler);
+    button->pollTimer.stats = &button->stats;
+    button->callback = callback;
+    button->reportedState = GPIO_Value_High;
+    button->gpioId = gpioId;
+    button->recovery = (RecoveryBudget)RECOVERY_BUDGET("Button GPIO");
+
+    button->gpioFd = GPIO_OpenAsInput(gpioId);
+    if (button->gpioFd < 0) {
+        Log_Debug("ERROR: Could not open button GPIO %d: %s (%d).\n", gpioId, strerror(errno),
+                  errno);
+        return -1;
+    }
+
+    if (SoftTimer_Start(&button->pollTimer, &idlePollPeriod, &idlePollPeriod) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+const EventLatencyStats *ButtonInput_GetStats(const ButtonInput *button)
+{
+    return &button->stats;
+}
+
+bool ButtonInput_IsPressed(const ButtonInput *button)
+{
+    return button->reportedState == GPIO_Value_Low;
+}
+
+void ButtonInput_Close(ButtonInput *button, const char *name)
+{
+    SoftTimer_Stop(&button->pollTimer);
+    CloseFdAndPrintError(button->gpioFd, name);
+    button->gpioFd = -1;
+}
@@ -0,0 +1,97 @@
+/*
+Debounced push button input with adaptive polling.
+High-level Azure Sphere apps cannot take GPIO interrupts, so a button has to be polled. Instead of the fixed 1 ms
+poll the button timer used to run, the button is sampled every BUTTON_IDLE_POLL_PERIOD_NS while nothing is
+happening, and every BUTTON_ACTIVE_POLL_PERIOD_NS for BUTTON_ACTIVE_WINDOW_NS after it changes, which is where quick
+repeat presses need the resolution. The idle period of 20 ms takes a fiftieth of the wakeups and GPIO reads of the
+old poll, while a press is still seen well within the time a person could notice between pressing and the motor
+starting.
+An edge is reported on the first sample that sees it (leading edge debounce); polling then pauses for the debounce
+lockout, since contact bounce is all a sample could see, and the first sample after the lockout reports a release
+or a new press that happened inside it.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <time.h>
+
+#include <applibs/gpio.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "latency_stats.h"
+#include "recovery.h"
+
+/// <summary>Poll period while the button has been stable for longer than the active window.</summary>
+#define BUTTON_IDLE_POLL_PERIOD_NS 20000000L
+/// <summary>Poll period right after a change, once the debounce lockout is over.</summary>
+#define BUTTON_ACTIVE_POLL_PERIOD_NS 2000000L
+/// <summary>Time after a reported edge during which contact bounce is ignored.</summary>
+#define BUTTON_DEBOUNCE_NS 20000000L
+/// <summary>Time after the last change before falling back to the idle poll period.</summary>
+#define BUTTON_ACTIVE_WINDOW_NS 500000000L
+
+/// <summary>
+///     Events reported by a button.
+/// </summary>
+typedef enum {
+    /// <summary>The button went down (input Low).</summary>
+    ButtonEvent_Pressed,
+    /// <summary>The button came back up (input High).</summary>
+    ButtonEvent_Released,
+    /// <summary>The timer or GPIO could not be read; the button stops polling.</summary>
+    ButtonEvent_Error
+} ButtonEvent;
+
+struct ButtonInput;
+
+/// <summary>
+///     Function signature for button event callbacks.
+/// </summary>
+/// <param name="button">The button that generated the event</param>
+/// <param name="event">What happened</param>
+typedef void (*ButtonEventCallback)(struct ButtonInput *button, ButtonEvent event);
+
+/// <summary>
+///     State of one polled button. Treat the members as private to button_input.c.
+/// </summary>
+typedef struct ButtonInput {
+    /// <summary>Poll timer on the timer wheel; must stay the first member.</summary>
+    SoftTimer pollTimer;
+    /// <summary>Called for every reported event.</summary>
+    ButtonEventCallback callback;
+    GPIO_Id gpioId;
+    int gpioFd;
+    /// <summary>Last level reported through the callback.</summary>
+    GPIO_Value_Type reportedState;
+    /// <summary>Fast polls left before returning to the idle poll period.</summary>
+    unsigned activePolls;
+    /// <summary>Poll latency figures.</summary>
+    EventLatencyStats stats;
+    /// <summary>Read faults; the GPIO is reopened until these run out.</summary>
+    RecoveryBudget recovery;
+} ButtonInput;
+
+/// <summary>
+///     Opens a button GPIO as input and starts polling it at the idle period. The poll runs on the timer
+///     wheel, so <see cref="TimerWheel_Init" /> must have been called.
+/// </summary>
+/// <param name="button">Button state; must stay in memory until <see cref="ButtonInput_Close" /></param>
+/// <param name="gpioId">GPIO the button is connected to; the button pulls it Low when pressed</param>
+/// <param name="callback">Function called with press, release and error events</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int ButtonInput_Open(ButtonInput *button, GPIO_Id gpioId, ButtonEventCallback callback);
+
+/// <summary>
+///     Returns how late each poll ran and how long it took.
+/// </summary>
+const EventLatencyStats *ButtonInput_GetStats(const ButtonInput *button);
+
+/// <summary>
+///     Returns true if the last reported event was a press.
+/// </summary>
+bool ButtonInput_IsPressed(const ButtonInput *button);
+
+/// <summary>
+///     Stops the poll timer and closes the button GPIO.
+/// </summary>
+void ButtonInput_Close(ButtonInput *button, const char *name);
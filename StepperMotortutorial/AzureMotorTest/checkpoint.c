@@ -0,0 +1,346 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "checkpoint.h"
+#include "epoll_timerfd_utilities.h"
+
+#define RECORD_BYTES 16
+#define RECORD_MAGIC 0xc7
+// The axis was standing still, so its position is exact
+#define FLAG_AT_REST 0x01
+// The position counts from a known origin
+#define FLAG_KNOWN 0x02
+// The phase is kept in the top four bits of the flags byte
+#define FLAGS_MASK 0x0f
+#define PHASE_SHIFT 4
+
+typedef struct {
+    int32_t position;
+    uint8_t stepMode;
+    uint8_t phase;
+    uint8_t flags;
+} AxisState;
+
+static void SampleTimerHandler(SoftTimer *timer);
+
+static StepperMotor *const *checkpointMotors = NULL;
+static uint32_t axisCount = 0;
+static const MovePlanner *checkpointPlanner = NULL;
+static int logFd = -1;
+static SoftTimer sampleTimer;
+
+// What the log says about each axis, valid once hasWritten is set
+static AxisState written[CHECKPOINT_MAX_AXES];
+static bool hasWritten[CHECKPOINT_MAX_AXES];
+static int32_t sampledPositions[CHECKPOINT_MAX_AXES];
+static bool positionKnown[CHECKPOINT_MAX_AXES];
+static bool restored[CHECKPOINT_MAX_AXES];
+
+static uint32_t nextSequence = 0;
+static uint32_t appendOffset = 0;
+// Last write error logged, so that storage that stays broken is logged once
+static int lastWriteError = 0;
+
+static uint8_t logBuffer[CHECKPOINT_LOG_BYTES];
+
+static void PutU32(uint8_t *out, uint32_t value)
+{
+    for (int byte = 0; byte < 4; ++byte) {
+        out[byte] = (uint8_t)(value >> (8 * byte));
+    }
+}
+
+static uint32_t GetU32(const uint8_t *in)
+{
+    return (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+// FNV-1a, enough to tell a record from erased or half-written storage
+static uint32_t Checksum(const uint8_t *data, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void EncodeRecord(uint8_t *out, uint32_t axis, const AxisState *state, uint32_t sequence)
+{
+    out[0] = RECORD_MAGIC;
+    out[1] = (uint8_t)axis;
+    out[2] = state->stepMode;
+    out[3] = (uint8_t)(state->flags | state->phase << PHASE_SHIFT);
+    PutU32(out + 4, sequence);
+    PutU32(out + 8, (uint32_t)state->position);
+    PutU32(out + 12, Checksum(out, RECORD_BYTES - 4));
+}
+
+static bool DecodeRecord(const uint8_t *in, uint32_t *axis, AxisState *state, uint32_t *sequence)
+{
+    if (in[0] != RECORD_MAGIC || in[1] >= CHECKPOINT_MAX_AXES || in[2] >= StepMode_Count ||
+        (in[3] >> PHASE_SHIFT) >= StepSequence_Get((StepMode)in[2])->length ||
+        GetU32(in + 12) != Checksum(in, RECORD_BYTES - 4)) {
+        return false;
+    }
+    *axis = in[1];
+    state->stepMode = in[2];
+    state->flags = in[3] & FLAGS_MASK;
+    state->phase = in[3] >> PHASE_SHIFT;
+    *sequence = GetU32(in + 4);
+    state->position = (int32_t)GetU32(in + 8);
+    return true;
+}
+
+// Find the newest record of every axis, and carry on appending after the newest record of all
+static int ReadLog(void)
+{
+    ssize_t length = pread(logFd, logBuffer, sizeof(logBuffer), 0);
+    if (length < 0) {
+        Log_Debug("ERROR: Could not read checkpoints: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    uint32_t sequences[CHECKPOINT_MAX_AXES];
+    bool haveNewest = false;
+    uint32_t newestSequence = 0;
+    appendOffset = 0;
+    for (size_t offset = 0; offset + RECORD_BYTES <= (size_t)length; offset += RECORD_BYTES) {
+        uint32_t axis, sequence;
+        AxisState state;
+        if (!DecodeRecord(logBuffer + offset, &axis, &state, &sequence)) {
+            continue;
+        }
+        // Compared as a difference so that the order holds when the sequence wraps
+        if (!hasWritten[axis] || (int32_t)(sequence - sequences[axis]) > 0) {
+            written[axis] = state;
+            sequences[axis] = sequence;
+            hasWritten[axis] = true;
+        }
+        if (!haveNewest || (int32_t)(sequence - newestSequence) > 0) {
+            newestSequence = sequence;
+            appendOffset = (uint32_t)(offset + RECORD_BYTES);
+            haveNewest = true;
+        }
+    }
+    nextSequence = haveNewest ? newestSequence + 1 : 0;
+    return 0;
+}
+
+static void RestoreAxis(uint32_t axis)
+{
+    StepperMotor *motor = checkpointMotors[axis];
+    positionKnown[axis] = true;
+    if (!hasWritten[axis]) {
+        return;
+    }
+
+    const AxisState *state = &written[axis];
+    if ((state->flags & FLAG_AT_REST) == 0) {
+        Log_Debug("Checkpoint: axis %u was moving when the app stopped, its position is not known.\n", axis);
+        positionKnown[axis] = false;
+        return;
+    }
+    if ((state->flags & FLAG_KNOWN) == 0) {
+        Log_Debug("Checkpoint: axis %u has not had a known position since it was lost.\n", axis);
+        positionKnown[axis] = false;
+        return;
+    }
+
+    // The position and phase are in steps of the step mode they were saved in. The rotor was left in the saved
+    // phase, so the next step has to carry on from there, in whatever mode the motor now runs.
+    int32_t position = state->position;
+    uint32_t phase = state->phase;
+    StepSequence_ChangeMode((StepMode)state->stepMode, StepperMotor_GetStepMode(motor), &position, &phase);
+    StepperMotor_SetPosition(motor, position);
+    StepperMotor_SetPhase(motor, phase);
+    restored[axis] = true;
+    Log_Debug("Checkpoint: axis %u restored at position %ld.\n", axis, (long)position);
+}
+
+static AxisState SampleAxis(uint32_t axis, bool atRest)
+{
+    StepperMotor *motor = checkpointMotors[axis];
+    AxisState state = {.position = StepperMotor_GetPosition(motor),
+                       .stepMode = (uint8_t)StepperMotor_GetStepMode(motor),
+                       .phase = (uint8_t)StepperMotor_GetPhase(motor),
+                       .flags = 0};
+    if (atRest) {
+        state.flags |= FLAG_AT_REST;
+    }
+    if (positionKnown[axis]) {
+        state.flags |= FLAG_KNOWN;
+    }
+    return state;
+}
+
+static bool IsAnythingMoving(void)
+{
+    if (checkpointPlanner != NULL && MovePlanner_IsMoving(checkpointPlanner)) {
+        return true;
+    }
+    for (uint32_t axis = 0; axis < axisCount; ++axis) {
+        if (StepperMotor_IsMoving(checkpointMotors[axis])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// While an axis moves only the change to moving is written, not every position it passes
+static bool HasChanged(uint32_t axis, const AxisState *state)
+{
+    if (!hasWritten[axis]) {
+        return true;
+    }
+    const AxisState *last = &written[axis];
+    if (state->flags != last->flags) {
+        return true;
+    }
+    return (state->flags & FLAG_AT_REST) != 0 &&
+           (state->position != last->position || state->stepMode != last->stepMode || state->phase != last->phase);
+}
+
+// Append every axis that changed in one write. A batch that would run past the end of the log starts again at
+// the beginning, and then has every axis in it, so the newest state of each axis is always in the last lap.
+static void WriteCheckpoints(bool atRest)
+{
+    AxisState states[CHECKPOINT_MAX_AXES];
+    bool changed[CHECKPOINT_MAX_AXES];
+    uint32_t changedCount = 0;
+    for (uint32_t axis = 0; axis < axisCount; ++axis) {
+        states[axis] = SampleAxis(axis, atRest);
+        changed[axis] = HasChanged(axis, &states[axis]);
+        changedCount += changed[axis] ? 1u : 0u;
+    }
+    if (changedCount == 0) {
+        return;
+    }
+
+    uint32_t offset = appendOffset;
+    if (offset + changedCount * RECORD_BYTES > CHECKPOINT_LOG_BYTES) {
+        offset = 0;
+        for (uint32_t axis = 0; axis < axisCount; ++axis) {
+            changed[axis] = true;
+        }
+    }
+
+    uint8_t batch[CHECKPOINT_MAX_AXES * RECORD_BYTES];
+    size_t length = 0;
+    uint32_t sequence = nextSequence;
+    for (uint32_t axis = 0; axis < axisCount; ++axis) {
+        if (changed[axis]) {
+            EncodeRecord(batch + length, axis, &states[axis], sequence++);
+            length += RECORD_BYTES;
+        }
+    }
+
+    if (pwrite(logFd, batch, length, offset) != (ssize_t)length || fsync(logFd) != 0) {
+        // Tried again on the next sample, as nothing is marked written
+        if (errno != lastWriteError) {
+            Log_Debug("ERROR: Could not write checkpoint: %s (%d).\n", strerror(errno), errno);
+            lastWriteError = errno;
+        }
+        return;
+    }
+    lastWriteError = 0;
+    nextSequence = sequence;
+    appendOffset = offset + (uint32_t)length;
+    for (uint32_t axis = 0; axis < axisCount; ++axis) {
+        if (changed[axis]) {
+            written[axis] = states[axis];
+            hasWritten[axis] = true;
+        }
+    }
+}
+
+// Nothing is written while anything moves, as the write would hold back the steps that are due; the move start
+// has already written every axis as moving. A planner or homing steps a motor without it running a move of its
+// own, so a position that changed since the last sample counts as moving too, and the axes are written at rest
+// once they have all stood still for a whole sample period.
+static void SampleTimerHandler(SoftTimer *timer)
+{
+    bool moving = IsAnythingMoving();
+    for (uint32_t axis = 0; axis < axisCount; ++axis) {
+        int32_t position = StepperMotor_GetPosition(checkpointMotors[axis]);
+        moving = moving || position != sampledPositions[axis];
+        sampledPositions[axis] = position;
+    }
+    if (!moving) {
+        WriteCheckpoints(true);
+    }
+}
+
+int Checkpoint_Open(StepperMotor *const *motors, uint32_t count, const MovePlanner *planner)
+{
+    if (count > CHECKPOINT_MAX_AXES) {
+        Log_Debug("ERROR: At most %d axes can be checkpointed.\n", CHECKPOINT_MAX_AXES);
+        return -1;
+    }
+    checkpointMotors = motors;
+    axisCount = count;
+    checkpointPlanner = planner;
+    lastWriteError = 0;
+    for (uint32_t axis = 0; axis < CHECKPOINT_MAX_AXES; ++axis) {
+        hasWritten[axis] = false;
+        positionKnown[axis] = false;
+        restored[axis] = false;
+    }
+
+    logFd = Storage_OpenMutableFile();
+    if (logFd < 0) {
+        Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    if (ReadLog() != 0) {
+        CloseFdAndPrintError(logFd, "Checkpoint log");
+        logFd = -1;
+        return -1;
+    }
+    for (uint32_t axis = 0; axis < axisCount; ++axis) {
+        RestoreAxis(axis);
+        sampledPositions[axis] = StepperMotor_GetPosition(motors[axis]);
+    }
+
+    SoftTimer_Init(&sampleTimer, &SampleTimerHandler);
+    static const struct timespec period = {CHECKPOINT_PERIOD_MS / 1000, (CHECKPOINT_PERIOD_MS % 1000) * 1000000L};
+    return SoftTimer_Start(&sampleTimer, &period, &period);
+}
+
+void Checkpoint_Close(void)
+{
+    SoftTimer_Stop(&sampleTimer);
+    if (logFd >= 0) {
+        WriteCheckpoints(!IsAnythingMoving());
+        CloseFdAndPrintError(logFd, "Checkpoint log");
+        logFd = -1;
+    }
+}
+
+void Checkpoint_MoveStarting(void)
+{
+    if (logFd >= 0) {
+        WriteCheckpoints(false);
+    }
+}
+
+bool Checkpoint_IsPositionKnown(uint32_t axis)
+{
+    return axis < axisCount && positionKnown[axis];
+}
+
+bool Checkpoint_WasRestored(uint32_t axis)
+{
+    return axis < axisCount && restored[axis];
+}
+
+void Checkpoint_SetPositionKnown(uint32_t axis)
+{
+    if (axis < axisCount) {
+        positionKnown[axis] = true;
+    }
+}
@@ -0,0 +1,73 @@
+/*
+Motor position checkpoints in mutable storage.
+Every motor's position, phase, step mode and whether it was at rest are kept in a small log in the app's mutable
+storage, so that after a restart the axes carry on from where they stopped instead of having to be homed again. The
+log is never written while anything moves, as a write holds up the event loop and with it any step that is due.
+Before the first step from rest, <see cref="Checkpoint_MoveStarting" /> writes every axis as moving, since another
+axis starting later could not be written without holding up the steps of this one. So if the app stops during a
+move, an axis that stood still through it comes back as not known too. The log is sampled from the timer wheel every
+CHECKPOINT_PERIOD_MS at low priority, and once nothing has moved for a whole sample period every axis that changed
+is written at rest, all in one write. Axes that stand still cost nothing. Records are appended round a fixed-size
+file, so the writes are spread evenly over the storage rather than wearing out one block, and whenever the log
+wraps the last state of every axis is written again at the start.
+An axis that was moving when the app stopped has lost its position, and comes back as not known until it is set
+with <see cref="Checkpoint_SetPositionKnown" />, for example after homing. Before the first checkpoint the
+position the motor was first started at is the origin, as it always was.
+
+Record layout, 16 bytes, little-endian:
+    magic(1) axis(1) stepMode(1) flags(1) sequence(4) position(4) checksum(4)
+    flags: bit 0 at rest, bit 1 position known, bits 4-7 the phase
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "move_planner.h"
+#include "stepper_motor.h"
+
+/// <summary>Axes that can be checkpointed.</summary>
+#define CHECKPOINT_MAX_AXES 4
+/// <summary>Size of the log in mutable storage. The manifest must allow at least this much.</summary>
+#define CHECKPOINT_LOG_BYTES 4096
+/// <summary>Time between samples, and so the shortest time between two writes.</summary>
+#define CHECKPOINT_PERIOD_MS 250
+
+/// <summary>
+///     Opens the log, restores the last position of every axis that was at rest and starts checkpointing.
+///     <see cref="TimerWheel_Init" /> must have been called, and the motors must not be moving.
+/// </summary>
+/// <param name="motors">Motors to checkpoint; must stay in memory until <see cref="Checkpoint_Close" /></param>
+/// <param name="count">Number of motors, at most CHECKPOINT_MAX_AXES</param>
+/// <param name="planner">Planner driving the motors, or NULL</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Checkpoint_Open(StepperMotor *const *motors, uint32_t count, const MovePlanner *planner);
+
+/// <summary>
+///     Writes a last checkpoint and closes the log. Call after motion has been stopped and before the motors
+///     are closed; if a motor is still running a move of its own, every axis is recorded as moving.
+/// </summary>
+void Checkpoint_Close(void);
+
+/// <summary>
+///     Writes every axis as moving unless the log already has them so. Call when a motor or the planner is about
+///     to start a move from rest, before its first step is scheduled, which is the
+///     <see cref="StepperMotorEvent_MoveStarting" /> and <see cref="MovePlannerEvent_MoveStarting" /> events.
+/// </summary>
+void Checkpoint_MoveStarting(void);
+
+/// <summary>
+///     Returns true if the position of an axis is known: restored from a checkpoint, never lost, or set since.
+/// </summary>
+bool Checkpoint_IsPositionKnown(uint32_t axis);
+
+/// <summary>
+///     Returns true if the position of an axis was restored from the log when it was opened, so it does not
+///     need to be homed.
+/// </summary>
+bool Checkpoint_WasRestored(uint32_t axis);
+
+/// <summary>
+///     Marks the position of an axis as known again, once it has been found some other way.
+/// </summary>
+void Checkpoint_SetPositionKnown(uint32_t axis);
@@ -0,0 +1,254 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "coil_bank.h"
+#include "epoll_timerfd_utilities.h"
+
+// The line handle is only for a device whose GPIO chip is known, see coil_bank.h. A host build never defines the
+// label, so it cannot request lines of whatever chips the machine it runs on has.
+#if defined(COIL_BANK_GPIO_CHIP_LABEL) && defined(__has_include)
+#if __has_include(<linux/gpio.h>)
+#include <linux/gpio.h>
+#define COIL_BANK_HAS_LINE_HANDLE 1
+#endif
+#endif
+
+#ifndef COIL_BANK_HAS_LINE_HANDLE
+#define COIL_BANK_HAS_LINE_HANDLE 0
+#endif
+
+#ifndef COIL_BANK_GPIO_LINE_BASE
+#define COIL_BANK_GPIO_LINE_BASE 0
+#endif
+
+// GPIO chips looked at for the line handle
+#define MAX_GPIO_CHIPS 8
+
+#if COIL_BANK_HAS_LINE_HANDLE
+static int OpenChip(void)
+{
+    for (int chip = 0; chip < MAX_GPIO_CHIPS; ++chip) {
+        char path[32];
+        snprintf(path, sizeof(path), "/dev/gpiochip%d", chip);
+        int chipFd = open(path, O_RDONLY | O_CLOEXEC);
+        if (chipFd < 0) {
+            continue;
+        }
+        struct gpiochip_info info;
+        if (ioctl(chipFd, GPIO_GET_CHIPINFO_IOCTL, &info) == 0 &&
+            strncmp(info.label, COIL_BANK_GPIO_CHIP_LABEL, sizeof(info.label)) == 0) {
+            return chipFd;
+        }
+        close(chipFd);
+    }
+    return -1;
+}
+
+// Each input has to be a line of the labelled chip, at its GPIO number less the chip's first, and not taken by
+// anything else. Anything that does not add up falls back to opening the inputs one by one.
+static bool FindLineOffsets(int chipFd, const GPIO_Id *gpios, struct gpiohandle_request *request)
+{
+    struct gpiochip_info info;
+    if (ioctl(chipFd, GPIO_GET_CHIPINFO_IOCTL, &info) != 0) {
+        return false;
+    }
+    for (int coil = 0; coil < COIL_COUNT; ++coil) {
+        int32_t offset = (int32_t)gpios[coil] - COIL_BANK_GPIO_LINE_BASE;
+        if (offset < 0 || (uint32_t)offset >= info.lines) {
+            return false;
+        }
+        struct gpioline_info line = {.line_offset = (uint32_t)offset};
+        if (ioctl(chipFd, GPIO_GET_LINEINFO_IOCTL, &line) != 0 || (line.flags & GPIOLINE_FLAG_KERNEL) != 0) {
+            return false;
+        }
+        request->lineoffsets[coil] = (uint32_t)offset;
+        request->default_values[coil] = 1;
+    }
+    return true;
+}
+
+static int OpenLineHandle(const GPIO_Id *gpios)
+{
+    int chipFd = OpenChip();
+    if (chipFd < 0) {
+        return -1;
+    }
+    struct gpiohandle_request request = {.flags = GPIOHANDLE_REQUEST_OUTPUT, .lines = COIL_COUNT};
+    int result = -1;
+    if (FindLineOffsets(chipFd, gpios, &request)) {
+        strncpy(request.consumer_label, "stepper coils", sizeof(request.consumer_label) - 1);
+        result = ioctl(chipFd, GPIO_GET_LINEHANDLE_IOCTL, &request);
+    }
+    close(chipFd);
+    return result == 0 ? request.fd : -1;
+}
+
+static int WriteLines(CoilBank *bank, uint8_t coilMask)
+{
+    struct gpiohandle_data data = {};
+    for (int coil = 0; coil < COIL_COUNT; ++coil) {
+        data.values[coil] = (coilMask & (1u << coil)) != 0 ? 0 : 1;
+    }
+    if (ioctl(bank->lineFd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) != 0) {
+        return -1;
+    }
+    bank->writtenMask = coilMask;
+    return 0;
+}
+#else
+static int OpenLineHandle(const GPIO_Id *gpios)
+{
+    return -1;
+}
+
+static int WriteLines(CoilBank *bank, uint8_t coilMask)
+{
+    return -1;
+}
+#endif
+
+static int WritePins(CoilBank *bank, uint8_t bits, GPIO_Value_Type value)
+{
+    int result = 0;
+    for (int coil = 0; coil < COIL_COUNT; ++coil) {
+        uint8_t bit = (uint8_t)(1u << coil);
+        if ((bits & bit) == 0) {
+            continue;
+        }
+        if (GPIO_SetValue(bank->pinFds[coil], value) == 0) {
+            bank->writtenMask ^= bit;
+        } else {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+static uint64_t NowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t OnTimeSince(const CoilBank *bank, uint64_t nowNs)
+{
+    return (uint64_t)__builtin_popcount(bank->writtenMask) * (nowNs - bank->changedNs);
+}
+
+// Close the on time of the coils that are on so far, before the mask changes
+static void AccountOnTime(CoilBank *bank)
+{
+    uint64_t nowNs = NowNs();
+    bank->onTimeNs += OnTimeSince(bank, nowNs);
+    bank->changedNs = nowNs;
+}
+
+static int OpenInputs(CoilBank *bank)
+{
+    AccountOnTime(bank);
+    bank->writtenMask = 0;
+    for (int coil = 0; coil < COIL_COUNT; ++coil) {
+        bank->pinFds[coil] = -1;
+    }
+
+    const GPIO_Id *gpios = bank->gpios;
+    bank->lineFd = OpenLineHandle(gpios);
+    if (bank->lineFd >= 0) {
+        Log_Debug("Coil GPIOs %d,%d,%d,%d opened as one port.\n", gpios[0], gpios[1], gpios[2], gpios[3]);
+        return 0;
+    }
+
+    for (int coil = 0; coil < COIL_COUNT; ++coil) {
+        bank->pinFds[coil] = GPIO_OpenAsOutput(gpios[coil], GPIO_OutputMode_PushPull, GPIO_Value_High);
+        if (bank->pinFds[coil] < 0) {
+            Log_Debug("ERROR: Could not open IN%d GPIO: %s (%d).\n", coil + 1, strerror(errno), errno);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void CloseInputs(CoilBank *bank)
+{
+    CloseFdAndPrintError(bank->lineFd, "Coil GPIOs");
+    bank->lineFd = -1;
+    static const char *const coilNames[COIL_COUNT] = {"IN1 GPIO", "IN2 GPIO", "IN3 GPIO", "IN4 GPIO"};
+    for (int coil = 0; coil < COIL_COUNT; ++coil) {
+        CloseFdAndPrintError(bank->pinFds[coil], coilNames[coil]);
+        bank->pinFds[coil] = -1;
+    }
+}
+
+static int WriteMask(CoilBank *bank, uint8_t coilMask)
+{
+    uint8_t changed = coilMask ^ bank->writtenMask;
+    if (changed == 0) {
+        return 0;
+    }
+    AccountOnTime(bank);
+    if (bank->lineFd >= 0) {
+        return WriteLines(bank, coilMask);
+    }
+
+    // Switch off before switching on, so the driver only ever passes through coils the two phases share
+    int releaseResult = WritePins(bank, changed & ~coilMask, GPIO_Value_High);
+    int energizeResult = WritePins(bank, changed & coilMask, GPIO_Value_Low);
+    return releaseResult == 0 && energizeResult == 0 ? 0 : -1;
+}
+
+int CoilBank_Open(CoilBank *bank, const GPIO_Id *gpios)
+{
+    for (int coil = 0; coil < COIL_COUNT; ++coil) {
+        bank->gpios[coil] = gpios[coil];
+    }
+    bank->recovery = (RecoveryBudget)RECOVERY_BUDGET("Coil GPIOs");
+    bank->writtenMask = 0;
+    bank->onTimeNs = 0;
+    bank->changedNs = NowNs();
+    return OpenInputs(bank);
+}
+
+void CoilBank_Close(CoilBank *bank)
+{
+    if (bank->lineFd >= 0 || bank->pinFds[0] >= 0) {
+        WriteMask(bank, 0);
+    }
+    CloseInputs(bank);
+}
+
+int CoilBank_Write(CoilBank *bank, uint8_t coilMask)
+{
+    if (WriteMask(bank, coilMask) == 0) {
+        return 0;
+    }
+    int error = errno;
+    if (!Recovery_Allow(&bank->recovery, error)) {
+        return -1;
+    }
+    if (!Recovery_IsTransient(error)) {
+        // The inputs come back High, every coil off, and the phase is written again straight away
+        CloseInputs(bank);
+        if (OpenInputs(bank) != 0) {
+            return -1;
+        }
+    }
+    return WriteMask(bank, coilMask);
+}
+
+uint8_t CoilBank_GetMask(const CoilBank *bank)
+{
+    return bank->writtenMask;
+}
+
+uint64_t CoilBank_GetOnTimeNs(const CoilBank *bank)
+{
+    return bank->onTimeNs + OnTimeSince(bank, NowNs());
+}
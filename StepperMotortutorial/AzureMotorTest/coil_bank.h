@@ -0,0 +1,74 @@
+/*
+The four driver inputs as one output port.
+Where the GPIO character device is available and all four inputs are lines of the same chip, they are requested
+as a single line handle and every phase change is one ioctl that sets all four levels at once. That is only built
+for a device whose chip is known: define COIL_BANK_GPIO_CHIP_LABEL to the label the chip reports, and
+COIL_BANK_GPIO_LINE_BASE to the GPIO number of its line 0 if that is not 0. The chip is found by its label and
+each input must be a free line of it. Without a line handle each input is opened with GPIO_OpenAsOutput and only
+the inputs that change are written, coils that switch off first: between two phases the driver then only ever sees
+coils that are on in both, never more than either phase has.
+A coil is energized by driving its input Low. The bank also adds up how long each coil has been on, which is what
+heats the motor.
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include <applibs/gpio.h>
+
+#include "recovery.h"
+#include "step_sequence.h"
+
+/// <summary>
+///     State of one coil bank. Treat the members as private to coil_bank.c.
+/// </summary>
+typedef struct {
+    /// <summary>Handle for all four lines, or -1 if the inputs are written one by one.</summary>
+    int lineFd;
+    /// <summary>One GPIO per input when there is no line handle.</summary>
+    int pinFds[COIL_COUNT];
+    /// <summary>Coils as last written to the driver.</summary>
+    uint8_t writtenMask;
+    /// <summary>Time each coil has been on, added up over the coils, up to changedNs.</summary>
+    uint64_t onTimeNs;
+    /// <summary>CLOCK_MONOTONIC time writtenMask last changed.</summary>
+    uint64_t changedNs;
+    /// <summary>GPIOs wired to IN1..IN4, for reopening them.</summary>
+    GPIO_Id gpios[COIL_COUNT];
+    /// <summary>Write faults; the inputs are reopened until these run out.</summary>
+    RecoveryBudget recovery;
+} CoilBank;
+
+/// <summary>
+///     Opens the driver inputs High, with every coil off.
+/// </summary>
+/// <param name="bank">Bank state</param>
+/// <param name="gpios">GPIOs wired to IN1..IN4</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int CoilBank_Open(CoilBank *bank, const GPIO_Id *gpios);
+
+/// <summary>
+///     Switches every coil off and closes the inputs. Does nothing if the bank is not open.
+/// </summary>
+void CoilBank_Close(CoilBank *bank);
+
+/// <summary>
+///     Energizes exactly the coils in a mask. Nothing is written if the mask is the one already on the inputs.
+///     A failed write is retried at once, after reopening the inputs unless the error goes away by itself; an
+///     input that still fails keeps its old level and is written again on the next call.
+/// </summary>
+/// <param name="bank">Bank state</param>
+/// <param name="coilMask">Bit n set for every coil INn+1 to energize</param>
+/// <returns>0 on success, or -1 if an input could not be written</returns>
+int CoilBank_Write(CoilBank *bank, uint8_t coilMask);
+
+/// <summary>
+///     Returns the mask of the coils as last written.
+/// </summary>
+uint8_t CoilBank_GetMask(const CoilBank *bank);
+
+/// <summary>
+///     Returns the time each coil has been on since the bank was opened, added up over the four coils, so two
+///     coils on for a second count two seconds.
+/// </summary>
+uint64_t CoilBank_GetOnTimeNs(const CoilBank *bank);
@@ -7,6 +7,8 @@
 #include <sys/timerfd.h>
 #include <applibs/log.h>
 #include "epoll_timerfd_utilities.h"
+#include "latency_stats.h"
+#include "recovery.h"
 
 int CreateEpollFd(void)
 {
@@ -21,10 +23,48 @@ int CreateEpollFd(void)
     return epollFd;
 }
 
+// Real-time sources, for the earliest deadline that low-priority work must leave room for
+static EventData *realTimeSources[EVENT_LOOP_MAX_REAL_TIME_SOURCES];
+static uint32_t realTimeSourceCount = 0;
+static uint32_t lowPrioritySliceNs = 0;
+// End of the current low-priority slice while low-priority handlers run, otherwise UINT64_MAX
+static uint64_t lowPrioritySliceEndNs = UINT64_MAX;
+
+static int AddRealTimeSource(EventData *eventData)
+{
+    for (uint32_t i = 0; i < realTimeSourceCount; ++i) {
+        if (realTimeSources[i] == eventData) {
+            return 0;
+        }
+    }
+    if (realTimeSourceCount == EVENT_LOOP_MAX_REAL_TIME_SOURCES) {
+        Log_Debug("ERROR: More than %d real-time event sources.\n", EVENT_LOOP_MAX_REAL_TIME_SOURCES);
+        return -1;
+    }
+    realTimeSources[realTimeSourceCount++] = eventData;
+    return 0;
+}
+
+static void RemoveRealTimeSource(int eventFd)
+{
+    for (uint32_t i = 0; i < realTimeSourceCount; ++i) {
+        if (realTimeSources[i]->fd == eventFd) {
+            realTimeSources[i] = realTimeSources[--realTimeSourceCount];
+            return;
+        }
+    }
+}
+
 int RegisterEventHandlerToEpoll(int epollFd, int eventFd, EventData *persistentEventData,
                                 const uint32_t epollEventMask)
 {
     persistentEventData->fd = eventFd;
+    // A real-time source added here is dropped again if epoll does not take it, or its deadline would go on
+    // cutting the low-priority slice short and it would keep its slot
+    uint32_t trackedCount = realTimeSourceCount;
+    if (persistentEventData->priority == EventPriority_RealTime && AddRealTimeSource(persistentEventData) != 0) {
+        return -1;
+    }
     struct epoll_event eventToAddOrModify = {.data.ptr = persistentEventData,
                                              .events = epollEventMask};
 
@@ -36,6 +76,7 @@ int RegisterEventHandlerToEpoll(int epollFd, int eventFd, EventData *persistentE
         if (epoll_ctl(epollFd, EPOLL_CTL_MOD, eventFd, &eventToAddOrModify) == -1) {
             Log_Debug("ERROR: Could not register event to epoll instance: %s (%d).\n",
                       strerror(errno), errno);
+            realTimeSourceCount = trackedCount;
             return -1;
         }
     }
@@ -54,6 +95,7 @@ int UnregisterEventHandlerFromEpoll(int epollFd, int eventFd)
             return -1;
         }
     }
+    RemoveRealTimeSource(eventFd);
 
     return 0;
 }
@@ -82,11 +124,37 @@ int SetTimerFdToSingleExpiry(int timerFd, const struct timespec *expiry)
     return 0;
 }
 
+int SetTimerFdToAbsoluteExpiry(int timerFd, const struct timespec *deadline)
+{
+    struct itimerspec newValue = {.it_value = *deadline, .it_interval = {}};
+
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &newValue, NULL) < 0) {
+        Log_Debug("ERROR: Could not set timerfd deadline: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+int DisarmTimerFd(int timerFd)
+{
+    struct itimerspec newValue = {.it_value = {}, .it_interval = {}};
+
+    if (timerfd_settime(timerFd, 0, &newValue, NULL) < 0) {
+        Log_Debug("ERROR: Could not disarm timerfd: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    return 0;
+}
+
 int ConsumeTimerFdEvent(int timerFd)
 {
     uint64_t timerData = 0;
 
-    if (read(timerFd, &timerData, sizeof(timerData)) == -1) {
+    // Re-arming a timer that has expired clears it, so a handler that ran earlier in the same wakeup can leave
+    // it with nothing to read
+    if (read(timerFd, &timerData, sizeof(timerData)) == -1 && errno != EAGAIN) {
         Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
         return -1;
     }
@@ -119,6 +187,60 @@ int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
     return timerFd;
 }
 
+int ReplaceTimerFd(int epollFd, int timerFd, EventData *persistentEventData)
+{
+    UnregisterEventHandlerFromEpoll(epollFd, timerFd);
+    CloseFdAndPrintError(timerFd, "Failed timer");
+    static const struct timespec disarmed = {0, 0};
+    return CreateTimerFdAndAddToEpoll(epollFd, &disarmed, persistentEventData, EPOLLIN);
+}
+
+static uint64_t MonotonicNowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// Runs a handler, timing it if it asked to be measured.
+static void CallHandler(EventData *eventData)
+{
+    if (eventData->stats == NULL) {
+        eventData->eventHandler(eventData);
+        return;
+    }
+    uint64_t startNs = MonotonicNowNs();
+    eventData->eventHandler(eventData);
+    LatencyHistogram_Record(&eventData->stats->executionTime, MonotonicNowNs() - startNs);
+}
+
+// Higher priority first; within a priority, a source with a deadline goes before one without, earlier first.
+static bool RunsBefore(const EventData *a, const EventData *b)
+{
+    if (a->priority != b->priority) {
+        return a->priority > b->priority;
+    }
+    return a->deadlineNs != 0 && (b->deadlineNs == 0 || a->deadlineNs < b->deadlineNs);
+}
+
+static uint64_t LowPrioritySliceEnd(uint64_t wakeupNs)
+{
+    uint64_t endNs = wakeupNs + lowPrioritySliceNs;
+    for (uint32_t i = 0; i < realTimeSourceCount; ++i) {
+        uint64_t deadlineNs = realTimeSources[i]->deadlineNs;
+        if (deadlineNs == 0) {
+            continue;
+        }
+        // A deadline that has already passed ends the slice at once; the step is ready by the next wait
+        uint64_t stopNs =
+            deadlineNs > EVENT_LOOP_DEADLINE_GUARD_NS ? deadlineNs - EVENT_LOOP_DEADLINE_GUARD_NS : 0;
+        if (stopNs < endNs) {
+            endNs = stopNs;
+        }
+    }
+    return endNs;
+}
+
 int WaitForEventAndCallHandler(int epollFd)
 {
     struct epoll_event event;
@@ -134,13 +256,82 @@ int WaitForEventAndCallHandler(int epollFd)
     }
 
     if (numEventsOccurred == 1 && event.data.ptr != NULL) {
-        EventData *eventData = event.data.ptr;
-        eventData->eventHandler(eventData);
+        CallHandler(event.data.ptr);
     }
 
     return 0;
 }
 
+int WaitForEventsAndCallHandlers(int epollFd, int maxEvents)
+{
+    struct epoll_event events[EPOLL_MAX_EVENTS_PER_WAIT];
+
+    if (maxEvents < 1 || maxEvents > EPOLL_MAX_EVENTS_PER_WAIT) {
+        maxEvents = EPOLL_MAX_EVENTS_PER_WAIT;
+    }
+
+    int numEventsOccurred = epoll_wait(epollFd, events, maxEvents, -1);
+
+    if (numEventsOccurred == -1) {
+        if (errno == EINTR) {
+            // interrupted by signal, e.g. due to breakpoint being set; ignore
+            return 0;
+        }
+        int error = errno;
+        Log_Debug("ERROR: Failed waiting on events: %s (%d).\n", strerror(error), error);
+        // Left for the caller, which decides from it whether to carry on
+        errno = error;
+        return -1;
+    }
+
+    uint64_t wakeupNs = lowPrioritySliceNs != 0 ? MonotonicNowNs() : 0;
+
+    // Collect the handlers and stable-sort them by priority, then deadline. The batch is never larger than
+    // EPOLL_MAX_EVENTS_PER_WAIT, so an insertion sort is cheaper than anything fancier.
+    EventData *ready[EPOLL_MAX_EVENTS_PER_WAIT];
+    int numReady = 0;
+    for (int i = 0; i < numEventsOccurred; ++i) {
+        EventData *eventData = events[i].data.ptr;
+        if (eventData == NULL) {
+            continue;
+        }
+        int j = numReady++;
+        while (j > 0 && RunsBefore(eventData, ready[j - 1])) {
+            ready[j] = ready[j - 1];
+            --j;
+        }
+        ready[j] = eventData;
+    }
+
+    int numHandled = 0;
+    for (; numHandled < numReady; ++numHandled) {
+        EventData *eventData = ready[numHandled];
+        if (eventData->priority == EventPriority_Low && lowPrioritySliceNs != 0) {
+            // The real-time handlers of this batch have run by now, so their deadlines are the next ones
+            if (lowPrioritySliceEndNs == UINT64_MAX) {
+                lowPrioritySliceEndNs = LowPrioritySliceEnd(wakeupNs);
+            }
+            if (MonotonicNowNs() >= lowPrioritySliceEndNs) {
+                break;
+            }
+        }
+        CallHandler(eventData);
+    }
+    lowPrioritySliceEndNs = UINT64_MAX;
+
+    return numHandled;
+}
+
+void EventLoop_SetLowPrioritySlice(uint32_t sliceNs)
+{
+    lowPrioritySliceNs = sliceNs;
+}
+
+bool EventLoop_ShouldYield(void)
+{
+    return lowPrioritySliceEndNs != UINT64_MAX && MonotonicNowNs() >= lowPrioritySliceEndNs;
+}
+
 void CloseFdAndPrintError(int fd, const char *fdName)
 {
     if (fd >= 0) {
@@ -149,4 +340,327 @@ void CloseFdAndPrintError(int fd, const char *fdName)
             Log_Debug("ERROR: Could not close fd %s: %s (%d).\n", fdName, strerror(errno), errno);
         }
     }
-}
\ No newline at end of file
+}
+
+// Timer wheel: all software timers share one timerfd. The wheel has four levels: 256 slots of one tick, then
+// three levels of 64 slots that are each 64 times coarser, which reaches about 18.6 hours at 1 ms ticks. A timer
+// goes in the finest level that can hold its expiry; when a coarse slot comes round its timers are placed again
+// in the finer levels. Timers further out than the top level wait in its furthest slot and are placed again
+// when it comes round. The timerfd is armed for the earliest occupied slot only, so an idle wheel never wakes up.
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOT_COUNT 448
+
+static const uint32_t wheelLevelShift[WHEEL_LEVELS] = {0, 8, 14, 20};
+static const uint32_t wheelLevelSlots[WHEEL_LEVELS] = {256, 64, 64, 64};
+static const uint32_t wheelLevelOffset[WHEEL_LEVELS] = {0, 256, 320, 384};
+
+static void TimerWheelEventHandler(EventData *eventData);
+
+// Software timers are for housekeeping, so they run after any step that is due in the same wakeup
+static EventData wheelEventData = {.eventHandler = &TimerWheelEventHandler, .priority = EventPriority_Low};
+static RecoveryBudget wheelRecovery = RECOVERY_BUDGET("Timer wheel timer");
+static int wheelEpollFd = -1;
+static int wheelTimerFd = -1;
+static SoftTimer *wheelSlots[WHEEL_SLOT_COUNT];
+// One bit per slot that holds at least one timer
+static uint64_t wheelOccupied[WHEEL_SLOT_COUNT / 64];
+static uint64_t wheelEpochNs = 0;
+// Last tick whose timers have run
+static uint64_t wheelTick = 0;
+// Tick the timerfd is armed for, or UINT64_MAX when disarmed
+static uint64_t wheelArmedTick = UINT64_MAX;
+static uint32_t wheelRunningCount = 0;
+// Set while timers run, so that restarting timers from a handler does not re-arm the timerfd every time
+static bool wheelDispatching = false;
+
+static uint64_t WheelTickOf(uint64_t ns)
+{
+    return (ns - wheelEpochNs) / TIMER_WHEEL_TICK_NS;
+}
+
+static uint64_t TicksOf(const struct timespec *duration)
+{
+    uint64_t ns = (uint64_t)duration->tv_sec * 1000000000u + (uint64_t)duration->tv_nsec;
+    uint64_t ticks = (ns + TIMER_WHEEL_TICK_NS - 1) / TIMER_WHEEL_TICK_NS;
+    return ticks > 0 ? ticks : 1;
+}
+
+static uint32_t WheelSlotFor(uint64_t expiryTick)
+{
+    for (uint32_t level = 0;; ++level) {
+        uint32_t shift = wheelLevelShift[level];
+        uint32_t slots = wheelLevelSlots[level];
+        uint64_t distance = (expiryTick >> shift) - (wheelTick >> shift);
+        if (distance < slots || level == WHEEL_LEVELS - 1) {
+            if (distance >= slots) {
+                distance = slots - 1;
+            }
+            return wheelLevelOffset[level] + (uint32_t)(((wheelTick >> shift) + distance) & (slots - 1));
+        }
+    }
+}
+
+static void WheelInsert(SoftTimer *timer)
+{
+    uint32_t slot = WheelSlotFor(timer->expiryTick);
+    timer->slot = slot;
+    timer->previous = NULL;
+    timer->next = wheelSlots[slot];
+    if (timer->next != NULL) {
+        timer->next->previous = timer;
+    }
+    wheelSlots[slot] = timer;
+    wheelOccupied[slot / 64] |= 1ull << (slot % 64);
+}
+
+static void WheelRemove(SoftTimer *timer)
+{
+    if (timer->previous != NULL) {
+        timer->previous->next = timer->next;
+    } else {
+        wheelSlots[timer->slot] = timer->next;
+        if (timer->next == NULL) {
+            wheelOccupied[timer->slot / 64] &= ~(1ull << (timer->slot % 64));
+        }
+    }
+    if (timer->next != NULL) {
+        timer->next->previous = timer->previous;
+    }
+    timer->next = NULL;
+    timer->previous = NULL;
+}
+
+// Distance from 'from' to the first occupied slot of a level, going round once, or UINT32_MAX if it is empty.
+// Every level is a whole number of bitmap words, so the scan skips 64 empty slots at a time.
+static uint32_t WheelOccupiedDistance(uint32_t level, uint32_t from)
+{
+    uint32_t slots = wheelLevelSlots[level];
+    for (uint32_t distance = 0; distance < slots;) {
+        uint32_t bit = wheelLevelOffset[level] + ((from + distance) & (slots - 1));
+        uint64_t word = wheelOccupied[bit / 64] >> (bit % 64);
+        if (word != 0) {
+            return distance + (uint32_t)__builtin_ctzll(word);
+        }
+        distance += 64 - bit % 64;
+    }
+    return UINT32_MAX;
+}
+
+// The next tick at which something has to happen: a fine slot whose timers are due, or a coarse slot whose
+// timers have to be placed again. UINT64_MAX if no timer is running.
+static uint64_t WheelNextEventTick(void)
+{
+    uint64_t next = UINT64_MAX;
+    for (uint32_t level = 0; level < WHEEL_LEVELS; ++level) {
+        uint32_t shift = wheelLevelShift[level];
+        uint64_t base = wheelTick >> shift;
+        // The current fine slot may still hold timers due right now; coarse slots are only ever ahead
+        uint32_t first = level == 0 ? 0 : 1;
+        uint32_t distance =
+            WheelOccupiedDistance(level, (uint32_t)((base + first) & (wheelLevelSlots[level] - 1)));
+        if (distance != UINT32_MAX) {
+            uint64_t tick = (base + first + distance) << shift;
+            if (tick < next) {
+                next = tick;
+            }
+        }
+    }
+    return next;
+}
+
+static int WheelProgram(void)
+{
+    uint64_t next = WheelNextEventTick();
+    if (next == wheelArmedTick) {
+        return 0;
+    }
+    wheelArmedTick = next;
+    if (next == UINT64_MAX) {
+        return DisarmTimerFd(wheelTimerFd);
+    }
+
+    uint64_t deadlineNs = wheelEpochNs + next * TIMER_WHEEL_TICK_NS;
+    struct timespec deadline = {(time_t)(deadlineNs / 1000000000u), (long)(deadlineNs % 1000000000u)};
+    return SetTimerFdToAbsoluteExpiry(wheelTimerFd, &deadline);
+}
+
+// Put a new timerfd in place of one that failed. Every timer lives in the wheel, not in the fd, so none is lost.
+static int WheelRebuild(int error)
+{
+    if (!Recovery_Allow(&wheelRecovery, error)) {
+        return -1;
+    }
+    wheelTimerFd = ReplaceTimerFd(wheelEpollFd, wheelTimerFd, &wheelEventData);
+    wheelArmedTick = UINT64_MAX;
+    return wheelTimerFd < 0 ? -1 : 0;
+}
+
+static int WheelArm(void)
+{
+    if (WheelProgram() == 0) {
+        return 0;
+    }
+    wheelArmedTick = UINT64_MAX;
+    if (WheelRebuild(errno) != 0) {
+        return -1;
+    }
+    return WheelProgram();
+}
+
+// Run tick 'tick': place the timers of the coarse slots that start here again, then fire the fine slot. Returns
+// false if the event loop asked to yield before the fine slot was empty; running the same tick again later
+// picks up where this left off, as nothing is ever placed in a coarse slot that starts at the current tick.
+static bool WheelProcessTick(uint64_t tick, uint64_t nowNs)
+{
+    wheelTick = tick;
+
+    for (uint32_t level = WHEEL_LEVELS - 1; level > 0; --level) {
+        uint32_t shift = wheelLevelShift[level];
+        if ((tick & ((1ull << shift) - 1)) != 0) {
+            continue;
+        }
+        uint32_t slot = wheelLevelOffset[level] + (uint32_t)((tick >> shift) & (wheelLevelSlots[level] - 1));
+        SoftTimer *timer;
+        while ((timer = wheelSlots[slot]) != NULL) {
+            WheelRemove(timer);
+            WheelInsert(timer);
+        }
+    }
+
+    uint32_t slot = (uint32_t)(tick & (wheelLevelSlots[0] - 1));
+    SoftTimer *timer;
+    while ((timer = wheelSlots[slot]) != NULL) {
+        WheelRemove(timer);
+        uint64_t dueNs = wheelEpochNs + timer->expiryTick * TIMER_WHEEL_TICK_NS;
+        if (timer->periodTicks > 0) {
+            // Periodic timers keep their phase; expiries that were missed entirely are skipped
+            timer->expiryTick += timer->periodTicks;
+            if (timer->expiryTick <= tick) {
+                timer->expiryTick += ((tick - timer->expiryTick) / timer->periodTicks + 1) * timer->periodTicks;
+            }
+            WheelInsert(timer);
+        } else {
+            timer->isRunning = false;
+            --wheelRunningCount;
+        }
+
+        if (timer->stats == NULL) {
+            timer->handler(timer);
+        } else {
+            LatencyHistogram_Record(&timer->stats->wakeupLatency, nowNs > dueNs ? nowNs - dueNs : 0);
+            uint64_t startNs = MonotonicNowNs();
+            timer->handler(timer);
+            LatencyHistogram_Record(&timer->stats->executionTime, MonotonicNowNs() - startNs);
+        }
+        if (EventLoop_ShouldYield()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void TimerWheelEventHandler(EventData *eventData)
+{
+    if (ConsumeTimerFdEvent(wheelTimerFd) != 0 && WheelRebuild(errno) != 0) {
+        Log_Debug("ERROR: Could not recover the timer wheel.\n");
+        return;
+    }
+    wheelArmedTick = UINT64_MAX;
+
+    uint64_t nowNs = MonotonicNowNs();
+    uint64_t nowTick = WheelTickOf(nowNs);
+    wheelDispatching = true;
+    uint64_t next;
+    bool yielded = false;
+    while ((next = WheelNextEventTick()) <= nowTick + TIMER_WHEEL_COALESCE_TICKS) {
+        // Timers left over are still due, so the timerfd is armed in the past and they run next wakeup
+        if (!WheelProcessTick(next, nowNs)) {
+            yielded = true;
+            break;
+        }
+    }
+    // Nothing is due up to now, so new timers can be placed relative to now
+    if (!yielded && wheelTick < nowTick) {
+        wheelTick = nowTick;
+    }
+    wheelDispatching = false;
+
+    if (WheelArm() != 0) {
+        Log_Debug("ERROR: Could not arm the timer wheel.\n");
+    }
+}
+
+int TimerWheel_Init(int epollFd)
+{
+    memset(wheelSlots, 0, sizeof(wheelSlots));
+    memset(wheelOccupied, 0, sizeof(wheelOccupied));
+    wheelEpochNs = MonotonicNowNs();
+    wheelTick = 0;
+    wheelArmedTick = UINT64_MAX;
+    wheelRunningCount = 0;
+    wheelEpollFd = epollFd;
+
+    static const struct timespec disarmed = {0, 0};
+    wheelTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &disarmed, &wheelEventData, EPOLLIN);
+    return wheelTimerFd < 0 ? -1 : 0;
+}
+
+void TimerWheel_Close(void)
+{
+    for (uint32_t slot = 0; slot < WHEEL_SLOT_COUNT; ++slot) {
+        SoftTimer *timer;
+        while ((timer = wheelSlots[slot]) != NULL) {
+            WheelRemove(timer);
+            timer->isRunning = false;
+        }
+    }
+    wheelRunningCount = 0;
+    CloseFdAndPrintError(wheelTimerFd, "Timer wheel");
+    wheelTimerFd = -1;
+}
+
+void SoftTimer_Init(SoftTimer *timer, SoftTimerHandler handler)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->handler = handler;
+}
+
+int SoftTimer_Start(SoftTimer *timer, const struct timespec *delay, const struct timespec *period)
+{
+    if (timer->isRunning) {
+        WheelRemove(timer);
+    } else {
+        ++wheelRunningCount;
+    }
+
+    uint64_t nowTick = WheelTickOf(MonotonicNowNs());
+    if (wheelRunningCount == 1 && !wheelDispatching && wheelTick < nowTick) {
+        // The wheel was empty, so it can start turning from now
+        wheelTick = nowTick;
+    }
+    // The current tick may already have run if it was pulled forward by coalescing
+    timer->expiryTick = (nowTick > wheelTick ? nowTick : wheelTick) + TicksOf(delay);
+    timer->periodTicks = period != NULL ? TicksOf(period) : 0;
+    timer->isRunning = true;
+    WheelInsert(timer);
+
+    return wheelDispatching ? 0 : WheelArm();
+}
+
+void SoftTimer_Stop(SoftTimer *timer)
+{
+    if (!timer->isRunning) {
+        return;
+    }
+    WheelRemove(timer);
+    timer->isRunning = false;
+    --wheelRunningCount;
+    if (!wheelDispatching && WheelArm() != 0) {
+        Log_Debug("ERROR: Could not arm the timer wheel.\n");
+    }
+}
+
+bool SoftTimer_IsRunning(const SoftTimer *timer)
+{
+    return timer->isRunning;
+}
@@ -2,6 +2,8 @@
    Licensed under the MIT License. */
 
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/epoll.h>
 #include <unistd.h>
@@ -9,6 +11,37 @@
 /// Forward declaration of the data type passed to the handlers.
 struct EventData;
 
+/// Forward declaration of the per-handler latency figures, see latency_stats.h.
+struct EventLatencyStats;
+
+/// <summary>
+///     Maximum number of ready events drained by a single call to
+///     <see cref="WaitForEventsAndCallHandlers" />.
+/// </summary>
+#define EPOLL_MAX_EVENTS_PER_WAIT 8
+
+/// <summary>
+///     Maximum number of real-time event sources whose deadlines the dispatcher keeps track of.
+/// </summary>
+#define EVENT_LOOP_MAX_REAL_TIME_SOURCES 4
+
+/// <summary>
+///     How long before the earliest real-time deadline low-priority work stops, so that the wakeup for it is not
+///     held up by a handler that is already running.
+/// </summary>
+#define EVENT_LOOP_DEADLINE_GUARD_NS 200000u
+
+/// <summary>
+///     Dispatch priority of an event. When several events are ready in the same wakeup,
+///     higher priorities are handled first. The zero value is the default for handlers
+///     that do not set a priority.
+/// </summary>
+typedef enum {
+    EventPriority_Low = -1,
+    EventPriority_Normal = 0,
+    EventPriority_RealTime = 1
+} EventPriority;
+
 /// <summary>
 ///     Function signature for event handlers.
 /// </summary>
@@ -31,6 +64,20 @@ typedef struct EventData {
     /// The file descriptor that generated the event.
     /// </summary>
     int fd;
+    /// <summary>
+    /// Order in which the handler runs relative to other events ready in the same wakeup.
+    /// </summary>
+    EventPriority priority;
+    /// <summary>
+    /// CLOCK_MONOTONIC time in nanoseconds the next event of this source is due, or 0 if none is pending. Kept
+    /// up to date by the owner of a real-time source. Ready events of equal priority run earliest deadline
+    /// first, and sliced low-priority work stops short of the earliest real-time deadline.
+    /// </summary>
+    uint64_t deadlineNs;
+    /// <summary>
+    /// Where to record the handler's latency, or NULL to not measure it.
+    /// </summary>
+    struct EventLatencyStats *stats;
 } EventData;
 
 /// <summary>
@@ -76,9 +123,31 @@ int SetTimerFdToPeriod(int timerFd, const struct timespec *period);
 /// <returns>0 on success, or -1 on failure</returns>
 int SetTimerFdToSingleExpiry(int timerFd, const struct timespec *expiry);
 
+/// <summary>
+///     Sets a timer to fire once only, at an absolute CLOCK_MONOTONIC time. Unlike
+///     <see cref="SetTimerFdToSingleExpiry" /> the expiry does not move by however long it took
+///     to get from reading the clock to arming the timer, so a chain of deadlines re-armed one
+///     after another does not drift. A deadline that has already passed fires immediately.
+/// </summary>
+/// <param name="timerFd">Timer file descriptor</param>
+/// <param name="deadline">The absolute time at which it expires</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int SetTimerFdToAbsoluteExpiry(int timerFd, const struct timespec *deadline);
+
+/// <summary>
+///     Disarms a timer so that it does not expire again until it is re-armed with
+///     <see cref="SetTimerFdToPeriod" />, <see cref="SetTimerFdToSingleExpiry" /> or
+///     <see cref="SetTimerFdToAbsoluteExpiry" />.
+///     Any expirations that have not been consumed yet are discarded.
+/// </summary>
+/// <param name="timerFd">Timer file descriptor</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int DisarmTimerFd(int timerFd);
+
 /// <summary>
 ///     Consumes an event by reading from the timer file descriptor.
-///     If the event is not consumed, then it will immediately recur.
+///     If the event is not consumed, then it will immediately recur. A timer that was re-armed
+///     after epoll reported it has nothing to read, which counts as success.
 /// </summary>
 /// <param name="timerFd">Timer file descriptor</param>
 /// <returns>0 on success, or -1 on failure</returns>
@@ -96,6 +165,16 @@ int ConsumeTimerFdEvent(int timerFd);
 int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
                                EventData *persistentEventData, const uint32_t epollEventMask);
 
+/// <summary>
+///     Replaces a timerfd that keeps failing: removes it from the epoll instance, closes it, and creates a
+///     disarmed one registered for EPOLLIN with the same event data. The caller arms it again.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="timerFd">Timer file descriptor to replace; may already be closed</param>
+/// <param name="persistentEventData">Event data the old timerfd was registered with</param>
+/// <returns>The new timerfd on success, or -1 on failure</returns>
+int ReplaceTimerFd(int epollFd, int timerFd, EventData *persistentEventData);
+
 /// <summary>
 ///     Waits for an event on an epoll instance and triggers the handler.
 /// </summary>
@@ -105,9 +184,124 @@ int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
 /// <returns>0 on success, or -1 on failure</returns>
 int WaitForEventAndCallHandler(int epollFd);
 
+/// <summary>
+///     Waits for events on an epoll instance and triggers the handler of every event that is
+///     ready, up to <paramref name="maxEvents" /> per call. Handlers run in decreasing
+///     <see cref="EventData.priority" /> order; events of equal priority keep the order in
+///     which epoll reported them, except that those with a <see cref="EventData.deadlineNs" /> run
+///     earliest deadline first. While low-priority slicing is on, see
+///     <see cref="EventLoop_SetLowPrioritySlice" />, low-priority handlers that are not reached before the
+///     slice ends are left for the next call. The execution time of every handler that has
+///     <see cref="EventData.stats" /> set is recorded there.
+/// </summary>
+/// <param name="epollFd">
+///     Epoll file descriptor which was created with <see cref="CreateEpollFd" />.
+/// </param>
+/// <param name="maxEvents">
+///     Maximum number of events to handle, clamped to <see cref="EPOLL_MAX_EVENTS_PER_WAIT" />.
+/// </param>
+/// <returns>The number of events handled in this wakeup, or -1 on failure with errno set by epoll_wait</returns>
+int WaitForEventsAndCallHandlers(int epollFd, int maxEvents);
+
+/// <summary>
+///     Turns low-priority slicing on or off. While it is on, the low-priority handlers of one wakeup of
+///     <see cref="WaitForEventsAndCallHandlers" /> get at most <paramref name="sliceNs" /> between them, and
+///     stop <see cref="EVENT_LOOP_DEADLINE_GUARD_NS" /> before the earliest deadline of a real-time source,
+///     so that a busy network or a burst of soft timers cannot push a step late. Handlers that do not get to
+///     run stay ready and are called on a later wakeup, since every registration is level-triggered.
+/// </summary>
+/// <param name="sliceNs">Time per wakeup for low-priority handlers, or 0 to run them all (the default)</param>
+void EventLoop_SetLowPrioritySlice(uint32_t sliceNs);
+
+/// <summary>
+///     Called by a low-priority handler between units of queued work. Returns true once the slice of the
+///     current wakeup is used up; the handler should then return and make sure it is called again, for
+///     example by leaving its event ready. Always false outside of low-priority handlers, or with slicing off.
+/// </summary>
+bool EventLoop_ShouldYield(void);
+
 /// <summary>
 ///     Closes a file descriptor and prints an error on failure.
 /// </summary>
 /// <param name="fd">File descriptor to close</param>
 /// <param name="name">File descriptor name to use in error message</param>
-void CloseFdAndPrintError(int fd, const char *name);
\ No newline at end of file
+void CloseFdAndPrintError(int fd, const char *name);
+
+/// <summary>
+///     Resolution of software timers. Timers due in the same tick run in the same wakeup.
+/// </summary>
+#define TIMER_WHEEL_TICK_NS 1000000u
+
+/// <summary>
+///     Timers due this many ticks after the earliest one run early, in the same wakeup.
+/// </summary>
+#define TIMER_WHEEL_COALESCE_TICKS 1
+
+/// Forward declaration of the software timer type passed to the handlers.
+struct SoftTimer;
+
+/// <summary>
+///     Function signature for software timer handlers.
+/// </summary>
+/// <param name="timer">The timer that expired</param>
+typedef void (*SoftTimerHandler)(struct SoftTimer *timer);
+
+/// <summary>
+/// <para>A software timer multiplexed onto the timer wheel's single timerfd.</para>
+/// <para>Initialize it with <see cref="SoftTimer_Init" />. The struct must stay in memory
+/// while the timer runs. Treat the members other than stats as private.</para>
+/// </summary>
+typedef struct SoftTimer {
+    struct SoftTimer *next;
+    struct SoftTimer *previous;
+    /// <summary>
+    /// Function which is called when the timer expires.
+    /// </summary>
+    SoftTimerHandler handler;
+    /// <summary>
+    /// Where to record the handler's latency, or NULL to not measure it.
+    /// </summary>
+    struct EventLatencyStats *stats;
+    uint64_t expiryTick;
+    uint64_t periodTicks;
+    uint32_t slot;
+    bool isRunning;
+} SoftTimer;
+
+/// <summary>
+///     Creates the timerfd behind all software timers and adds it to an epoll instance.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int TimerWheel_Init(int epollFd);
+
+/// <summary>
+///     Closes the timer wheel's timerfd. Running timers are stopped.
+/// </summary>
+void TimerWheel_Close(void);
+
+/// <summary>
+///     Prepares a software timer. It does not run until <see cref="SoftTimer_Start" /> is called.
+/// </summary>
+/// <param name="timer">Timer</param>
+/// <param name="handler">Function called when the timer expires</param>
+void SoftTimer_Init(SoftTimer *timer, SoftTimerHandler handler);
+
+/// <summary>
+///     Starts or restarts a software timer. Times are rounded up to whole ticks.
+/// </summary>
+/// <param name="timer">Timer</param>
+/// <param name="delay">Time until the first expiry</param>
+/// <param name="period">Time between later expiries, or NULL to expire once</param>
+/// <returns>0 on success, or -1 if the timer wheel could not be armed</returns>
+int SoftTimer_Start(SoftTimer *timer, const struct timespec *delay, const struct timespec *period);
+
+/// <summary>
+///     Stops a software timer. Does nothing if it is not running.
+/// </summary>
+void SoftTimer_Stop(SoftTimer *timer);
+
+/// <summary>
+///     Returns true while a software timer is running.
+/// </summary>
+bool SoftTimer_IsRunning(const SoftTimer *timer);
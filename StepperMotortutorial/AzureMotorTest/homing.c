@@ -0,0 +1,214 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "homing.h"
+
+static int ReadSwitch(Homing *homing, bool *closed)
+{
+    GPIO_Value_Type value;
+    if (GPIO_GetValue(homing->switchFd, &value) != 0) {
+        return -1;
+    }
+    *closed = (value == GPIO_Value_Low) == homing->config.activeLow;
+    return 0;
+}
+
+static int OpenSwitch(Homing *homing)
+{
+    homing->switchFd = GPIO_OpenAsInput(homing->config.switchGpio);
+    if (homing->switchFd < 0) {
+        Log_Debug("ERROR: Could not open limit switch GPIO %d: %s (%d).\n", homing->config.switchGpio,
+                  strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+
+static void CloseSwitch(Homing *homing)
+{
+    CloseFdAndPrintError(homing->switchFd, "Limit switch GPIO");
+    homing->switchFd = -1;
+}
+
+// A sample that cannot be read is skipped, and the switch is read again on the next one
+static int RecoverSwitch(Homing *homing, int error)
+{
+    if (!Recovery_Allow(&homing->recovery, error)) {
+        return -1;
+    }
+    if (!Recovery_IsTransient(error)) {
+        CloseSwitch(homing);
+        OpenSwitch(homing);
+    }
+    return 0;
+}
+
+static void Finish(Homing *homing, HomingEvent event, const char *reason)
+{
+    StepScheduler_Cancel(&homing->task);
+    if (StepperMotor_IsMoving(homing->motor)) {
+        StepperMotor_Stop(homing->motor);
+    } else {
+        StepperMotor_Hold(homing->motor);
+    }
+    homing->phase = HomingPhase_Idle;
+
+    if (event == HomingEvent_Homed) {
+        unsigned long elapsedMs = (unsigned long)((StepScheduler_Now() - homing->startNs) / 1000000u);
+        Log_Debug("Homing: homed in %lu ms.\n", elapsedMs);
+    } else {
+        Log_Debug("ERROR: Homing failed: %s.\n", reason);
+    }
+    homing->callback(homing, event);
+}
+
+static void BeginPhase(Homing *homing, HomingPhase phase)
+{
+    homing->phase = phase;
+    homing->phaseStart = StepperMotor_GetPosition(homing->motor);
+    homing->closedSamples = 0;
+}
+
+// Runs one stage of the state machine per sample. During the fast seek and the back-off the motor runs moves of
+// its own and the task only watches the switch; during the slow approach the task steps the motor itself.
+static void HomingTaskHandler(StepSchedulerTask *task, uint64_t nowNs)
+{
+    Homing *homing = (Homing *)task;
+    StepperMotor *motor = homing->motor;
+    const HomingConfig *config = &homing->config;
+
+    bool closed;
+    if (ReadSwitch(homing, &closed) != 0) {
+        if (RecoverSwitch(homing, errno) != 0) {
+            Finish(homing, HomingEvent_Failed, "the limit switch cannot be read");
+            return;
+        }
+    } else {
+        uint32_t travelled = (uint32_t)abs(StepperMotor_GetPosition(motor) - homing->phaseStart);
+        switch (homing->phase) {
+        case HomingPhase_Seek:
+            if (closed) {
+                StepperMotor_Stop(motor);
+                homing->tripPosition = StepperMotor_GetPosition(motor);
+                BeginPhase(homing, HomingPhase_Stopping);
+            } else if (travelled > config->maxTravelSteps) {
+                Finish(homing, HomingEvent_Failed, "no limit switch within the travel");
+                return;
+            } else if (!StepperMotor_IsMoving(motor)) {
+                Finish(homing, HomingEvent_Failed, "the motor stopped during the seek");
+                return;
+            }
+            break;
+        case HomingPhase_Stopping:
+            if (!StepperMotor_IsMoving(motor)) {
+                BeginPhase(homing, HomingPhase_BackOff);
+                int32_t overtravel = abs(StepperMotor_GetPosition(motor) - homing->tripPosition);
+                StepperMotor_MoveBy(motor, -config->direction * (overtravel + (int32_t)config->backOffSteps));
+            }
+            break;
+        case HomingPhase_BackOff:
+            if (!StepperMotor_IsMoving(motor)) {
+                if (closed) {
+                    Finish(homing, HomingEvent_Failed, "the limit switch did not release");
+                    return;
+                }
+                BeginPhase(homing, HomingPhase_Approach);
+            }
+            break;
+        case HomingPhase_Approach:
+            // No steps are taken while the switch reads closed, so the motor waits on the edge for the debounce
+            if (closed) {
+                if (++homing->closedSamples >= config->debounceSamples) {
+                    StepperMotor_SetPosition(motor, config->homePosition);
+                    Finish(homing, HomingEvent_Homed, NULL);
+                    return;
+                }
+            } else if (travelled > 2 * config->backOffSteps) {
+                Finish(homing, HomingEvent_Failed, "the limit switch was lost on the approach");
+                return;
+            } else {
+                homing->closedSamples = 0;
+                if (StepperMotor_Step(motor, config->direction) != 0) {
+                    Finish(homing, HomingEvent_Failed, "the motor could not be stepped");
+                    return;
+                }
+            }
+            break;
+        case HomingPhase_Idle:
+            return;
+        }
+    }
+
+    uint32_t periodNs =
+        homing->phase == HomingPhase_Approach ? config->approachIntervalNs : config->samplePeriodNs;
+    StepClock_Advance(&homing->clock, periodNs);
+    StepClock_Resync(&homing->clock, nowNs, periodNs);
+    if (StepScheduler_Schedule(task, homing->clock.deadlineNs) != 0) {
+        Finish(homing, HomingEvent_Failed, "the sample could not be scheduled");
+    }
+}
+
+int Homing_Open(Homing *homing, StepperMotor *motor, const HomingConfig *config, HomingCallback callback)
+{
+    memset(homing, 0, sizeof(*homing));
+    StepScheduler_InitTask(&homing->task, &HomingTaskHandler);
+    homing->callback = callback;
+    homing->motor = motor;
+    homing->config = *config;
+    homing->config.direction = config->direction < 0 ? -1 : 1;
+    homing->switchFd = -1;
+    homing->phase = HomingPhase_Idle;
+    homing->recovery = (RecoveryBudget)RECOVERY_BUDGET("Limit switch GPIO");
+
+    if (config->backOffSteps == 0 || config->approachIntervalNs == 0 || config->samplePeriodNs == 0 ||
+        config->debounceSamples == 0) {
+        Log_Debug("ERROR: Invalid homing configuration.\n");
+        return -1;
+    }
+
+    return OpenSwitch(homing);
+}
+
+void Homing_Close(Homing *homing)
+{
+    Homing_Cancel(homing);
+    CloseSwitch(homing);
+}
+
+int Homing_Start(Homing *homing)
+{
+    if (homing->phase != HomingPhase_Idle || StepperMotor_IsMoving(homing->motor)) {
+        return -1;
+    }
+
+    homing->startNs = StepScheduler_Now();
+    BeginPhase(homing, HomingPhase_Seek);
+    StepperMotor_Jog(homing->motor, homing->config.direction);
+    StepClock_Start(&homing->clock, homing->startNs);
+    uint64_t deadlineNs = StepClock_Advance(&homing->clock, homing->config.samplePeriodNs);
+    if (StepScheduler_Schedule(&homing->task, deadlineNs) != 0) {
+        StepperMotor_Stop(homing->motor);
+        homing->phase = HomingPhase_Idle;
+        return -1;
+    }
+    return 0;
+}
+
+void Homing_Cancel(Homing *homing)
+{
+    if (homing->phase == HomingPhase_Idle) {
+        return;
+    }
+    StepScheduler_Cancel(&homing->task);
+    StepperMotor_Stop(homing->motor);
+    homing->phase = HomingPhase_Idle;
+}
+
+bool Homing_IsActive(const Homing *homing)
+{
+    return homing->phase != HomingPhase_Idle;
+}
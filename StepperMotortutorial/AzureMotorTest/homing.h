@@ -0,0 +1,130 @@
+/*
+Homing against a limit switch.
+Finds the absolute position of an axis in three moves, from a task on the step scheduler that samples the switch. A
+fast seek jogs towards the switch along the motor's own acceleration profile and decelerates once it trips, which
+gets there quickly but runs past the switch edge by the stopping distance. The axis then backs off until the switch
+has released, clearing the switch edge by a set distance whatever the overtravel was, and approaches again one step
+at a time at a slow fixed rate. The switch is sampled before every step of the approach and the axis stops stepping
+as soon as it reads closed; it is homed once it has read closed on debounceSamples samples in a row, so contact
+bounce and noise on the line cannot end the approach early. The edge is found to within one step at the approach
+rate, while most of the travel is covered at full speed. The switch has to allow for the overtravel of the fast
+seek.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <applibs/gpio.h>
+
+#include "recovery.h"
+#include "step_scheduler.h"
+#include "stepper_motor.h"
+
+/// <summary>
+///     Events reported by a homing run.
+/// </summary>
+typedef enum {
+    /// <summary>The switch edge was found and the motor position set to the home position.</summary>
+    HomingEvent_Homed,
+    /// <summary>The switch was not found, did not release, or could not be read; the position is unchanged
+    /// and not known.</summary>
+    HomingEvent_Failed
+} HomingEvent;
+
+struct Homing;
+
+/// <summary>
+///     Function signature for homing callbacks.
+/// </summary>
+typedef void (*HomingCallback)(struct Homing *homing, HomingEvent event);
+
+/// <summary>
+///     Static configuration of homing. Distances are in steps of the motor's active step mode.
+/// </summary>
+typedef struct {
+    /// <summary>GPIO the limit switch is wired to.</summary>
+    GPIO_Id switchGpio;
+    /// <summary>Set if the switch pulls the line low when it closes.</summary>
+    bool activeLow;
+    /// <summary>1 if the switch is at the end the position counts up to, -1 if it is at the other end.</summary>
+    int direction;
+    /// <summary>Travel the fast seek gives up after.</summary>
+    uint32_t maxTravelSteps;
+    /// <summary>Distance the axis backs off to before the slow approach, from where the fast seek tripped the
+    /// switch; the overtravel is backed off on top. The slow approach gives up after twice this.</summary>
+    uint32_t backOffSteps;
+    /// <summary>Time between steps of the slow approach.</summary>
+    uint32_t approachIntervalNs;
+    /// <summary>Time between switch samples during the fast seek and the back-off.</summary>
+    uint32_t samplePeriodNs;
+    /// <summary>Samples in a row the switch has to read closed for to end the slow approach.</summary>
+    uint32_t debounceSamples;
+    /// <summary>Position of the switch edge.</summary>
+    int32_t homePosition;
+} HomingConfig;
+
+// Stage of a homing run.
+typedef enum {
+    HomingPhase_Idle,
+    HomingPhase_Seek,
+    HomingPhase_Stopping,
+    HomingPhase_BackOff,
+    HomingPhase_Approach
+} HomingPhase;
+
+/// <summary>
+///     State of homing for one axis. Treat the members as private to homing.c.
+/// </summary>
+typedef struct Homing {
+    /// <summary>Sample task on the shared scheduler; must stay the first member.</summary>
+    StepSchedulerTask task;
+    /// <summary>Deadline of the latest sample.</summary>
+    StepClock clock;
+    HomingCallback callback;
+    StepperMotor *motor;
+    HomingConfig config;
+    int switchFd;
+    HomingPhase phase;
+    /// <summary>Motor position at the start of the current phase, to limit its travel.</summary>
+    int32_t phaseStart;
+    /// <summary>Motor position at which the fast seek tripped the switch.</summary>
+    int32_t tripPosition;
+    /// <summary>Closed samples in a row during the slow approach.</summary>
+    uint32_t closedSamples;
+    uint64_t startNs;
+    /// <summary>Read faults; the GPIO is reopened until these run out.</summary>
+    RecoveryBudget recovery;
+} Homing;
+
+/// <summary>
+///     Opens the limit switch GPIO. <see cref="StepScheduler_Init" /> must have been called.
+/// </summary>
+/// <param name="homing">Homing state; must stay in memory until <see cref="Homing_Close" /></param>
+/// <param name="motor">The open motor to home</param>
+/// <param name="config">Switch and homing configuration</param>
+/// <param name="callback">Function called when a run ends</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Homing_Open(Homing *homing, StepperMotor *motor, const HomingConfig *config, HomingCallback callback);
+
+/// <summary>
+///     Cancels any run and closes the switch GPIO.
+/// </summary>
+void Homing_Close(Homing *homing);
+
+/// <summary>
+///     Starts a run. Nothing else may move the motor until it ends.
+/// </summary>
+/// <returns>0 on success, or -1 if a run is already under way, the motor is moving, or the task could not be
+/// scheduled</returns>
+int Homing_Start(Homing *homing);
+
+/// <summary>
+///     Ends a run without homing, decelerating the motor if it is moving. No event is reported.
+/// </summary>
+void Homing_Cancel(Homing *homing);
+
+/// <summary>
+///     Returns true while a run is under way.
+/// </summary>
+bool Homing_IsActive(const Homing *homing);
@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "latency_stats.h"
+
+void LatencyHistogram_Record(LatencyHistogram *histogram, uint64_t ns)
+{
+    uint32_t bucket = ns == 0 ? 0 : (uint32_t)(64 - __builtin_clzll(ns));
+    if (bucket >= LATENCY_HISTOGRAM_BUCKETS) {
+        bucket = LATENCY_HISTOGRAM_BUCKETS - 1;
+    }
+    ++histogram->buckets[bucket];
+    ++histogram->count;
+    if (ns > histogram->maxNs) {
+        histogram->maxNs = ns;
+    }
+}
+
+uint64_t LatencyHistogram_PercentileNs(const LatencyHistogram *histogram, uint32_t percent)
+{
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = ((uint64_t)histogram->count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (uint32_t bucket = 0; bucket < LATENCY_HISTOGRAM_BUCKETS; ++bucket) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank) {
+            // The largest value the bucket can hold, but never more than was actually seen
+            uint64_t upperNs = bucket == 0 ? 0 : (1ull << bucket) - 1;
+            return upperNs < histogram->maxNs ? upperNs : histogram->maxNs;
+        }
+    }
+    return histogram->maxNs;
+}
+
+void EventLatencyStats_Clear(EventLatencyStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+static void LogHistogram(const LatencyHistogram *histogram, const char *name, const char *what)
+{
+    Log_Debug("%s %s: %lu samples, p50 <= %llu ns, p99 <= %llu ns, max %llu ns.\n", name, what,
+              (unsigned long)histogram->count,
+              (unsigned long long)LatencyHistogram_PercentileNs(histogram, 50),
+              (unsigned long long)LatencyHistogram_PercentileNs(histogram, 99),
+              (unsigned long long)histogram->maxNs);
+}
+
+void EventLatencyStats_Log(const EventLatencyStats *stats, const char *name)
+{
+    if (stats->wakeupLatency.count > 0) {
+        LogHistogram(&stats->wakeupLatency, name, "wakeup latency");
+    }
+    LogHistogram(&stats->executionTime, name, "execution time");
+}
@@ -0,0 +1,56 @@
+/*
+Fixed-size latency histograms for the event loop.
+Every value lands in a power-of-two bucket, so recording is a count-leading-zeros and an increment, the memory
+is fixed and the histograms can stay on in release builds. Percentiles are read back as the upper edge of the
+bucket they fall in, which is at most a factor of two pessimistic and plenty to size step rates with.
+*/
+#pragma once
+
+#include <stdint.h>
+
+/// <summary>Number of buckets. Bucket 0 counts 0 ns, bucket i counts [2^(i-1), 2^i) ns and the last bucket
+/// everything from about half a second up.</summary>
+#define LATENCY_HISTOGRAM_BUCKETS 32
+
+/// <summary>
+///     A log2 histogram of durations in nanoseconds.
+/// </summary>
+typedef struct {
+    uint32_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+    uint32_t count;
+    uint64_t maxNs;
+} LatencyHistogram;
+
+/// <summary>
+///     Latency figures of one event handler.
+/// </summary>
+typedef struct EventLatencyStats {
+    /// <summary>How long after its deadline the handler ran. Only timer handlers record this.</summary>
+    LatencyHistogram wakeupLatency;
+    /// <summary>How long the handler took, recorded by <see cref="WaitForEventsAndCallHandlers" />.</summary>
+    LatencyHistogram executionTime;
+} EventLatencyStats;
+
+/// <summary>
+///     Adds a value to a histogram.
+/// </summary>
+void LatencyHistogram_Record(LatencyHistogram *histogram, uint64_t ns);
+
+/// <summary>
+///     Returns an upper bound on the given percentile, or 0 if nothing was recorded.
+/// </summary>
+/// <param name="histogram">Histogram</param>
+/// <param name="percent">Percentile from 1 to 100</param>
+uint64_t LatencyHistogram_PercentileNs(const LatencyHistogram *histogram, uint32_t percent);
+
+/// <summary>
+///     Empties both histograms.
+/// </summary>
+void EventLatencyStats_Clear(EventLatencyStats *stats);
+
+/// <summary>
+///     Logs the count, p50, p99 and maximum of both histograms.
+/// </summary>
+/// <param name="stats">Figures to log</param>
+/// <param name="name">Name of the handler, for the log</param>
+void EventLatencyStats_Log(const EventLatencyStats *stats, const char *name);
@@ -15,29 +15,128 @@ is directly connected to the driver only. The motor itself is connected to the d
 #include <applibs/log.h>
 #include <applibs/gpio.h>
 
+#include "app_options.h"
+#include "button_input.h"
+#include "checkpoint.h"
 #include "epoll_timerfd_utilities.h"
+#include "homing.h"
+#include "latency_stats.h"
+#include "move_planner.h"
+#include "recovery.h"
+#include "remote_command.h"
+#include "rt_step_engine.h"
+#include "stall_detector.h"
+#include "startup_timing.h"
+#include "step_scheduler.h"
+#include "step_trace.h"
+#include "stepper_motor.h"
+#include "telemetry.h"
+#include "thermal_governor.h"
 #include "signal.h"
 #include "avnet_mt3620_sk.h";
 
 
-static int buttonPollTimerFd = -1;
 static int epollFd = -1;
-static int button_A_GpioFd = -1;
+static ButtonInput buttonA = { .gpioFd = -1 };
 static int greenLEDFd = -1;
-static int stepperMotorTimerFd = -1;
+//the close path runs even if init fails early, so anything it closes starts out closed and unscheduled
+static StepperMotor motor = {
+	.task = { .heapIndex = STEP_SCHEDULER_NOT_SCHEDULED },
+	.coils = { .lineFd = -1, .pinFds = { -1, -1, -1, -1 } }
+};
+static MovePlanner planner = { .task = { .heapIndex = STEP_SCHEDULER_NOT_SCHEDULED } };
+static AppOptions options;
+static StallDetector stallDetector = {
+	.task = { .heapIndex = STEP_SCHEDULER_NOT_SCHEDULED },
+	.channelFds = { -1, -1 }
+};
+static Homing homing = { .switchFd = -1 };
+static SoftTimer deferredInitTimer;
+static RecoveryBudget eventLoopRecovery = RECOVERY_BUDGET("Event loop");
 
 
 // Termination state
 static volatile sig_atomic_t terminationRequired = false;
-
-static GPIO_Value_Type buttonState = GPIO_Value_High;
-static bool isMotorTurning = false;
-static int stepNumber = 0;
-
-static int IN4 = -1;
-static int IN3 = -1;
-static int IN2 = -1;
-static int IN1 = -1;
+// Set by SIGUSR1 to dump the step trace and latency figures from the main loop
+static volatile sig_atomic_t traceDumpRequested = false;
+
+// The driver's IN1..IN4 are wired to pins 32, 33, 31 and 34. The 28byj-48 reliably starts at the original
+// fixed 2.048 ms step period and is ramped up to cruise from there. Between moves the last phase is held at a
+// third of the current, and released altogether after 10 s; the gearbox holds the shaft well enough after that.
+// These are only the defaults: the CmdArgs in app_manifest.json can override them, see app_options.h.
+static const StepperMotorConfig defaultMotorConfig = {
+	.coilGpios = { AVNET_MT3620_SK_GPIO32, AVNET_MT3620_SK_GPIO33, AVNET_MT3620_SK_GPIO31, AVNET_MT3620_SK_GPIO34 },
+	.stepMode = StepMode_FullStep,
+	.profileShape = MotionProfileShape_SCurve,
+	.startIntervalNs = 2048000,
+	.cruiseIntervalNs = 1200000,
+	.accelerationStepsPerSec2 = 2000,
+	.fullStepsPerRevolution = STEPPER_28BYJ48_FULL_STEPS_PER_REVOLUTION,
+	.hold = { .mode = HoldMode_Reduced, .releaseAfterMs = 10000, .dutyOnTicks = 1, .dutyOffTicks = 2 }
+};
+
+// Set USE_RT_STEP_ENGINE to 1 to generate steps on the IO M4 core with the AzureMotorTestRT app instead of from
+// this app's step timer. The M4 core then owns GPIO 31-34, so they must be removed from this app's manifest.
+#ifndef USE_RT_STEP_ENGINE
+#define USE_RT_STEP_ENGINE 0
+#endif
+
+// Set USE_STALL_DETECTION to 1 if a quadrature encoder is fitted to the output shaft with A and B on GPIO0 and
+// GPIO16 (both on SOCKET1). The motor is then halted as soon as the shaft stops following the steps, so the
+// profile can be run much closer to the torque limit. The encoder is sampled from the step scheduler, so this
+// only works with the steps generated in this app.
+#ifndef USE_STALL_DETECTION
+#define USE_STALL_DETECTION 0
+#endif
+
+// 600 line encoder, sampled every 250 us: fast enough for 2400 counts per revolution at 15 rpm, well above
+// what the 28byj-48 can do. The rotor may lag the field by up to two full steps before it slips a pole.
+static const StallDetectorConfig stallDetectorConfig = {
+	.channelGpios = { AVNET_MT3620_SK_GPIO0, AVNET_MT3620_SK_GPIO16 },
+	.countsPerRevolution = 2400,
+	.fullStepsPerRevolution = STEPPER_28BYJ48_FULL_STEPS_PER_REVOLUTION,
+	.toleranceSteps = 8,
+	.samplePeriodNs = 250000,
+	.invert = false
+};
+
+// Set USE_HOMING to 1 if a limit switch is fitted at the end of the travel the position counts down to. On the
+// starter kit button B stands in for it: tap it to end the fast seek, then press and hold it to end the slow
+// approach. At boot the axis is homed unless a checkpoint gave its position, and remote moves are only taken
+// once homing is over.
+#ifndef USE_HOMING
+#define USE_HOMING 0
+#endif
+
+// Seek at the motor's own cruise speed for up to four turns, back off a sixteenth of a turn and approach again at
+// 50 full steps per second. The switch is sampled every half millisecond during the seek and before every step of
+// the approach, and three closed samples in a row there make 40 to 60 ms of solid contact.
+static const HomingConfig homingConfig = {
+	.switchGpio = AVNET_MT3620_SK_USER_BUTTON_B,
+	.activeLow = true,
+	.direction = -1,
+	.maxTravelSteps = 4 * STEPPER_28BYJ48_FULL_STEPS_PER_REVOLUTION,
+	.backOffSteps = STEPPER_28BYJ48_FULL_STEPS_PER_REVOLUTION / 16,
+	.approachIntervalNs = 20000000,
+	.samplePeriodNs = 500000,
+	.debounceSamples = 3,
+	.homePosition = 0
+};
+
+// 5 V 28byj-48 on a ULN2003: 50 ohm windings, about a volt lost in the Darlington, and some 40 C per watt
+// with a time constant of five minutes in a small closed box. The hold current is cut back from 30 C above
+// ambient and the coils are released at standstill from the 40 C rise the motor is rated for; the cruise speed
+// follows the winding resistance all the way. At 5 V the motor never gets that hot, but on a 12 V supply it
+// would, so set --motor-supply in the CmdArgs to the supply the driver is on.
+static const ThermalGovernorConfig defaultThermalConfig = {
+	.supplyMillivolts = 5000,
+	.driverDropMillivolts = 1000,
+	.coilResistanceMilliohms = 50000,
+	.thermalResistanceMilliCPerW = 40000,
+	.timeConstantS = 300,
+	.derateFromRiseC = 30,
+	.maxRiseC = 40
+};
 
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
@@ -49,108 +148,231 @@ static void TerminationHandler(int signalNumber)
 }
 
 /// <summary>
-///     Handle button timer event: if the button is pressed, light the green LED and set isMotorTurning to true.
+///     Signal handler for step trace dump requests. This handler must be async-signal-safe.
+/// </summary>
+static void TraceDumpHandler(int signalNumber)
+{
+	traceDumpRequested = true;
+}
+
+/// <summary>
+///     Handle stepper motor events: a move starting from standstill is checkpointed before its first step.
 /// </summary>
-static void ButtonTimerEventHandler(EventData *eventData)
+static void MotorEventHandler(StepperMotor *eventMotor, StepperMotorEvent event)
 {
-	if (ConsumeTimerFdEvent(buttonPollTimerFd) != 0)
+	if (event == StepperMotorEvent_MoveStarting)
+	{
+		Checkpoint_MoveStarting();
+	}
+	else if (event == StepperMotorEvent_Error)
 	{
 		terminationRequired = true;
-		return;
 	}
+}
 
-	// Check for a button press
-	GPIO_Value_Type newButtonState;
-	int result = GPIO_GetValue(button_A_GpioFd, &newButtonState);
-	if (result != 0)
+/// <summary>
+///     Handle move planner events: a move starting from rest is checkpointed before its first tick.
+/// </summary>
+static void MovePlannerEventHandler(MovePlanner *eventPlanner, MovePlannerEvent event)
+{
+	if (event == MovePlannerEvent_MoveStarting)
+	{
+		Checkpoint_MoveStarting();
+	}
+	else if (event == MovePlannerEvent_Error)
 	{
-		Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
 		terminationRequired = true;
-		return;
 	}
+}
 
-	if (newButtonState == GPIO_Value_High)
+/// <summary>
+///     Handle stall detector events: a stall has already halted the motor, so turn the LED off to show it.
+/// </summary>
+static void StallDetectorEventHandler(StallDetector *detector, StallEvent event)
+{
+	if (event == StallEvent_Stalled)
 	{
-		isMotorTurning = false;
-		stepNumber = 0;
+		Log_Debug("Motor stalled, release the button to reset.\n");
 		GPIO_SetValue(greenLEDFd, GPIO_Value_High);
 	}
 	else
 	{
-		isMotorTurning = true;
-		GPIO_SetValue(greenLEDFd, GPIO_Value_Low);
+		terminationRequired = true;
 	}
 }
 
-/*
-Stepper mototr event will fire every 0.002048 seconds as defined for a full step for the 28byj-48 stepper motor.
-if the isMotorTurning bool is true from the button being pressed we will check to see which step we are on.
-We send the signal to the correct GPIO while stopping the signal from the others to tell the motor driver which coil to ignite. 
-This moves the motor to the next step.
-When we reach our fourth step(index 3) we set it back to the first step(index 0) and start the cycle back again.
-*/
-static void StepperMotorEventHandler(EventData *eventData)
+/// <summary>
+///     Take moves from the network, if a command port is configured.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int OpenCommandPort(void)
+{
+	return options.commandPort != 0 ? RemoteCommand_Open(epollFd, options.commandPort, &planner) : 0;
+}
+
+/// <summary>
+///     Handle homing events: a homed axis has a known position again. Remote moves are taken from here on
+///     either way, so that an axis that failed to home can still be moved clear.
+/// </summary>
+static void HomingEventHandler(Homing *eventHoming, HomingEvent event)
 {
-	if (ConsumeTimerFdEvent(stepperMotorTimerFd) != 0)
+	if (event == HomingEvent_Homed)
+	{
+		Checkpoint_SetPositionKnown(0);
+#if USE_STALL_DETECTION
+		StallDetector_Resync(&stallDetector);
+#endif
+	}
+	if (OpenCommandPort() != 0)
 	{
 		terminationRequired = true;
-		return;
 	}
+}
+
+/// <summary>
+///     Handle step scheduler timer failures.
+/// </summary>
+static void StepSchedulerErrorEventHandler(void)
+{
+	terminationRequired = true;
+}
 
-	if (isMotorTurning)
+/// <summary>
+///     Handle button A events: while the button is held, light the green LED and turn the stepper.
+/// </summary>
+static void ButtonAEventHandler(ButtonInput *button, ButtonEvent event)
+{
+	switch (event)
 	{
-		switch (stepNumber)
+	case ButtonEvent_Pressed:
+#if USE_RT_STEP_ENGINE
+		if (RtStepEngine_Jog(1) != 0)
+		{
+			terminationRequired = true;
+		}
+#else
+		//the button only jogs while no remote move or homing is running
+		if (!MovePlanner_IsMoving(&planner) && !Homing_IsActive(&homing))
 		{
-		case 0:
-			Log_Debug("STEP 0\n");
-			GPIO_SetValue(IN1, GPIO_Value_Low);
-			GPIO_SetValue(IN2, GPIO_Value_High);
-			GPIO_SetValue(IN3, GPIO_Value_High);
-			GPIO_SetValue(IN4, GPIO_Value_High);
-			break;
-		case 1:
-			Log_Debug("STEP 1\n");
-			GPIO_SetValue(IN1, GPIO_Value_High);
-			GPIO_SetValue(IN2, GPIO_Value_Low);
-			GPIO_SetValue(IN3, GPIO_Value_High);
-			GPIO_SetValue(IN4, GPIO_Value_High);
-			break;
-		case 2:
-			Log_Debug("STEP 2\n");
-			GPIO_SetValue(IN1, GPIO_Value_High);
-			GPIO_SetValue(IN2, GPIO_Value_High);
-			GPIO_SetValue(IN3, GPIO_Value_Low);
-			GPIO_SetValue(IN4, GPIO_Value_High);
-			break;
-		case 3:
-			Log_Debug("STEP 3\n");
-			GPIO_SetValue(IN1, GPIO_Value_High);
-			GPIO_SetValue(IN2, GPIO_Value_High);
-			GPIO_SetValue(IN3, GPIO_Value_High);
-			GPIO_SetValue(IN4, GPIO_Value_Low);
-			break;
-
-		default:
-			break;
+			StepperMotor_Jog(&motor, 1);
 		}
-		stepNumber++;
-		if (stepNumber == 4)
-			stepNumber = 0;
+#endif
+		GPIO_SetValue(greenLEDFd, GPIO_Value_Low);
+		break;
+	case ButtonEvent_Released:
+#if USE_RT_STEP_ENGINE
+		if (RtStepEngine_Stop() != 0)
+		{
+			terminationRequired = true;
+		}
+#else
+		if (!MovePlanner_IsMoving(&planner) && !Homing_IsActive(&homing))
+		{
+			StepperMotor_Stop(&motor);
+		}
+#endif
+		GPIO_SetValue(greenLEDFd, GPIO_Value_High);
+		break;
+	case ButtonEvent_Error:
+		terminationRequired = true;
+		break;
 	}
-	else
+}
+
+/// <summary>
+///     Log the wakeup latency and execution time of the timer handlers, and the telemetry samples lost.
+/// </summary>
+static void LogEventStats(void)
+{
+#if !USE_RT_STEP_ENGINE
+	EventLatencyStats_Log(StepScheduler_GetStats(), "Step scheduler");
+#endif
+	EventLatencyStats_Log(ButtonInput_GetStats(&buttonA), "Button A");
+	if (options.telemetry.address != 0)
 	{
-		GPIO_SetValue(IN1, GPIO_Value_High);
-		GPIO_SetValue(IN2, GPIO_Value_High);
-		GPIO_SetValue(IN3, GPIO_Value_High);
-		GPIO_SetValue(IN4, GPIO_Value_High);
+		Log_Debug("Telemetry samples dropped: %lu.\n", (unsigned long)Telemetry_GetDroppedSamples());
 	}
 }
 
-//event handler for button press
-static EventData buttonEventData = { .eventHandler = &ButtonTimerEventHandler };
+/// <summary>
+///     Fill in a telemetry sample with the step counts and the latency figures.
+/// </summary>
+static void SampleTelemetry(TelemetrySample *sample)
+{
+#if USE_RT_STEP_ENGINE
+	const StepEngineStatusMessage *status = RtStepEngine_GetLastStatus();
+	sample->values[TelemetryField_StepsTaken] = status->stepsTaken;
+	sample->values[TelemetryField_MissedSteps] = status->lateSteps;
+	sample->values[TelemetryField_Position] = status->position;
+#else
+	uint64_t stepsTaken, missedSteps;
+	StepperMotor_GetStepCounts(&motor, &stepsTaken, &missedSteps);
+	sample->values[TelemetryField_StepsTaken] = (int64_t)stepsTaken;
+	sample->values[TelemetryField_MissedSteps] = (int64_t)missedSteps;
+	sample->values[TelemetryField_Position] = StepperMotor_GetPosition(&motor);
+
+	const EventLatencyStats *scheduler = StepScheduler_GetStats();
+	sample->values[TelemetryField_SchedulerWakeupP99Ns] =
+		(int64_t)LatencyHistogram_PercentileNs(&scheduler->wakeupLatency, 99);
+	sample->values[TelemetryField_SchedulerWakeupMaxNs] = (int64_t)scheduler->wakeupLatency.maxNs;
+	sample->values[TelemetryField_SchedulerExecutionP99Ns] =
+		(int64_t)LatencyHistogram_PercentileNs(&scheduler->executionTime, 99);
+#endif
+	sample->values[TelemetryField_ButtonWakeupP99Ns] =
+		(int64_t)LatencyHistogram_PercentileNs(&ButtonInput_GetStats(&buttonA)->wakeupLatency, 99);
+	sample->values[TelemetryField_TimeToFirstStepUs] = StartupTiming_GetUs(StartupMilestone_FirstStep);
+	sample->values[TelemetryField_Recoveries] = Recovery_GetTotal();
+	sample->values[TelemetryField_MotorRiseDeciC] = ThermalGovernor_GetRiseDeciC(0);
+}
 
-//event handler for stepper motor
-static EventData motorTurnEventData = { .eventHandler = &StepperMotorEventHandler };
+/// <summary>
+///     Open the peripherals the motor does not need, on the first tick of the event loop. None of them is
+///     worth stopping the app for, so a failure only logs and leaves that peripheral out.
+/// </summary>
+static void DeferredInitHandler(SoftTimer *timer)
+{
+	// Open button GPIO as input; it is polled slowly while idle and quickly for a short while after it changes.
+	if (ButtonInput_Open(&buttonA, AVNET_MT3620_SK_USER_BUTTON_A, &ButtonAEventHandler) != 0)
+	{
+		Log_Debug("Continuing without button A.\n");
+		ButtonInput_Close(&buttonA, "Button A");
+	}
+
+	// Open LED GPIO, set as output with value GPIO_Value_High (off). While it is missing, setting it just fails.
+	greenLEDFd = GPIO_OpenAsOutput(AVNET_MT3620_SK_USER_LED_GREEN, GPIO_OutputMode_PushPull, GPIO_Value_High);
+	if (greenLEDFd < 0)
+	{
+		Log_Debug("ERROR: Could not open green LED GPIO: %s (%d).\n", strerror(errno), errno);
+	}
+
+	//start the telemetry uplink if a collector is configured; it samples and sends from the timer wheel, at
+	//low priority, and never waits on the network
+	if (Telemetry_Open(epollFd, &options.telemetry, &SampleTelemetry) != 0)
+	{
+		Log_Debug("Continuing without telemetry.\n");
+		Telemetry_Close();
+	}
+
+	StartupTiming_Mark(StartupMilestone_PeripheralsReady);
+}
+
+/// <summary>
+///     Record the first step, for the time-to-first-step figure.
+/// </summary>
+static void CheckFirstStep(void)
+{
+#if USE_RT_STEP_ENGINE
+	bool stepped = RtStepEngine_GetLastStatus()->stepsTaken > 0;
+#else
+	uint64_t stepsTaken, missedSteps;
+	StepperMotor_GetStepCounts(&motor, &stepsTaken, &missedSteps);
+	bool stepped = stepsTaken > 0;
+#endif
+	if (stepped)
+	{
+		StartupTiming_Mark(StartupMilestone_FirstStep);
+	}
+}
 
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
@@ -162,81 +384,107 @@ static int InitPeripheralsAndHandlers(void)
 	memset(&action, 0, sizeof(struct sigaction));
 	action.sa_handler = TerminationHandler;
 	sigaction(SIGTERM, &action, NULL);
+	action.sa_handler = TraceDumpHandler;
+	sigaction(SIGUSR1, &action, NULL);
 
 	epollFd = CreateEpollFd();
 	if (epollFd < 0) {
 		return -1;
 	}
 
-	// Open button GPIO as input, and set up a timer to poll it
-	Log_Debug("Opening SAMPLE_BUTTON_1 as input.\n");
-	button_A_GpioFd = GPIO_OpenAsInput(AVNET_MT3620_SK_USER_BUTTON_A);
-	if (button_A_GpioFd < 0) {
-		Log_Debug("ERROR: Could not open button A GPIO: %s (%d).\n", strerror(errno), errno);
+	// Telemetry, remote commands and the soft timers get half a millisecond per wakeup between them, and
+	// always give way a little before the next step is due
+	EventLoop_SetLowPrioritySlice(500000);
+
+	// Set up the timer wheel, which runs every slow software timer off one timerfd at low priority, after any
+	// step that is due in the same wakeup
+	if (TimerWheel_Init(epollFd) != 0)
+	{
 		return -1;
 	}
-	struct timespec buttonPressCheckPeriod = { 0, 1000000 };
-	buttonPollTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &buttonPressCheckPeriod, &buttonEventData, EPOLLIN);
-	if (buttonPollTimerFd < 0)
+
+	// The motor path comes up first and has to: without it there is nothing for the app to do
+#if USE_RT_STEP_ENGINE
+	//connect to the step engine on the M4 core and send it the motor configuration
+	if (RtStepEngine_Open(epollFd, &options.motor, NULL) != 0)
 	{
 		return -1;
 	}
-
-	// Open LED GPIO, set as output with value GPIO_Value_High (off), and set up a timer to blink it
-	Log_Debug("Opening SAMPLE_LED as output.\n");
-	greenLEDFd = GPIO_OpenAsOutput(AVNET_MT3620_SK_USER_LED_GREEN, GPIO_OutputMode_PushPull, GPIO_Value_High);
-	if (greenLEDFd < 0)
+#else
+	//set up the step scheduler, which owns the one step timer every motor shares. It stays disarmed until
+	//the A button is pressed, then fires once per step to move the motor to the next appropiate step
+	if (StepScheduler_Init(epollFd, &StepSchedulerErrorEventHandler) != 0)
 	{
-		Log_Debug("ERROR: Could not open green LED GPIO: %s (%d).\n", strerror(errno), errno);
 		return -1;
 	}
 
-	//open GPIO pin for IN4 from driver board
-	Log_Debug("Init IN4 GPIO.\n");
-	IN4 = GPIO_OpenAsOutput(AVNET_MT3620_SK_GPIO34, GPIO_OutputMode_PushPull, GPIO_Value_High);
-	if (IN4 < 0)
+	//open the driver's input pins
+	if (StepperMotor_Open(&motor, &options.motor, &MotorEventHandler) != 0)
 	{
-		Log_Debug("ERROR: Could not open IN4 GPIO: %s (%d).\n", strerror(errno), errno);
 		return -1;
 	}
 
-	//open GPIO pin for IN3 from driver board
-	Log_Debug("Init IN3 GPIO.\n");
-	IN3 = GPIO_OpenAsOutput(AVNET_MT3620_SK_GPIO31, GPIO_OutputMode_PushPull, GPIO_Value_High);
-	if (IN3 < 0)
+	//queue moves for the motor, ramped with the same limits as a jog
+	static StepperMotor *const plannerAxes[] = { &motor };
+	const MovePlannerConfig plannerConfig = {
+		.profileShape = options.motor.profileShape,
+		.startIntervalNs = options.motor.startIntervalNs,
+		.cruiseIntervalNs = options.motor.cruiseIntervalNs,
+		.accelerationStepsPerSec2 = options.motor.accelerationStepsPerSec2
+	};
+	if (MovePlanner_Init(&planner, plannerAxes, 1, &plannerConfig, &MovePlannerEventHandler) != 0)
 	{
-		Log_Debug("ERROR: Could not open IN3 GPIO: %s (%d).\n", strerror(errno), errno);
 		return -1;
 	}
 
-	//open GPIO pin for IN2 from driver board
-	Log_Debug("Init IN2 GPIO.\n");
-	IN2 = GPIO_OpenAsOutput(AVNET_MT3620_SK_GPIO33, GPIO_OutputMode_PushPull, GPIO_Value_High);
-	if (IN2 < 0)
+	//carry on from the position the motor was left at, if it was saved at rest. Without the log the motor
+	//starts from 0, as it always did
+	if (Checkpoint_Open(plannerAxes, 1, &planner) != 0)
 	{
-		Log_Debug("ERROR: Could not open IN2 GPIO: %s (%d).\n", strerror(errno), errno);
-		return -1;
+		Log_Debug("Continuing without checkpoints.\n");
+		Checkpoint_Close();
 	}
 
-	//open GPIO pin for IN2 from driver board
-	Log_Debug("Init IN1 GPIO.\n");
-	IN1 = GPIO_OpenAsOutput(AVNET_MT3620_SK_GPIO32, GPIO_OutputMode_PushPull, GPIO_Value_High);
-	if (IN1 < 0)
+	//keep the motor inside its temperature limits: slow it down and cut the hold current back as it warms up
+	if (ThermalGovernor_Open(plannerAxes, 1, &planner, options.motor.cruiseIntervalNs, &options.motor.hold,
+		&options.thermal) != 0)
+	{
+		Log_Debug("Continuing without the thermal governor.\n");
+		ThermalGovernor_Close();
+	}
+
+#if USE_HOMING
+	//find the limit switch, unless the checkpoint already knew where the axis is
+	if (Homing_Open(&homing, &motor, &homingConfig, &HomingEventHandler) != 0)
 	{
-		Log_Debug("ERROR: Could not open IN1 GPIO: %s (%d).\n", strerror(errno), errno);
 		return -1;
 	}
+	if (!Checkpoint_WasRestored(0) && Homing_Start(&homing) != 0)
+	{
+		return -1;
+	}
+#endif
 
-	/*create timer event for stepper motor. This loop fires evey 0.002048 seconds. 
-	If the A button is pressed it will move the motor to the next appropiate step*/
-	struct timespec motorStepperTimePeriod = { 0,2048000 };
-	stepperMotorTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &motorStepperTimePeriod, &motorTurnEventData, EPOLLIN);
-	if (stepperMotorTimerFd< 0)
+	//take those moves from the network if a command port is configured; while homing, once it is over
+	if (!Homing_IsActive(&homing) && OpenCommandPort() != 0)
 	{
 		return -1;
 	}
 
-	return 0;
+#if USE_STALL_DETECTION
+	//watch the shaft with the encoder and compare it with the steps taken
+	if (StallDetector_Open(&stallDetector, &motor, &stallDetectorConfig, &StallDetectorEventHandler) != 0)
+	{
+		return -1;
+	}
+#endif
+#endif
+	StartupTiming_Mark(StartupMilestone_MotorReady);
+
+	// Everything else opens from the event loop once it runs, so it never holds up the first step
+	SoftTimer_Init(&deferredInitTimer, &DeferredInitHandler);
+	static const struct timespec now = { 0, 0 };
+	return SoftTimer_Start(&deferredInitTimer, &now, NULL);
 }
 
 /// <summary>
@@ -247,33 +495,72 @@ static void ClosePeripheralsAndHandlers(void)
 	Log_Debug("Closing file descriptors.\n");
 
 	CloseFdAndPrintError(epollFd, "Epoll");
-	CloseFdAndPrintError(buttonPollTimerFd, "Button A Timer");
+	SoftTimer_Stop(&deferredInitTimer);
+	ButtonInput_Close(&buttonA, "Button A");
+	RemoteCommand_Close();
+	Telemetry_Close();
+	TimerWheel_Close();
 	CloseFdAndPrintError(greenLEDFd, "Green LED");
 
-	CloseFdAndPrintError(button_A_GpioFd, "Button A GPIO");
-	CloseFdAndPrintError(stepperMotorTimerFd, "Stepper motor timer event");
-
-	CloseFdAndPrintError(IN1, "IN1 GPIO");
-	CloseFdAndPrintError(IN2, "IN2 GPIO");
-	CloseFdAndPrintError(IN3, "IN3 GPIO");
-	CloseFdAndPrintError(IN4, "IN4 GPIO");
+#if USE_RT_STEP_ENGINE
+	RtStepEngine_Close();
+#else
+#if USE_STALL_DETECTION
+	StallDetector_Close(&stallDetector);
+#endif
+	Homing_Close(&homing);
+	ThermalGovernor_Close();
+	MovePlanner_Close(&planner);
+	Checkpoint_Close();
+	StepperMotor_Close(&motor);
+	StepScheduler_Close();
+#endif
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
+	StartupTiming_Begin();
 	Log_Debug("GPIO application starting.\n");
-	if (InitPeripheralsAndHandlers() != 0) {
+	options.motor = defaultMotorConfig;
+	options.telemetry = (TelemetryConfig){ .periodMs = 1000 };
+	options.thermal = defaultThermalConfig;
+	if (AppOptions_Parse(argc, argv, &options) != 0 || InitPeripheralsAndHandlers() != 0) {
 		terminationRequired = true;
 	}
 
-	// Use epoll to wait for events and trigger handlers, until an error or SIGTERM happens
+	// Use epoll to wait for events and trigger handlers, until SIGTERM or an error that keeps coming back.
+	// Every ready event is drained in one wakeup so a due step is never held behind the button poll. The
+	// handlers recover from their own fd failures and only report errors once that has stopped working.
 	while (!terminationRequired) {
-		if (WaitForEventAndCallHandler(epollFd) != 0) {
-			terminationRequired = true;
+		if (WaitForEventsAndCallHandlers(epollFd, EPOLL_MAX_EVENTS_PER_WAIT) < 0) {
+			int error = errno;
+			if (!Recovery_Allow(&eventLoopRecovery, error)) {
+				terminationRequired = true;
+			}
+		}
+		if (StartupTiming_GetUs(StartupMilestone_FirstStep) == 0) {
+			CheckFirstStep();
+		}
+		if (traceDumpRequested) {
+			traceDumpRequested = false;
+			StepTrace_Dump();
+			LogEventStats();
 		}
 	}
 
 	ClosePeripheralsAndHandlers();
+	StepTrace_Dump();
+	LogEventStats();
+#if USE_RT_STEP_ENGINE
+	const StepEngineStatusMessage *status = RtStepEngine_GetLastStatus();
+	Log_Debug("Steps taken: %lu, late steps: %lu, position: %ld.\n", (unsigned long)status->stepsTaken,
+		(unsigned long)status->lateSteps, (long)status->position);
+#else
+	uint64_t stepsTaken, missedSteps;
+	StepperMotor_GetStepCounts(&motor, &stepsTaken, &missedSteps);
+	Log_Debug("Steps taken: %llu, steps missed: %llu, position: %ld.\n", (unsigned long long)stepsTaken,
+		(unsigned long long)missedSteps, (long)StepperMotor_GetPosition(&motor));
+#endif
 	Log_Debug("Application exiting.\n");
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include "motion_profile.h"
+
+// Position (in steps) reached at time t of the ramp, and the velocity there. Both ramps go from v0 to
+// v0 + dv over duration T.
+static double RampPosition(MotionProfileShape shape, double v0, double dv, double T, double t)
+{
+    if (shape == MotionProfileShape_SCurve) {
+        double u = t / T;
+        return v0 * t + dv * T * (u * u * u - u * u * u * u / 2.0);
+    }
+    return v0 * t + dv * t * t / (2.0 * T);
+}
+
+static double RampVelocity(MotionProfileShape shape, double v0, double dv, double T, double t)
+{
+    double u = t / T;
+    if (shape == MotionProfileShape_SCurve) {
+        return v0 + dv * (3.0 * u * u - 2.0 * u * u * u);
+    }
+    return v0 + dv * u;
+}
+
+int MotionProfile_Init(MotionProfile *profile, MotionProfileShape shape, uint32_t startIntervalNs,
+                       uint32_t cruiseIntervalNs, uint32_t accelerationStepsPerSec2)
+{
+    if (cruiseIntervalNs == 0 || startIntervalNs < cruiseIntervalNs ||
+        accelerationStepsPerSec2 == 0) {
+        return -1;
+    }
+
+    profile->cruiseIntervalNs = cruiseIntervalNs;
+    profile->rampLength = 0;
+
+    // This runs once at setup, so floating point is fine here; the step path only indexes the table.
+    double v0 = 1e9 / startIntervalNs;
+    double dv = 1e9 / cruiseIntervalNs - v0;
+    double T = dv / accelerationStepsPerSec2;
+    if (shape == MotionProfileShape_SCurve) {
+        T *= 1.5;
+    }
+
+    // Step k is taken when the ramp position reaches k. Solve for each crossing with Newton's method,
+    // which converges in a couple of iterations because position is smooth and velocity never drops below v0.
+    double previous = 0.0;
+    double t = 0.0;
+    for (uint32_t k = 1; k <= MOTION_PROFILE_MAX_RAMP_STEPS; ++k) {
+        t += 1.0 / RampVelocity(shape, v0, dv, T, t);
+        for (int i = 0; i < 8 && t < T; ++i) {
+            double error = RampPosition(shape, v0, dv, T, t) - (double)k;
+            t -= error / RampVelocity(shape, v0, dv, T, t);
+        }
+        if (t >= T) {
+            break;
+        }
+        uint32_t intervalNs = (uint32_t)((t - previous) * 1e9 + 0.5);
+        if (intervalNs < cruiseIntervalNs) {
+            break;
+        }
+        profile->rampIntervalsNs[profile->rampLength++] = intervalNs;
+        previous = t;
+    }
+
+    // A ramp that did not fit in the table tops out where the table ends instead of jumping to cruise.
+    if (profile->rampLength == MOTION_PROFILE_MAX_RAMP_STEPS) {
+        profile->cruiseIntervalNs = profile->rampIntervalsNs[MOTION_PROFILE_MAX_RAMP_STEPS - 1];
+    }
+    profile->levelLimit = (int32_t)profile->rampLength;
+
+    return 0;
+}
+
+int32_t MotionProfile_LevelForIntervalNs(const MotionProfile *profile, uint32_t intervalNs)
+{
+    if (intervalNs <= profile->cruiseIntervalNs) {
+        return (int32_t)profile->rampLength;
+    }
+    // The ramp intervals shrink as the level rises; find the last one that is still long enough.
+    uint32_t low = 0;
+    uint32_t high = profile->rampLength;
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        if (profile->rampIntervalsNs[middle] >= intervalNs) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low == 0 ? 0 : (int32_t)(low - 1);
+}
+
+void MotionProfile_SetSpeedLimit(MotionProfile *profile, uint32_t intervalNs)
+{
+    profile->levelLimit = intervalNs == 0 ? (int32_t)profile->rampLength
+                                          : MotionProfile_LevelForIntervalNs(profile, intervalNs);
+}
+
+void MotionRamp_Start(MotionRamp *ramp, const MotionProfile *profile, uint32_t steps)
+{
+    ramp->profile = profile;
+    ramp->level = -1;
+    ramp->stepsRemaining = steps;
+    ramp->exitLevel = 0;
+}
+
+void MotionRamp_Continue(MotionRamp *ramp, uint32_t steps, int32_t exitLevel)
+{
+    ramp->stepsRemaining = steps;
+    ramp->exitLevel = exitLevel;
+}
+
+void MotionRamp_SetExitLevel(MotionRamp *ramp, int32_t exitLevel)
+{
+    ramp->exitLevel = exitLevel;
+}
+
+void MotionRamp_RequestStop(MotionRamp *ramp)
+{
+    // The scheduled step runs at 'level'; the steps after it walk the ramp back down to entry 0.
+    uint32_t stoppingSteps = (uint32_t)(ramp->level + 1);
+    if (ramp->stepsRemaining > stoppingSteps) {
+        ramp->stepsRemaining = stoppingSteps;
+    }
+    ramp->exitLevel = 0;
+}
+
+void MotionRamp_Extend(MotionRamp *ramp, uint32_t steps)
+{
+    ramp->stepsRemaining = steps;
+}
+
+bool MotionRamp_IsDone(const MotionRamp *ramp)
+{
+    return ramp->stepsRemaining == 0;
+}
+
+bool MotionRamp_StepTaken(MotionRamp *ramp)
+{
+    if (ramp->stepsRemaining != MOTION_STEPS_UNBOUNDED && ramp->stepsRemaining > 0) {
+        --ramp->stepsRemaining;
+    }
+    return ramp->stepsRemaining > 0;
+}
+
+uint32_t MotionRamp_NextIntervalNs(MotionRamp *ramp)
+{
+    const MotionProfile *profile = ramp->profile;
+    int32_t level = ramp->level + 1;
+
+    // Above the speed limit, come down one level per step as when braking
+    if (level > profile->levelLimit) {
+        level = ramp->level > profile->levelLimit ? ramp->level - 1 : profile->levelLimit;
+    }
+    // Never go faster than the ramp can brake from in the steps left after this one, down to the exit level.
+    if (ramp->stepsRemaining != MOTION_STEPS_UNBOUNDED) {
+        int64_t brakingLimit = (int64_t)ramp->stepsRemaining - 1 + ramp->exitLevel;
+        if (level > brakingLimit) {
+            level = (int32_t)brakingLimit;
+        }
+    }
+
+    ramp->level = level;
+    return level < (int32_t)profile->rampLength ? profile->rampIntervalsNs[level]
+                                                : profile->cruiseIntervalNs;
+}
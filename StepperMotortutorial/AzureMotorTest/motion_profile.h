@@ -0,0 +1,136 @@
+/*
+Acceleration profiles for the stepper.
+A MotionProfile precomputes the step intervals for accelerating from a start (pull-in) speed up to a cruise
+speed. Deceleration replays the same table backwards, so a move is accelerate, cruise, decelerate and the
+only work per step is picking the next table entry. The step timer is re-armed with that interval as a
+single expiry on every step.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// <summary>Maximum number of steps in the acceleration ramp; longer ramps are cut short.</summary>
+#define MOTION_PROFILE_MAX_RAMP_STEPS 512
+
+/// <summary>Step count for moves that run until <see cref="MotionRamp_RequestStop" /> is called.</summary>
+#define MOTION_STEPS_UNBOUNDED UINT32_MAX
+
+/// <summary>
+///     Shape of the velocity ramp.
+/// </summary>
+typedef enum {
+    /// <summary>Constant acceleration; the shortest ramp for a given acceleration limit.</summary>
+    MotionProfileShape_Trapezoidal,
+    /// <summary>Smoothstep velocity with zero acceleration at both ends of the ramp, which avoids the jerk
+    /// that makes a loaded motor skip when the acceleration suddenly changes. Peak acceleration equals the
+    /// limit, so the ramp is 1.5 times as long as the trapezoidal one.</summary>
+    MotionProfileShape_SCurve
+} MotionProfileShape;
+
+/// <summary>
+///     Precomputed step intervals for one ramp.
+/// </summary>
+typedef struct {
+    /// <summary>Interval before each step of the ramp, starting from standstill.</summary>
+    uint32_t rampIntervalsNs[MOTION_PROFILE_MAX_RAMP_STEPS];
+    /// <summary>Number of valid entries in rampIntervalsNs.</summary>
+    uint32_t rampLength;
+    /// <summary>Interval between steps once the ramp is complete.</summary>
+    uint32_t cruiseIntervalNs;
+    /// <summary>Highest level a move may run at; rampLength unless the speed is limited.</summary>
+    int32_t levelLimit;
+} MotionProfile;
+
+/// <summary>
+///     Progress through a move that follows a profile.
+/// </summary>
+typedef struct {
+    const MotionProfile *profile;
+    /// <summary>Ramp entry used for the step that is currently scheduled; -1 at standstill. A level equal to
+    /// the ramp length means cruising.</summary>
+    int32_t level;
+    /// <summary>Steps still to take including the one that is scheduled, or MOTION_STEPS_UNBOUNDED.</summary>
+    uint32_t stepsRemaining;
+    /// <summary>Highest level the last step may run at; 0 stops, higher levels hand over to a following move
+    /// at speed.</summary>
+    int32_t exitLevel;
+} MotionRamp;
+
+/// <summary>
+///     Precomputes the ramp for a profile.
+/// </summary>
+/// <param name="profile">Profile to fill in</param>
+/// <param name="shape">Shape of the velocity ramp</param>
+/// <param name="startIntervalNs">Step interval the motor can start at without stalling</param>
+/// <param name="cruiseIntervalNs">Step interval at top speed; must not be longer than startIntervalNs</param>
+/// <param name="accelerationStepsPerSec2">Acceleration limit in steps per second squared</param>
+/// <returns>0 on success, or -1 if the parameters are invalid</returns>
+int MotionProfile_Init(MotionProfile *profile, MotionProfileShape shape, uint32_t startIntervalNs,
+                       uint32_t cruiseIntervalNs, uint32_t accelerationStepsPerSec2);
+
+/// <summary>
+///     Returns the highest ramp level whose step interval is at least <paramref name="intervalNs" />, so that a
+///     move at that level is no faster than the given interval. Returns 0 when even the start interval is
+///     shorter, and the ramp length (cruise) when the cruise interval is long enough.
+/// </summary>
+int32_t MotionProfile_LevelForIntervalNs(const MotionProfile *profile, uint32_t intervalNs);
+
+/// <summary>
+///     Limits the speed of every move that follows the profile to that of a step interval. A move that is
+///     running faster slows down to it along the ramp, at the same rate as it would brake.
+/// </summary>
+/// <param name="profile">Profile to limit</param>
+/// <param name="intervalNs">Shortest step interval, or 0 to run up to the cruise speed again</param>
+void MotionProfile_SetSpeedLimit(MotionProfile *profile, uint32_t intervalNs);
+
+/// <summary>
+///     Starts a move from standstill.
+/// </summary>
+/// <param name="ramp">Move state</param>
+/// <param name="profile">Profile to follow; must stay valid for the whole move</param>
+/// <param name="steps">Number of steps in the move, or MOTION_STEPS_UNBOUNDED</param>
+void MotionRamp_Start(MotionRamp *ramp, const MotionProfile *profile, uint32_t steps);
+
+/// <summary>
+///     Starts the next move of a blended sequence at the speed the previous one ended at.
+/// </summary>
+/// <param name="ramp">Move state of the move that just ended</param>
+/// <param name="steps">Number of steps in the next move</param>
+/// <param name="exitLevel">Highest level the last step of the next move may run at</param>
+void MotionRamp_Continue(MotionRamp *ramp, uint32_t steps, int32_t exitLevel);
+
+/// <summary>
+///     Changes the speed the move may end at, for example when another move is queued behind it. Raising it is
+///     always safe; lowering it below what the remaining steps can brake to is not.
+/// </summary>
+void MotionRamp_SetExitLevel(MotionRamp *ramp, int32_t exitLevel);
+
+/// <summary>
+///     Shortens the move so that it decelerates to a stop as soon as possible.
+///     The step that is already scheduled still happens.
+/// </summary>
+void MotionRamp_RequestStop(MotionRamp *ramp);
+
+/// <summary>
+///     Resumes accelerating towards cruise speed after <see cref="MotionRamp_RequestStop" />,
+///     turning the move back into one of <paramref name="steps" /> steps from the current speed.
+/// </summary>
+void MotionRamp_Extend(MotionRamp *ramp, uint32_t steps);
+
+/// <summary>
+///     Returns true when no steps are left.
+/// </summary>
+bool MotionRamp_IsDone(const MotionRamp *ramp);
+
+/// <summary>
+///     Records that the scheduled step was taken.
+/// </summary>
+/// <returns>true if more steps follow</returns>
+bool MotionRamp_StepTaken(MotionRamp *ramp);
+
+/// <summary>
+///     Picks the speed for the next step and returns the interval to wait before taking it.
+///     Must only be called when <see cref="MotionRamp_IsDone" /> is false.
+/// </summary>
+uint32_t MotionRamp_NextIntervalNs(MotionRamp *ramp);
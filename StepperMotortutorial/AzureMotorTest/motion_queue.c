@@ -0,0 +1,148 @@
+#include <stddef.h>
+
+#include <applibs/log.h>
+
+#include "motion_queue.h"
+
+static MotionSegment *SegmentAt(MotionQueue *queue, uint32_t index)
+{
+    return &queue->segments[(queue->head + index) & (MOTION_QUEUE_CAPACITY - 1)];
+}
+
+// The fastest the planner may tick through the corner between two segments. A stepper tolerates an instant
+// change of speed up to its start (pull-in) speed, so the corner is taken at the tick rate where no axis changes
+// speed by more than that. Axis speeds are fractions of the tick rate (delta over major steps), so the tick
+// interval has to be at least the start interval times the largest change of fraction.
+// This runs on push, not per step, so floating point is fine here.
+static int32_t JunctionLimit(const MotionQueue *queue, const MotionSegment *from, const MotionSegment *to)
+{
+    double largestChange = 0.0;
+    for (uint32_t axis = 0; axis < queue->axisCount; ++axis) {
+        double fromFraction = (double)from->directions[axis] * from->deltas[axis] / from->majorSteps;
+        double toFraction = (double)to->directions[axis] * to->deltas[axis] / to->majorSteps;
+        double change = fromFraction > toFraction ? fromFraction - toFraction : toFraction - fromFraction;
+        if (change > largestChange) {
+            largestChange = change;
+        }
+    }
+
+    const MotionProfile *profile = queue->profile;
+    uint32_t startIntervalNs =
+        profile->rampLength > 0 ? profile->rampIntervalsNs[0] : profile->cruiseIntervalNs;
+    double cornerIntervalNs = startIntervalNs * largestChange;
+    if (cornerIntervalNs >= startIntervalNs) {
+        return 0;
+    }
+    return MotionProfile_LevelForIntervalNs(profile, (uint32_t)cornerIntervalNs);
+}
+
+// The exit level of the segment before 'next': no faster than the corner into 'next' allows, and no faster than
+// 'next' can brake from in its own steps, one ramp level per step down to its own exit level.
+static int32_t PlanExitLevel(const MotionQueue *queue, const MotionSegment *next)
+{
+    int64_t exitLevel = (int64_t)next->majorSteps + next->exitLevel;
+    if (exitLevel > next->entryLimit) {
+        exitLevel = next->entryLimit;
+    }
+    if (exitLevel > queue->profile->levelLimit) {
+        exitLevel = queue->profile->levelLimit;
+    }
+    return (int32_t)exitLevel;
+}
+
+void MotionQueue_Init(MotionQueue *queue, uint32_t axisCount, const MotionProfile *profile)
+{
+    queue->axisCount = axisCount;
+    queue->profile = profile;
+    static const int32_t origin[MOTION_QUEUE_MAX_AXES] = {0};
+    MotionQueue_Reset(queue, origin);
+}
+
+void MotionQueue_Reset(MotionQueue *queue, const int32_t *positions)
+{
+    queue->head = 0;
+    queue->count = 0;
+    for (uint32_t axis = 0; axis < queue->axisCount; ++axis) {
+        queue->tailPositions[axis] = positions[axis];
+    }
+}
+
+void MotionQueue_Truncate(MotionQueue *queue, uint32_t brakingSteps)
+{
+    if (queue->count == 0) {
+        return;
+    }
+
+    uint32_t kept = 1;
+    uint32_t steps = 0;
+    while (kept < queue->count && steps < brakingSteps) {
+        steps += SegmentAt(queue, kept)->majorSteps;
+        ++kept;
+    }
+    queue->count = kept;
+
+    SegmentAt(queue, kept - 1)->exitLevel = 0;
+    for (uint32_t index = kept - 1; index > 0; --index) {
+        SegmentAt(queue, index - 1)->exitLevel = PlanExitLevel(queue, SegmentAt(queue, index));
+    }
+}
+
+int MotionQueue_Push(MotionQueue *queue, const int32_t *targets)
+{
+    if (queue->count == MOTION_QUEUE_CAPACITY) {
+        return -1;
+    }
+
+    MotionSegment *segment = SegmentAt(queue, queue->count);
+    segment->majorSteps = 0;
+    for (uint32_t axis = 0; axis < queue->axisCount; ++axis) {
+        int64_t delta = (int64_t)targets[axis] - queue->tailPositions[axis];
+        // Keeps the planner's error terms below 2^32
+        if (delta > INT32_MAX || delta < -INT32_MAX) {
+            Log_Debug("ERROR: Queued move on axis %u is too long.\n", axis);
+            return -1;
+        }
+        segment->directions[axis] = delta < 0 ? -1 : 1;
+        segment->deltas[axis] = (uint32_t)(delta < 0 ? -delta : delta);
+        if (segment->deltas[axis] > segment->majorSteps) {
+            segment->majorSteps = segment->deltas[axis];
+        }
+    }
+    if (segment->majorSteps == 0) {
+        return 0;
+    }
+
+    segment->entryLimit =
+        queue->count > 0 ? JunctionLimit(queue, SegmentAt(queue, queue->count - 1), segment) : 0;
+    segment->exitLevel = 0;
+    ++queue->count;
+    for (uint32_t axis = 0; axis < queue->axisCount; ++axis) {
+        queue->tailPositions[axis] = targets[axis];
+    }
+
+    // Walk back from the new stop at the tail. Appending only ever relaxes the limits, so the walk stops at the
+    // first segment that does not change.
+    for (uint32_t index = queue->count - 1; index > 0; --index) {
+        MotionSegment *previous = SegmentAt(queue, index - 1);
+        int32_t exitLevel = PlanExitLevel(queue, SegmentAt(queue, index));
+        if (previous->exitLevel == exitLevel) {
+            break;
+        }
+        previous->exitLevel = exitLevel;
+    }
+
+    return 0;
+}
+
+const MotionSegment *MotionQueue_Peek(const MotionQueue *queue)
+{
+    return queue->count > 0 ? &queue->segments[queue->head] : NULL;
+}
+
+void MotionQueue_Pop(MotionQueue *queue)
+{
+    if (queue->count > 0) {
+        queue->head = (queue->head + 1) & (MOTION_QUEUE_CAPACITY - 1);
+        --queue->count;
+    }
+}
@@ -0,0 +1,86 @@
+/*
+Queue of straight-line motion segments for the move planner.
+Producers (the button handler, a socket or the inter-core mailbox) append targets while the planner drains the
+segment at the head, all from the one epoll thread, so the fixed ring needs no locking and never allocates.
+Every push re-plans the speed at each junction, working backwards from a stop after the last segment: a segment
+may end as fast as the corner to the next one allows and as the rest of the queue can still brake from, so
+consecutive moves blend without stopping in between.
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include "motion_profile.h"
+
+/// <summary>Maximum number of segments queued, including the one being executed. Must be a power of two.</summary>
+#define MOTION_QUEUE_CAPACITY 32
+
+/// <summary>Maximum number of axes in a segment.</summary>
+#define MOTION_QUEUE_MAX_AXES 4
+
+/// <summary>
+///     One straight-line move, relative to where the previous segment ends.
+/// </summary>
+typedef struct {
+    /// <summary>Distance each axis moves.</summary>
+    uint32_t deltas[MOTION_QUEUE_MAX_AXES];
+    /// <summary>1 or -1 per axis.</summary>
+    int8_t directions[MOTION_QUEUE_MAX_AXES];
+    /// <summary>Distance of the axis that moves furthest, which is the number of planner ticks.</summary>
+    uint32_t majorSteps;
+    /// <summary>Highest ramp level allowed through the corner from the previous segment.</summary>
+    int32_t entryLimit;
+    /// <summary>Highest ramp level the last step may run at, as planned from the segments behind it.</summary>
+    int32_t exitLevel;
+} MotionSegment;
+
+/// <summary>
+///     Ring buffer of segments.
+/// </summary>
+typedef struct {
+    MotionSegment segments[MOTION_QUEUE_CAPACITY];
+    uint32_t head;
+    uint32_t count;
+    uint32_t axisCount;
+    const MotionProfile *profile;
+    /// <summary>Position each axis is at once every queued segment has run.</summary>
+    int32_t tailPositions[MOTION_QUEUE_MAX_AXES];
+} MotionQueue;
+
+/// <summary>
+///     Empties the queue.
+/// </summary>
+/// <param name="queue">Queue</param>
+/// <param name="axisCount">Number of axes, at most MOTION_QUEUE_MAX_AXES</param>
+/// <param name="profile">Ramp whose levels the junction speeds are planned in; must stay valid</param>
+void MotionQueue_Init(MotionQueue *queue, uint32_t axisCount, const MotionProfile *profile);
+
+/// <summary>
+///     Drops every segment and sets where the next one starts from.
+/// </summary>
+void MotionQueue_Reset(MotionQueue *queue, const int32_t *positions);
+
+/// <summary>
+///     Drops the segments that are not needed to brake, and re-plans the rest to end in a stop.
+/// </summary>
+/// <param name="queue">Queue</param>
+/// <param name="brakingSteps">Steps still needed to brake once the head segment ends; 0 keeps only the head</param>
+void MotionQueue_Truncate(MotionQueue *queue, uint32_t brakingSteps);
+
+/// <summary>
+///     Appends a segment to an absolute position and re-plans the junction speeds. A target equal to the end of
+///     the queue is ignored.
+/// </summary>
+/// <param name="targets">One target per axis</param>
+/// <returns>0 on success, or -1 if the queue is full or the move is too long</returns>
+int MotionQueue_Push(MotionQueue *queue, const int32_t *targets);
+
+/// <summary>
+///     Returns the segment at the head, or NULL if the queue is empty.
+/// </summary>
+const MotionSegment *MotionQueue_Peek(const MotionQueue *queue);
+
+/// <summary>
+///     Removes the segment at the head.
+/// </summary>
+void MotionQueue_Pop(MotionQueue *queue);
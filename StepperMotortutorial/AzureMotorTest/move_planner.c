@@ -0,0 +1,228 @@
+#include <stddef.h>
+
+#include <applibs/log.h>
+
+#include "move_planner.h"
+#include "step_trace.h"
+
+static void Notify(MovePlanner *planner, MovePlannerEvent event)
+{
+    if (planner->callback != NULL) {
+        planner->callback(planner, event);
+    }
+}
+
+// Empty the queue so the next move starts from where the axes actually are.
+static void ResetQueue(MovePlanner *planner)
+{
+    int32_t positions[MOVE_PLANNER_MAX_AXES];
+    for (uint32_t axis = 0; axis < planner->axisCount; ++axis) {
+        positions[axis] = StepperMotor_GetPosition(planner->axes[axis]);
+    }
+    MotionQueue_Reset(&planner->queue, positions);
+}
+
+static void FinishMove(MovePlanner *planner, MovePlannerEvent event)
+{
+    planner->isMoving = false;
+    planner->isStopping = false;
+    StepScheduler_Cancel(&planner->task);
+    for (uint32_t axis = 0; axis < planner->axisCount; ++axis) {
+        StepperMotor_Hold(planner->axes[axis]);
+    }
+    ResetQueue(planner);
+    Notify(planner, event);
+}
+
+// Load the Bresenham state for a segment. Starting every error term half way rounds each axis's steps to the
+// nearest tick.
+static void BeginSegment(MovePlanner *planner, const MotionSegment *segment)
+{
+    planner->majorSteps = segment->majorSteps;
+    for (uint32_t axis = 0; axis < planner->axisCount; ++axis) {
+        planner->deltas[axis] = segment->deltas[axis];
+        planner->directions[axis] = segment->directions[axis];
+        planner->errors[axis] = segment->majorSteps / 2;
+    }
+}
+
+// One tick is one step of the major axis. Every axis adds its distance to its error term and steps when the
+// term reaches the major distance, which spreads its steps evenly over the segment. The major axis steps on every
+// tick. When a segment ends the ramp carries on into the next one at the speed it ended at.
+// The step clock chains deadlines from the previous one; if a tick runs so late that the next one is already due,
+// the clock skips ahead on the same time grid rather than bursting steps on every axis at once.
+static void MovePlannerTaskHandler(StepSchedulerTask *task, uint64_t nowNs)
+{
+    MovePlanner *planner = (MovePlanner *)task;
+
+    if (!planner->isMoving) {
+        return;
+    }
+    if (MotionRamp_IsDone(&planner->ramp)) {
+        // A stop requested before the first tick
+        FinishMove(planner, MovePlannerEvent_MoveComplete);
+        return;
+    }
+
+    for (uint32_t axis = 0; axis < planner->axisCount; ++axis) {
+        planner->errors[axis] += planner->deltas[axis];
+        if (planner->errors[axis] >= planner->majorSteps) {
+            planner->errors[axis] -= planner->majorSteps;
+            StepperMotor_Step(planner->axes[axis], planner->directions[axis]);
+        }
+    }
+
+    if (!MotionRamp_StepTaken(&planner->ramp)) {
+        MotionQueue_Pop(&planner->queue);
+        const MotionSegment *next = MotionQueue_Peek(&planner->queue);
+        if (next == NULL) {
+            FinishMove(planner, MovePlannerEvent_MoveComplete);
+            return;
+        }
+        BeginSegment(planner, next);
+        MotionRamp_Continue(&planner->ramp, next->majorSteps, next->exitLevel);
+    }
+
+    uint32_t intervalNs = MotionRamp_NextIntervalNs(&planner->ramp);
+    StepClock_Advance(&planner->clock, intervalNs);
+    uint64_t missed = StepClock_Resync(&planner->clock, nowNs, intervalNs);
+    if (missed > 0) {
+        StepTrace_RecordEvent(StepTraceKind_Missed, 0, 0, (int32_t)missed);
+    }
+    if (StepScheduler_Schedule(task, planner->clock.deadlineNs) != 0) {
+        FinishMove(planner, MovePlannerEvent_Error);
+    }
+}
+
+int MovePlanner_Init(MovePlanner *planner, StepperMotor *const *axes, uint32_t axisCount,
+                     const MovePlannerConfig *config, MovePlannerCallback callback)
+{
+    StepScheduler_InitTask(&planner->task, &MovePlannerTaskHandler);
+    planner->callback = callback;
+    planner->isMoving = false;
+    planner->isStopping = false;
+
+    if (axisCount == 0 || axisCount > MOVE_PLANNER_MAX_AXES) {
+        Log_Debug("ERROR: A move planner takes 1 to %d axes.\n", MOVE_PLANNER_MAX_AXES);
+        return -1;
+    }
+    planner->axisCount = axisCount;
+    for (uint32_t axis = 0; axis < axisCount; ++axis) {
+        planner->axes[axis] = axes[axis];
+    }
+
+    if (MotionProfile_Init(&planner->profile, config->profileShape, config->startIntervalNs,
+                           config->cruiseIntervalNs, config->accelerationStepsPerSec2) != 0) {
+        Log_Debug("ERROR: Invalid move planner motion profile.\n");
+        return -1;
+    }
+    MotionQueue_Init(&planner->queue, axisCount, &planner->profile);
+
+    return 0;
+}
+
+void MovePlanner_Close(MovePlanner *planner)
+{
+    StepScheduler_Cancel(&planner->task);
+    planner->isMoving = false;
+    planner->isStopping = false;
+    ResetQueue(planner);
+}
+
+// Every accepted move goes into the step trace along with the steps it makes, so that a dump can be replayed
+static void TraceMove(const MovePlanner *planner, const int32_t *targets, bool fromRest)
+{
+    if (fromRest) {
+        for (uint32_t axis = 0; axis < planner->axisCount; ++axis) {
+            StepTrace_RecordEvent(StepTraceKind_Origin, (uint8_t)axis,
+                                  (uint8_t)StepperMotor_GetPhase(planner->axes[axis]),
+                                  StepperMotor_GetPosition(planner->axes[axis]));
+        }
+    }
+    for (uint32_t axis = 0; axis < planner->axisCount; ++axis) {
+        StepTrace_RecordEvent(StepTraceKind_MoveTo, (uint8_t)axis, 0, targets[axis]);
+    }
+}
+
+int MovePlanner_MoveTo(MovePlanner *planner, const int32_t *targets)
+{
+    if (planner->isStopping) {
+        return -1;
+    }
+
+    if (planner->isMoving) {
+        if (MotionQueue_Push(&planner->queue, targets) != 0) {
+            return -1;
+        }
+        TraceMove(planner, targets, false);
+        // The segment behind the running one may let it end faster now
+        MotionRamp_SetExitLevel(&planner->ramp, MotionQueue_Peek(&planner->queue)->exitLevel);
+        return 0;
+    }
+
+    for (uint32_t axis = 0; axis < planner->axisCount; ++axis) {
+        if (StepperMotor_IsMoving(planner->axes[axis])) {
+            return -1;
+        }
+    }
+    ResetQueue(planner);
+    if (MotionQueue_Push(&planner->queue, targets) != 0) {
+        return -1;
+    }
+    const MotionSegment *segment = MotionQueue_Peek(&planner->queue);
+    if (segment == NULL) {
+        Notify(planner, MovePlannerEvent_MoveComplete);
+        return 0;
+    }
+
+    BeginSegment(planner, segment);
+    MotionRamp_Start(&planner->ramp, &planner->profile, segment->majorSteps);
+    planner->isMoving = true;
+    // Before the clock starts, so that whatever the callback does first does not eat into the first interval
+    Notify(planner, MovePlannerEvent_MoveStarting);
+    StepClock_Start(&planner->clock, StepScheduler_Now());
+    uint64_t deadlineNs = StepClock_Advance(&planner->clock, MotionRamp_NextIntervalNs(&planner->ramp));
+    if (StepScheduler_Schedule(&planner->task, deadlineNs) != 0) {
+        planner->isMoving = false;
+        ResetQueue(planner);
+        return -1;
+    }
+
+    TraceMove(planner, targets, true);
+    return 0;
+}
+
+void MovePlanner_Stop(MovePlanner *planner)
+{
+    if (!planner->isMoving || planner->isStopping) {
+        return;
+    }
+    planner->isStopping = true;
+    StepTrace_RecordEvent(StepTraceKind_Stop, 0, 0, 0);
+
+    // Braking takes one step per ramp level. If the running segment is too short for that, keep as many of the
+    // queued segments as the braking distance runs into.
+    uint32_t brakingSteps = (uint32_t)(planner->ramp.level + 1);
+    if (planner->ramp.stepsRemaining >= brakingSteps) {
+        MotionQueue_Truncate(&planner->queue, 0);
+        MotionRamp_RequestStop(&planner->ramp);
+    } else {
+        MotionQueue_Truncate(&planner->queue, brakingSteps - planner->ramp.stepsRemaining);
+        MotionRamp_SetExitLevel(&planner->ramp, MotionQueue_Peek(&planner->queue)->exitLevel);
+    }
+}
+
+void MovePlanner_SetSpeedLimit(MovePlanner *planner, uint32_t intervalNs)
+{
+    MotionProfile_SetSpeedLimit(&planner->profile, intervalNs);
+}
+
+bool MovePlanner_IsMoving(const MovePlanner *planner)
+{
+    return planner->isMoving;
+}
+
+uint32_t MovePlanner_GetAxisCount(const MovePlanner *planner)
+{
+    return planner->axisCount;
+}
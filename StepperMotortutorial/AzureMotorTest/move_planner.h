@@ -0,0 +1,127 @@
+/*
+Coordinated moves of several motors along a straight line.
+The planner runs one task on the shared step scheduler. Each tick is one step of the axis with the longest
+distance to go, paced by that axis's acceleration profile, and every other axis steps on the ticks an integer
+Bresenham error term picks, so all axes start together, stay on the line and arrive on the same tick. The hot path
+is integer adds and compares only.
+Moves are queued. The segments behind the running one are planned ahead, so the planner carries its speed
+through each corner as far as the corner and the distance left allow instead of stopping after every move.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "motion_profile.h"
+#include "motion_queue.h"
+#include "step_scheduler.h"
+#include "stepper_motor.h"
+
+/// <summary>Maximum number of axes one planner coordinates.</summary>
+#define MOVE_PLANNER_MAX_AXES MOTION_QUEUE_MAX_AXES
+
+/// <summary>
+///     Events reported by the planner.
+/// </summary>
+typedef enum {
+    /// <summary>A move from rest is about to start; its first tick has not been scheduled yet.</summary>
+    MovePlannerEvent_MoveStarting,
+    /// <summary>Every axis came to a stop and the queue is empty.</summary>
+    MovePlannerEvent_MoveComplete,
+    /// <summary>The next tick could not be scheduled; every axis is stopped.</summary>
+    MovePlannerEvent_Error
+} MovePlannerEvent;
+
+struct MovePlanner;
+
+/// <summary>
+///     Function signature for planner event callbacks.
+/// </summary>
+typedef void (*MovePlannerCallback)(struct MovePlanner *planner, MovePlannerEvent event);
+
+/// <summary>
+///     Speed limits of a planned move. The speeds are those of the axis that moves furthest.
+/// </summary>
+typedef struct {
+    /// <summary>Shape of the acceleration ramp.</summary>
+    MotionProfileShape profileShape;
+    /// <summary>Step interval the motors can start at without stalling.</summary>
+    uint32_t startIntervalNs;
+    /// <summary>Step interval at cruise speed.</summary>
+    uint32_t cruiseIntervalNs;
+    /// <summary>Acceleration limit in steps per second squared.</summary>
+    uint32_t accelerationStepsPerSec2;
+} MovePlannerConfig;
+
+/// <summary>
+///     State of one planner. Treat the members as private to move_planner.c.
+/// </summary>
+typedef struct MovePlanner {
+    /// <summary>Tick task on the shared scheduler; must stay the first member.</summary>
+    StepSchedulerTask task;
+    /// <summary>Deadline of the latest tick.</summary>
+    StepClock clock;
+    MovePlannerCallback callback;
+    StepperMotor *axes[MOVE_PLANNER_MAX_AXES];
+    uint32_t axisCount;
+    MotionProfile profile;
+    MotionRamp ramp;
+    /// <summary>Segments still to run; the head is the one running.</summary>
+    MotionQueue queue;
+    bool isMoving;
+    bool isStopping;
+    /// <summary>Ticks in the running segment, which is the distance of the axis that moves furthest.</summary>
+    uint32_t majorSteps;
+    uint32_t deltas[MOVE_PLANNER_MAX_AXES];
+    uint32_t errors[MOVE_PLANNER_MAX_AXES];
+    int directions[MOVE_PLANNER_MAX_AXES];
+} MovePlanner;
+
+/// <summary>
+///     Sets up a planner for a group of open motors. <see cref="StepScheduler_Init" /> must have been called.
+/// </summary>
+/// <param name="planner">Planner state; must stay in memory until <see cref="MovePlanner_Close" /></param>
+/// <param name="axes">Motors to coordinate, in the order targets are given</param>
+/// <param name="axisCount">Number of motors, at most MOVE_PLANNER_MAX_AXES</param>
+/// <param name="config">Speed limits</param>
+/// <param name="callback">Function called when a move starts, completes or fails; may be NULL</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int MovePlanner_Init(MovePlanner *planner, StepperMotor *const *axes, uint32_t axisCount,
+                     const MovePlannerConfig *config, MovePlannerCallback callback);
+
+/// <summary>
+///     Stops ticking and drops the queue. The motors stay open and keep their positions.
+/// </summary>
+void MovePlanner_Close(MovePlanner *planner);
+
+/// <summary>
+///     Queues a straight-line move of every axis to an absolute position, starting from where the queued moves
+///     end. When the planner is idle the move starts right away; none of the motors may be moving then, and they
+///     must not be commanded on their own until <see cref="MovePlannerEvent_MoveComplete" /> is reported.
+/// </summary>
+/// <param name="targets">One target per axis, in steps of that motor's active step mode</param>
+/// <returns>0 on success, or -1 if the queue is full, a stop is under way or an axis is moving</returns>
+int MovePlanner_MoveTo(MovePlanner *planner, const int32_t *targets);
+
+/// <summary>
+///     Decelerates to a stop and drops the queued moves that are not needed to brake. The axes stay on the path
+///     of the moves they ran.
+/// </summary>
+void MovePlanner_Stop(MovePlanner *planner);
+
+/// <summary>
+///     Limits the speed along the path to that of a step interval of the axis that moves furthest. A move running
+///     faster slows down to it along the ramp, and moves queued after it are planned for it.
+/// </summary>
+/// <param name="intervalNs">Shortest step interval, or 0 to run up to the configured cruise speed again</param>
+void MovePlanner_SetSpeedLimit(MovePlanner *planner, uint32_t intervalNs);
+
+/// <summary>
+///     Returns true while a planned move is under way.
+/// </summary>
+bool MovePlanner_IsMoving(const MovePlanner *planner);
+
+/// <summary>
+///     Returns the number of axes, which is the number of targets <see cref="MovePlanner_MoveTo" /> takes.
+/// </summary>
+uint32_t MovePlanner_GetAxisCount(const MovePlanner *planner);
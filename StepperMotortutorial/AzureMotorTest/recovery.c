@@ -0,0 +1,41 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "recovery.h"
+
+static uint32_t totalRecoveries = 0;
+
+bool Recovery_IsTransient(int error)
+{
+    return error == EINTR || error == EAGAIN || error == EWOULDBLOCK || error == EBUSY || error == ENOMEM;
+}
+
+bool Recovery_Allow(RecoveryBudget *budget, int error)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t nowNs = (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+    if (budget->faults == 0 || nowNs - budget->windowStartNs >= RECOVERY_WINDOW_NS) {
+        budget->faults = 0;
+        budget->windowStartNs = nowNs;
+    }
+
+    if (++budget->faults > RECOVERY_MAX_FAULTS) {
+        // Logged once per window, not on every retry after it
+        if (budget->faults == RECOVERY_MAX_FAULTS + 1) {
+            Log_Debug("ERROR: %s keeps failing: %s (%d).\n", budget->name, strerror(error), error);
+        }
+        return false;
+    }
+    ++totalRecoveries;
+    Log_Debug("Recovering %s from: %s (%d).\n", budget->name, strerror(error), error);
+    return true;
+}
+
+uint32_t Recovery_GetTotal(void)
+{
+    return totalRecoveries;
+}
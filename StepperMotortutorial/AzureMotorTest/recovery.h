@@ -0,0 +1,51 @@
+/*
+Recovery from transient faults.
+A read or write that fails on a timerfd or GPIO is usually a glitch, and restarting the whole app for it costs
+seconds and the motor position. Instead the owner of the fd retries, and if the error is not one that goes away
+by itself it closes that one fd and opens it again, while everything else keeps running. The objects on top of
+the fd keep their state through this, so a motor keeps its position and the phase it is holding.
+Every fault source has a budget of RECOVERY_MAX_FAULTS within RECOVERY_WINDOW_NS. A fault beyond that is not
+transient, and the owner reports it as an error as before.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// <summary>Faults a source may recover from within one window.</summary>
+#define RECOVERY_MAX_FAULTS 5
+/// <summary>Length of the window the faults are counted in.</summary>
+#define RECOVERY_WINDOW_NS 10000000000ull
+
+/// <summary>
+///     Fault count of one source. Initialize with <see cref="RECOVERY_BUDGET" />.
+/// </summary>
+typedef struct {
+    /// <summary>Name for the log.</summary>
+    const char *name;
+    /// <summary>Faults in the current window.</summary>
+    uint32_t faults;
+    /// <summary>Start of the current window.</summary>
+    uint64_t windowStartNs;
+} RecoveryBudget;
+
+/// <summary>Initializer for a budget with no faults.</summary>
+#define RECOVERY_BUDGET(sourceName) {.name = (sourceName), .faults = 0, .windowStartNs = 0}
+
+/// <summary>
+///     Returns true for errors that go away without reopening the fd, for which a retry is enough.
+/// </summary>
+bool Recovery_IsTransient(int error);
+
+/// <summary>
+///     Counts a fault and logs it.
+/// </summary>
+/// <param name="budget">Budget of the source that failed</param>
+/// <param name="error">errno of the failure, for the log</param>
+/// <returns>true if the source should recover, or false once it has used up its budget</returns>
+bool Recovery_Allow(RecoveryBudget *budget, int error);
+
+/// <summary>
+///     Returns how many faults every source together has recovered from since the app started.
+/// </summary>
+uint32_t Recovery_GetTotal(void);
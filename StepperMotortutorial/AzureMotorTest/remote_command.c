@@ -0,0 +1,252 @@
+// accept4
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "remote_command.h"
+
+// How often a paused command is retried
+#define RETRY_PERIOD_NS 10000000L
+
+static void ListenEventHandler(EventData *eventData);
+static void ClientEventHandler(EventData *eventData);
+static void RetryTimerHandler(SoftTimer *timer);
+
+static EventData listenEventData = {.eventHandler = &ListenEventHandler, .priority = EventPriority_Low};
+static EventData clientEventData = {.eventHandler = &ClientEventHandler, .priority = EventPriority_Low};
+static SoftTimer retryTimer;
+static int commandEpollFd = -1;
+static int listenFd = -1;
+static int clientFd = -1;
+// Whether the client socket is in epoll, which it is while the receive buffer has room
+static bool clientReading = false;
+static MovePlanner *commandPlanner = NULL;
+
+// Bytes received and not parsed yet are receiveBuffer[parsed, filled)
+static uint8_t receiveBuffer[REMOTE_COMMAND_BUFFER_BYTES];
+static size_t filled = 0;
+static size_t parsed = 0;
+
+static int32_t ReadInt32(const uint8_t *bytes)
+{
+    return (int32_t)((uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 |
+                     (uint32_t)bytes[3] << 24);
+}
+
+static void CloseClient(void)
+{
+    if (clientFd < 0) {
+        return;
+    }
+    SoftTimer_Stop(&retryTimer);
+    if (clientReading) {
+        UnregisterEventHandlerFromEpoll(commandEpollFd, clientFd);
+        clientReading = false;
+    }
+    CloseFdAndPrintError(clientFd, "Command client");
+    clientFd = -1;
+    filled = 0;
+    parsed = 0;
+}
+
+static int SetReading(bool reading)
+{
+    if (reading == clientReading) {
+        return 0;
+    }
+    int result = reading ? RegisterEventHandlerToEpoll(commandEpollFd, clientFd, &clientEventData, EPOLLIN)
+                         : UnregisterEventHandlerFromEpoll(commandEpollFd, clientFd);
+    if (result == 0) {
+        clientReading = reading;
+    }
+    return result;
+}
+
+typedef enum { Parse_NeedMoreData, Parse_Paused, Parse_ProtocolError } ParseResult;
+
+// Finds a Stop among the whole commands after the paused one at 'parsed'. The Stop would drop the moves between
+// the two from the queue anyway, so it can skip them and run at once instead of waiting behind them.
+static bool FindStop(size_t moveLength, size_t *stop)
+{
+    size_t offset = parsed;
+    while (offset < filled) {
+        if (receiveBuffer[offset] == RemoteCommand_Stop) {
+            *stop = offset;
+            return true;
+        }
+        if (receiveBuffer[offset] != RemoteCommand_MoveTo) {
+            // Left for the parser to reject in its turn
+            return false;
+        }
+        offset += moveLength;
+    }
+    return false;
+}
+
+// Run every whole command in the buffer. A move the planner cannot take yet, and whatever follows it when the
+// event loop asks to yield, stays in the buffer for the retry, unless a Stop follows.
+static ParseResult ParseCommands(void)
+{
+    size_t moveLength = 1 + 4 * (size_t)MovePlanner_GetAxisCount(commandPlanner);
+    size_t stop;
+    for (;;) {
+        const uint8_t *command = &receiveBuffer[parsed];
+        size_t available = filled - parsed;
+        if (available == 0) {
+            return Parse_NeedMoreData;
+        }
+
+        switch (command[0]) {
+        case RemoteCommand_MoveTo: {
+            if (available < moveLength) {
+                return Parse_NeedMoreData;
+            }
+            int32_t targets[MOVE_PLANNER_MAX_AXES];
+            for (uint32_t axis = 0; axis < MovePlanner_GetAxisCount(commandPlanner); ++axis) {
+                targets[axis] = ReadInt32(&command[1 + 4 * axis]);
+            }
+            if (MovePlanner_MoveTo(commandPlanner, targets) != 0) {
+                if (!FindStop(moveLength, &stop)) {
+                    return Parse_Paused;
+                }
+                parsed = stop;
+                break;
+            }
+            parsed += moveLength;
+            // Planning a move is the expensive part; the rest waits for the retry if the loop needs the time
+            if (EventLoop_ShouldYield()) {
+                if (!FindStop(moveLength, &stop)) {
+                    return Parse_Paused;
+                }
+                parsed = stop;
+            }
+            break;
+        }
+        case RemoteCommand_Stop:
+            MovePlanner_Stop(commandPlanner);
+            parsed += 1;
+            break;
+        default:
+            Log_Debug("ERROR: Unknown remote command 0x%02x.\n", command[0]);
+            return Parse_ProtocolError;
+        }
+    }
+}
+
+// Parse what has arrived, then move the unparsed commands to the front to make room. The socket is read on while a
+// command is paused, so that a Stop sent after it is seen, until the buffer is full; then unread data stays in the
+// kernel and TCP flow control holds back the sender.
+static void ProcessBuffer(void)
+{
+    ParseResult result = ParseCommands();
+    if (result == Parse_ProtocolError) {
+        CloseClient();
+        return;
+    }
+
+    if (parsed > 0) {
+        memmove(receiveBuffer, &receiveBuffer[parsed], filled - parsed);
+        filled -= parsed;
+        parsed = 0;
+    }
+    if (result != Parse_Paused) {
+        SoftTimer_Stop(&retryTimer);
+    } else if (!SoftTimer_IsRunning(&retryTimer)) {
+        static const struct timespec retryPeriod = {0, RETRY_PERIOD_NS};
+        if (SoftTimer_Start(&retryTimer, &retryPeriod, &retryPeriod) != 0) {
+            CloseClient();
+            return;
+        }
+    }
+    if (SetReading(filled < sizeof(receiveBuffer)) != 0) {
+        CloseClient();
+    }
+}
+
+static void RetryTimerHandler(SoftTimer *timer)
+{
+    ProcessBuffer();
+}
+
+static void ClientEventHandler(EventData *eventData)
+{
+    ssize_t received = recv(clientFd, &receiveBuffer[filled], sizeof(receiveBuffer) - filled, 0);
+    if (received == 0) {
+        Log_Debug("Command client disconnected.\n");
+        CloseClient();
+        return;
+    }
+    if (received < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            Log_Debug("ERROR: Could not read command client: %s (%d).\n", strerror(errno), errno);
+            CloseClient();
+        }
+        return;
+    }
+    filled += (size_t)received;
+    ProcessBuffer();
+}
+
+static void ListenEventHandler(EventData *eventData)
+{
+    int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            Log_Debug("ERROR: Could not accept command client: %s (%d).\n", strerror(errno), errno);
+        }
+        return;
+    }
+    if (clientFd >= 0) {
+        // One job stream at a time; a second client is turned away right away rather than left waiting
+        CloseFdAndPrintError(fd, "Extra command client");
+        return;
+    }
+
+    clientFd = fd;
+    filled = 0;
+    parsed = 0;
+    if (SetReading(true) != 0) {
+        CloseClient();
+        return;
+    }
+    Log_Debug("Command client connected.\n");
+}
+
+int RemoteCommand_Open(int epollFd, uint16_t port, MovePlanner *planner)
+{
+    commandEpollFd = epollFd;
+    commandPlanner = planner;
+    SoftTimer_Init(&retryTimer, &RetryTimerHandler);
+
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+        Log_Debug("ERROR: Could not create command socket: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address = {
+        .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY)};
+    if (bind(listenFd, (const struct sockaddr *)&address, sizeof(address)) != 0 || listen(listenFd, 1) != 0) {
+        Log_Debug("ERROR: Could not listen on command port %u: %s (%d).\n", port, strerror(errno), errno);
+        return -1;
+    }
+
+    return RegisterEventHandlerToEpoll(epollFd, listenFd, &listenEventData, EPOLLIN);
+}
+
+void RemoteCommand_Close(void)
+{
+    CloseClient();
+    if (listenFd >= 0) {
+        CloseFdAndPrintError(listenFd, "Command listener");
+        listenFd = -1;
+    }
+}
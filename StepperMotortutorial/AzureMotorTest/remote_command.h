@@ -0,0 +1,49 @@
+/*
+Remote motion commands.
+A TCP listener takes one client at a time. The client streams commands, each an opcode byte followed by a fixed
+little-endian payload, so one packet can carry a whole run of queued moves and nothing waits for a reply. Commands
+are parsed in place in a fixed receive buffer. When the planner cannot take a move yet (its queue is full, or a
+stop is still under way) parsing pauses at that command and is retried. The socket is read on until the buffer is
+full, and then not until there is room, so TCP flow control holds back the sender instead of moves being dropped.
+A Stop does not wait behind a paused move: it runs as soon as it is received and drops the moves before it that
+were not queued yet, as it drops the queued ones.
+Both sockets are non-blocking and handled at low priority, behind any step that is due. The port has to be listed
+in the AllowedTcpServerPorts of the manifest.
+
+Commands:
+    0x01 MoveTo   int32 target per planner axis   queue a straight-line move to absolute positions
+    0x02 Stop                                     decelerate to a stop and drop the queued moves
+Any other opcode closes the connection.
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include "move_planner.h"
+
+/// <summary>Size of the receive buffer. A read never takes more than this.</summary>
+#define REMOTE_COMMAND_BUFFER_BYTES 1024
+
+/// <summary>
+///     Command opcodes.
+/// </summary>
+typedef enum {
+    RemoteCommand_MoveTo = 0x01,
+    RemoteCommand_Stop = 0x02
+} RemoteCommandOpcode;
+
+/// <summary>
+///     Starts listening for a command client. Uses the timer wheel to retry paused commands, so
+///     <see cref="TimerWheel_Init" /> must have been called.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor the sockets are registered with</param>
+/// <param name="port">TCP port to listen on</param>
+/// <param name="planner">Planner the moves are queued on; must stay initialized until
+/// <see cref="RemoteCommand_Close" /></param>
+/// <returns>0 on success, or -1 on failure</returns>
+int RemoteCommand_Open(int epollFd, uint16_t port, MovePlanner *planner);
+
+/// <summary>
+///     Closes the client connection and the listener.
+/// </summary>
+void RemoteCommand_Close(void);
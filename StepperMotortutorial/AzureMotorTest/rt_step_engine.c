@@ -0,0 +1,117 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <applibs/application.h>
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "rt_step_engine.h"
+
+static void RtStepEngineEventHandler(EventData *eventData);
+
+static EventData rtStepEngineEventData = {.eventHandler = &RtStepEngineEventHandler,
+                                          .priority = EventPriority_Normal};
+
+static int rtSocketFd = -1;
+static RtStepEngineStatusCallback statusCallback = NULL;
+static StepEngineStatusMessage lastStatus = {.type = StepEngineMessage_Status};
+
+static int SendMessage(const void *message, size_t size)
+{
+    if (send(rtSocketFd, message, size, 0) == -1) {
+        Log_Debug("ERROR: Could not send to the real-time step engine: %s (%d).\n", strerror(errno),
+                  errno);
+        return -1;
+    }
+    return 0;
+}
+
+static int SendMotion(StepEngineMessageType type, int32_t target)
+{
+    StepEngineMotionMessage message = {.type = (uint8_t)type, .target = target};
+    return SendMessage(&message, sizeof(message));
+}
+
+static void RtStepEngineEventHandler(EventData *eventData)
+{
+    // Each datagram is one message; drain everything that arrived since the last wakeup.
+    for (;;) {
+        StepEngineStatusMessage message;
+        ssize_t bytesReceived = recv(rtSocketFd, &message, sizeof(message), 0);
+        if (bytesReceived == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                Log_Debug("ERROR: Could not receive from the real-time step engine: %s (%d).\n",
+                          strerror(errno), errno);
+            }
+            return;
+        }
+        if (bytesReceived != sizeof(message) || message.type != StepEngineMessage_Status) {
+            continue;
+        }
+        lastStatus = message;
+        if (statusCallback != NULL) {
+            statusCallback(&lastStatus);
+        }
+    }
+}
+
+int RtStepEngine_Open(int epollFd, const StepperMotorConfig *config, RtStepEngineStatusCallback callback)
+{
+    statusCallback = callback;
+
+    rtSocketFd = Application_Connect(STEP_ENGINE_RT_COMPONENT_ID);
+    if (rtSocketFd == -1) {
+        Log_Debug("ERROR: Could not connect to the real-time step engine: %s (%d).\n",
+                  strerror(errno), errno);
+        return -1;
+    }
+
+    int flags = fcntl(rtSocketFd, F_GETFL, 0);
+    if (flags == -1 || fcntl(rtSocketFd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        Log_Debug("ERROR: Could not make the step engine socket non-blocking: %s (%d).\n",
+                  strerror(errno), errno);
+        return -1;
+    }
+
+    if (RegisterEventHandlerToEpoll(epollFd, rtSocketFd, &rtStepEngineEventData, EPOLLIN) != 0) {
+        return -1;
+    }
+
+    StepEngineConfigureMessage configure = {
+        .type = StepEngineMessage_Configure,
+        .stepMode = (uint8_t)config->stepMode,
+        .profileShape = (uint8_t)config->profileShape,
+        .startIntervalNs = config->startIntervalNs,
+        .cruiseIntervalNs = config->cruiseIntervalNs,
+        .accelerationStepsPerSec2 = config->accelerationStepsPerSec2,
+    };
+    return SendMessage(&configure, sizeof(configure));
+}
+
+void RtStepEngine_Close(void)
+{
+    CloseFdAndPrintError(rtSocketFd, "Real-time step engine socket");
+    rtSocketFd = -1;
+}
+
+int RtStepEngine_Jog(int direction)
+{
+    return SendMotion(StepEngineMessage_Jog, direction < 0 ? -1 : 1);
+}
+
+int RtStepEngine_Stop(void)
+{
+    return SendMotion(StepEngineMessage_Stop, 0);
+}
+
+int RtStepEngine_MoveTo(int32_t target)
+{
+    return SendMotion(StepEngineMessage_MoveTo, target);
+}
+
+const StepEngineStatusMessage *RtStepEngine_GetLastStatus(void)
+{
+    return &lastStatus;
+}
@@ -0,0 +1,56 @@
+/*
+Client for the real-time step engine running on the MT3620 IO M4 core (AzureMotorTestRT).
+When the engine is used, the M4 core owns the coil GPIOs and generates every step from a hardware timer interrupt,
+so step timing is no longer limited by Linux timer wakeups and GPIO syscalls. This app only sends move commands
+over the inter-core socket and receives status back through the epoll loop.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "step_engine_protocol.h"
+#include "stepper_motor.h"
+
+/// <summary>
+///     Function signature for status callbacks.
+/// </summary>
+typedef void (*RtStepEngineStatusCallback)(const StepEngineStatusMessage *status);
+
+/// <summary>
+///     Connects to the real-time step engine and sends it the motor configuration.
+///     The coil GPIOs in the configuration are ignored; they are owned by the real-time app.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor status messages are received through</param>
+/// <param name="config">Step mode and acceleration profile to use</param>
+/// <param name="callback">Function called for every status message; may be NULL</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int RtStepEngine_Open(int epollFd, const StepperMotorConfig *config, RtStepEngineStatusCallback callback);
+
+/// <summary>
+///     Closes the connection. The engine finishes the current move on its own.
+/// </summary>
+void RtStepEngine_Close(void);
+
+/// <summary>
+///     Asks the engine to turn until <see cref="RtStepEngine_Stop" /> is sent.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int RtStepEngine_Jog(int direction);
+
+/// <summary>
+///     Asks the engine to decelerate to a stop.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int RtStepEngine_Stop(void);
+
+/// <summary>
+///     Asks the engine to move to an absolute position.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int RtStepEngine_MoveTo(int32_t target);
+
+/// <summary>
+///     Returns the last status received from the engine.
+/// </summary>
+const StepEngineStatusMessage *RtStepEngine_GetLastStatus(void);
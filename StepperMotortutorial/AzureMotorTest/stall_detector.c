@@ -0,0 +1,184 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "stall_detector.h"
+
+// Count change for every (previous, current) pair of encoder states, indexed by previous << 2 | current, where a
+// state is A << 1 | B. The forward sequence is 00, 10, 11, 01. INVALID marks both channels changing at once.
+#define INVALID 2
+static const int8_t quadratureTable[16] = {0, -1, 1, INVALID, 1, 0, INVALID, -1,
+                                           -1, INVALID, 0, 1, INVALID, 1, -1, 0};
+
+static int ReadEncoderState(StallDetector *detector, uint8_t *state)
+{
+    GPIO_Value_Type a, b;
+    if (GPIO_GetValue(detector->channelFds[0], &a) != 0 || GPIO_GetValue(detector->channelFds[1], &b) != 0) {
+        return -1;
+    }
+    *state = (uint8_t)((a == GPIO_Value_High ? 2 : 0) | (b == GPIO_Value_High ? 1 : 0));
+    return 0;
+}
+
+static void ReportError(StallDetector *detector)
+{
+    StepScheduler_Cancel(&detector->task);
+    detector->callback(detector, StallEvent_Error);
+}
+
+static int OpenChannels(StallDetector *detector)
+{
+    for (int channel = 0; channel < 2; ++channel) {
+        detector->channelFds[channel] = GPIO_OpenAsInput(detector->channelGpios[channel]);
+        if (detector->channelFds[channel] < 0) {
+            Log_Debug("ERROR: Could not open encoder GPIO %d: %s (%d).\n", detector->channelGpios[channel],
+                      strerror(errno), errno);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void CloseChannels(StallDetector *detector)
+{
+    CloseFdAndPrintError(detector->channelFds[0], "Encoder A GPIO");
+    CloseFdAndPrintError(detector->channelFds[1], "Encoder B GPIO");
+    detector->channelFds[0] = -1;
+    detector->channelFds[1] = -1;
+}
+
+// Compare the steps taken since the reference with the distance the encoder has measured, both in steps of the
+// motor's active mode. A step mode change rescales the position, so it starts a new reference.
+static bool CheckFollowingError(StallDetector *detector)
+{
+    uint32_t stepsPerFullStep = StepperMotor_GetStepsPerFullStep(detector->motor);
+    if (stepsPerFullStep != detector->referenceStepsPerFullStep) {
+        StallDetector_Resync(detector);
+        return true;
+    }
+
+    int64_t stepped = (int64_t)StepperMotor_GetPosition(detector->motor) - detector->referencePosition;
+    int64_t measured = (detector->encoderCount - detector->referenceCount) *
+                       (int64_t)(detector->fullStepsPerRevolution * stepsPerFullStep) /
+                       (int64_t)detector->countsPerRevolution;
+    detector->followingError = (int32_t)(stepped - measured);
+    return (uint32_t)abs(detector->followingError) <= detector->toleranceSteps;
+}
+
+// A sample that cannot be read is skipped; one missed sample is well inside the margin the sample period
+// leaves. Reopened GPIOs are read again and taken as matching the motor, since edges may have passed unseen.
+static int RecoverChannels(StallDetector *detector, int error)
+{
+    if (!Recovery_Allow(&detector->recovery, error)) {
+        return -1;
+    }
+    if (Recovery_IsTransient(error)) {
+        return 0;
+    }
+    CloseChannels(detector);
+    if (OpenChannels(detector) == 0 && ReadEncoderState(detector, &detector->encoderState) == 0) {
+        StallDetector_Resync(detector);
+    }
+    return 0;
+}
+
+// The sample task runs every samplePeriodNs, on the step clock so the rate does not drift with load.
+static void StallDetectorTaskHandler(StepSchedulerTask *task, uint64_t nowNs)
+{
+    StallDetector *detector = (StallDetector *)task;
+
+    uint8_t state;
+    if (ReadEncoderState(detector, &state) != 0) {
+        if (RecoverChannels(detector, errno) != 0) {
+            ReportError(detector);
+            return;
+        }
+    } else {
+        int8_t change = quadratureTable[(detector->encoderState << 2) | state];
+        if (change == INVALID) {
+            ++detector->decodeErrors;
+        } else {
+            detector->encoderCount += change * detector->countDirection;
+        }
+        detector->encoderState = state;
+    }
+
+    if (!CheckFollowingError(detector)) {
+        Log_Debug("Stall: stepped and measured position differ by %d steps.\n", detector->followingError);
+        StepperMotor_Halt(detector->motor);
+        StallDetector_Resync(detector);
+        detector->callback(detector, StallEvent_Stalled);
+    }
+
+    StepClock_Advance(&detector->clock, detector->samplePeriodNs);
+    StepClock_Resync(&detector->clock, nowNs, detector->samplePeriodNs);
+    if (StepScheduler_Schedule(task, detector->clock.deadlineNs) != 0) {
+        ReportError(detector);
+    }
+}
+
+int StallDetector_Open(StallDetector *detector, StepperMotor *motor, const StallDetectorConfig *config,
+                       StallDetectorCallback callback)
+{
+    memset(detector, 0, sizeof(*detector));
+    StepScheduler_InitTask(&detector->task, &StallDetectorTaskHandler);
+    detector->callback = callback;
+    detector->motor = motor;
+    detector->countsPerRevolution = config->countsPerRevolution;
+    detector->fullStepsPerRevolution = config->fullStepsPerRevolution;
+    detector->toleranceSteps = config->toleranceSteps;
+    detector->samplePeriodNs = config->samplePeriodNs;
+    detector->countDirection = config->invert ? -1 : 1;
+    detector->channelGpios[0] = config->channelGpios[0];
+    detector->channelGpios[1] = config->channelGpios[1];
+    detector->channelFds[0] = -1;
+    detector->channelFds[1] = -1;
+    detector->recovery = (RecoveryBudget)RECOVERY_BUDGET("Encoder GPIOs");
+
+    if (config->countsPerRevolution == 0 || config->fullStepsPerRevolution == 0 ||
+        config->samplePeriodNs == 0) {
+        Log_Debug("ERROR: Invalid stall detector configuration.\n");
+        return -1;
+    }
+
+    if (OpenChannels(detector) != 0) {
+        return -1;
+    }
+    if (ReadEncoderState(detector, &detector->encoderState) != 0) {
+        Log_Debug("ERROR: Could not read encoder GPIO: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    StallDetector_Resync(detector);
+
+    StepClock_Start(&detector->clock, StepScheduler_Now());
+    return StepScheduler_Schedule(&detector->task,
+                                  StepClock_Advance(&detector->clock, detector->samplePeriodNs));
+}
+
+void StallDetector_Close(StallDetector *detector)
+{
+    StepScheduler_Cancel(&detector->task);
+    CloseChannels(detector);
+}
+
+void StallDetector_Resync(StallDetector *detector)
+{
+    detector->referenceCount = detector->encoderCount;
+    detector->referencePosition = StepperMotor_GetPosition(detector->motor);
+    detector->referenceStepsPerFullStep = StepperMotor_GetStepsPerFullStep(detector->motor);
+    detector->followingError = 0;
+}
+
+int32_t StallDetector_GetFollowingError(const StallDetector *detector)
+{
+    return detector->followingError;
+}
+
+uint32_t StallDetector_GetDecodeErrors(const StallDetector *detector)
+{
+    return detector->decodeErrors;
+}
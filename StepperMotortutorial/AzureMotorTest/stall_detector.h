@@ -0,0 +1,123 @@
+/*
+Stall and missed-step detection from a quadrature encoder.
+The stepper is driven open loop, so a stall under load goes unnoticed: the steps keep coming and the shaft stays
+put. A quadrature encoder on two spare GPIOs closes the loop. High-level apps cannot take GPIO interrupts, so the
+encoder is sampled from a task on the step scheduler at a fixed rate and decoded with a transition table. Its
+count is compared with the position the motor has been stepped to, and when the two drift further apart than
+the tolerance the motor is halted and a stall is reported.
+The sample rate has to be at least the encoder's edge rate at full speed; edges that come too fast to tell apart
+are counted as decode errors rather than guessed at.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <applibs/gpio.h>
+
+#include "recovery.h"
+#include "step_scheduler.h"
+#include "stepper_motor.h"
+
+/// <summary>
+///     Events reported by a stall detector.
+/// </summary>
+typedef enum {
+    /// <summary>The shaft fell behind or ran ahead of the steps by more than the tolerance; the motor was
+    /// halted and the detector has taken the current position as the new reference.</summary>
+    StallEvent_Stalled,
+    /// <summary>The encoder could not be read or the sample could not be scheduled; sampling stops.</summary>
+    StallEvent_Error
+} StallEvent;
+
+struct StallDetector;
+
+/// <summary>
+///     Function signature for stall detector callbacks.
+/// </summary>
+typedef void (*StallDetectorCallback)(struct StallDetector *detector, StallEvent event);
+
+/// <summary>
+///     Static configuration of a stall detector.
+/// </summary>
+typedef struct {
+    /// <summary>GPIOs wired to the encoder's A and B outputs.</summary>
+    GPIO_Id channelGpios[2];
+    /// <summary>Encoder counts (four per quadrature cycle) per revolution of the shaft it is mounted on.</summary>
+    uint32_t countsPerRevolution;
+    /// <summary>Motor full steps per revolution of that same shaft.</summary>
+    uint32_t fullStepsPerRevolution;
+    /// <summary>Largest difference between stepped and measured position, in steps of the active step mode,
+    /// that is not a stall. It has to cover the rotor's lag behind the field at full load.</summary>
+    uint32_t toleranceSteps;
+    /// <summary>Time between encoder samples.</summary>
+    uint32_t samplePeriodNs;
+    /// <summary>Set if the encoder counts down while the motor position counts up.</summary>
+    bool invert;
+} StallDetectorConfig;
+
+/// <summary>
+///     State of one detector. Treat the members as private to stall_detector.c.
+/// </summary>
+typedef struct StallDetector {
+    /// <summary>Sample task on the shared scheduler; must stay the first member.</summary>
+    StepSchedulerTask task;
+    /// <summary>Deadline of the latest sample.</summary>
+    StepClock clock;
+    StallDetectorCallback callback;
+    StepperMotor *motor;
+    GPIO_Id channelGpios[2];
+    int channelFds[2];
+    uint32_t countsPerRevolution;
+    uint32_t fullStepsPerRevolution;
+    uint32_t toleranceSteps;
+    uint32_t samplePeriodNs;
+    int countDirection;
+    /// <summary>Last sampled level of B (bit 0) and A (bit 1).</summary>
+    uint8_t encoderState;
+    int64_t encoderCount;
+    /// <summary>Encoder count and motor position that are known to match.</summary>
+    int64_t referenceCount;
+    int32_t referencePosition;
+    /// <summary>Step mode resolution the reference was taken at.</summary>
+    uint32_t referenceStepsPerFullStep;
+    /// <summary>Stepped minus measured position at the latest sample.</summary>
+    int32_t followingError;
+    uint32_t decodeErrors;
+    /// <summary>Read faults; the GPIOs are reopened until these run out.</summary>
+    RecoveryBudget recovery;
+} StallDetector;
+
+/// <summary>
+///     Opens the encoder GPIOs and starts sampling. The motor's current position is taken as matching the
+///     encoder. <see cref="StepScheduler_Init" /> must have been called.
+/// </summary>
+/// <param name="detector">Detector state; must stay in memory until <see cref="StallDetector_Close" /></param>
+/// <param name="motor">The open motor to watch</param>
+/// <param name="config">Encoder configuration</param>
+/// <param name="callback">Function called with stall and error events</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int StallDetector_Open(StallDetector *detector, StepperMotor *motor, const StallDetectorConfig *config,
+                       StallDetectorCallback callback);
+
+/// <summary>
+///     Stops sampling and closes the encoder GPIOs.
+/// </summary>
+void StallDetector_Close(StallDetector *detector);
+
+/// <summary>
+///     Takes the motor's current position as matching the encoder again, for example after the position was
+///     re-referenced.
+/// </summary>
+void StallDetector_Resync(StallDetector *detector);
+
+/// <summary>
+///     Returns the stepped minus the measured position at the latest sample, in steps of the active step mode.
+/// </summary>
+int32_t StallDetector_GetFollowingError(const StallDetector *detector);
+
+/// <summary>
+///     Returns the number of samples in which both encoder channels had changed, which means the encoder moved
+///     faster than it is sampled.
+/// </summary>
+uint32_t StallDetector_GetDecodeErrors(const StallDetector *detector);
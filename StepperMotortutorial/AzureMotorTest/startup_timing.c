@@ -0,0 +1,42 @@
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "startup_timing.h"
+
+static uint64_t beginNs = 0;
+static uint32_t milestoneUs[StartupMilestone_Count];
+
+static uint64_t NowNs(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+void StartupTiming_Begin(void)
+{
+    beginNs = NowNs(CLOCK_MONOTONIC);
+    for (int milestone = 0; milestone < StartupMilestone_Count; ++milestone) {
+        milestoneUs[milestone] = 0;
+    }
+    Log_Debug("Startup: main entered %lu ms after boot.\n", (unsigned long)(NowNs(CLOCK_BOOTTIME) / 1000000u));
+}
+
+void StartupTiming_Mark(StartupMilestone milestone)
+{
+    if (milestoneUs[milestone] != 0) {
+        return;
+    }
+    uint64_t us = (NowNs(CLOCK_MONOTONIC) - beginNs) / 1000u;
+    // 0 means not reached, so a milestone in the first microsecond counts as 1
+    milestoneUs[milestone] = us == 0 ? 1 : us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+
+    static const char *const names[StartupMilestone_Count] = {"motor ready", "peripherals ready", "first step"};
+    Log_Debug("Startup: %s after %lu us.\n", names[milestone], (unsigned long)milestoneUs[milestone]);
+}
+
+uint32_t StartupTiming_GetUs(StartupMilestone milestone)
+{
+    return milestoneUs[milestone];
+}
@@ -0,0 +1,38 @@
+/*
+Startup milestones.
+Times how long the app takes from main to being able to step, to having every peripheral up, and to the first
+step it actually takes, so that a slower start after an OTA update shows up in the log and in telemetry. Times
+are kept in microseconds since main; the time from boot to main is logged alongside, which covers how long the OS
+took to get the app running.
+*/
+#pragma once
+
+#include <stdint.h>
+
+/// <summary>
+///     Points in startup that are timed.
+/// </summary>
+typedef enum {
+    /// <summary>The motor, its step timer and the command paths are up; motion is accepted from here on.</summary>
+    StartupMilestone_MotorReady,
+    /// <summary>The deferred peripherals (button, LED, telemetry) have been opened, or given up on.</summary>
+    StartupMilestone_PeripheralsReady,
+    /// <summary>The first step was taken.</summary>
+    StartupMilestone_FirstStep,
+    StartupMilestone_Count
+} StartupMilestone;
+
+/// <summary>
+///     Starts the clock. Call first thing in main.
+/// </summary>
+void StartupTiming_Begin(void);
+
+/// <summary>
+///     Records a milestone, once: later calls for the same milestone are ignored. Logs the time since main.
+/// </summary>
+void StartupTiming_Mark(StartupMilestone milestone);
+
+/// <summary>
+///     Returns the microseconds from main to a milestone, or 0 if it has not been reached.
+/// </summary>
+uint32_t StartupTiming_GetUs(StartupMilestone milestone);
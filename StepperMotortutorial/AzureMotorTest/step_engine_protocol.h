@@ -0,0 +1,68 @@
+/*
+Messages exchanged between this high-level app and the real-time step engine on the MT3620 IO M4 core
+(AzureMotorTestRT). Both sides include this header so the layout cannot drift apart.
+Every message starts with a one byte type. Fields are little endian, which both cores are.
+*/
+#pragma once
+
+#include <stdint.h>
+
+/// <summary>Component ID of the real-time step engine, as listed in its app_manifest.json.</summary>
+#define STEP_ENGINE_RT_COMPONENT_ID "a3c4f1e2-6b7d-4e58-9f10-2c3b4d5e6f70"
+
+/// <summary>Component ID of this high-level app, as listed in its app_manifest.json.</summary>
+#define STEP_ENGINE_HL_COMPONENT_ID "9f089a19-d540-4b61-b413-693080f67687"
+
+/// <summary>
+///     Message types.
+/// </summary>
+typedef enum {
+    /// <summary>High-level to real-time: set the step mode and acceleration profile. Only applied while stopped.</summary>
+    StepEngineMessage_Configure = 1,
+    /// <summary>High-level to real-time: move to an absolute position.</summary>
+    StepEngineMessage_MoveTo = 2,
+    /// <summary>High-level to real-time: turn until stopped; target holds the direction (1 or -1).</summary>
+    StepEngineMessage_Jog = 3,
+    /// <summary>High-level to real-time: decelerate to a stop.</summary>
+    StepEngineMessage_Stop = 4,
+    /// <summary>Real-time to high-level: state after a move starts or ends, or in reply to any command.</summary>
+    StepEngineMessage_Status = 0x80
+} StepEngineMessageType;
+
+/// <summary>
+///     Configure message.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    /// <summary>A StepMode value.</summary>
+    uint8_t stepMode;
+    /// <summary>A MotionProfileShape value.</summary>
+    uint8_t profileShape;
+    uint8_t reserved;
+    uint32_t startIntervalNs;
+    uint32_t cruiseIntervalNs;
+    uint32_t accelerationStepsPerSec2;
+} StepEngineConfigureMessage;
+
+/// <summary>
+///     MoveTo, Jog and Stop messages.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t reserved[3];
+    int32_t target;
+} StepEngineMotionMessage;
+
+/// <summary>
+///     Status message.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    /// <summary>Non-zero while steps are being generated.</summary>
+    uint8_t moving;
+    uint8_t reserved[2];
+    int32_t position;
+    uint32_t stepsTaken;
+    /// <summary>Steps whose interrupt ran later than one step interval; should stay zero.</summary>
+    uint32_t lateSteps;
+} StepEngineStatusMessage;
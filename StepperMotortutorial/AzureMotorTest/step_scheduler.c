@@ -0,0 +1,257 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "recovery.h"
+#include "step_scheduler.h"
+
+static void StepSchedulerEventHandler(EventData *eventData);
+
+static EventLatencyStats schedulerStats;
+static EventData schedulerEventData = {.eventHandler = &StepSchedulerEventHandler,
+                                       .priority = EventPriority_RealTime,
+                                       .stats = &schedulerStats};
+
+static RecoveryBudget schedulerRecovery = RECOVERY_BUDGET("Step scheduler timer");
+static int schedulerEpollFd = -1;
+static int schedulerTimerFd = -1;
+static StepSchedulerErrorHandler schedulerErrorHandler = NULL;
+static StepSchedulerTask *heap[STEP_SCHEDULER_MAX_TASKS];
+static uint32_t heapSize = 0;
+// Set while tasks run, so that rescheduling from inside a task does not re-arm the timer every time
+static bool dispatching = false;
+
+static void HeapSwap(uint32_t a, uint32_t b)
+{
+    StepSchedulerTask *task = heap[a];
+    heap[a] = heap[b];
+    heap[b] = task;
+    heap[a]->heapIndex = a;
+    heap[b]->heapIndex = b;
+}
+
+static void HeapSiftUp(uint32_t index)
+{
+    while (index > 0) {
+        uint32_t parent = (index - 1) / 2;
+        if (heap[parent]->deadlineNs <= heap[index]->deadlineNs) {
+            break;
+        }
+        HeapSwap(index, parent);
+        index = parent;
+    }
+}
+
+static void HeapSiftDown(uint32_t index)
+{
+    for (;;) {
+        uint32_t smallest = index;
+        uint32_t left = 2 * index + 1;
+        uint32_t right = left + 1;
+        if (left < heapSize && heap[left]->deadlineNs < heap[smallest]->deadlineNs) {
+            smallest = left;
+        }
+        if (right < heapSize && heap[right]->deadlineNs < heap[smallest]->deadlineNs) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            return;
+        }
+        HeapSwap(index, smallest);
+        index = smallest;
+    }
+}
+
+static void HeapRemove(StepSchedulerTask *task)
+{
+    uint32_t index = task->heapIndex;
+    task->heapIndex = STEP_SCHEDULER_NOT_SCHEDULED;
+    --heapSize;
+    if (index == heapSize) {
+        return;
+    }
+    heap[index] = heap[heapSize];
+    heap[index]->heapIndex = index;
+    HeapSiftDown(index);
+    HeapSiftUp(index);
+}
+
+static void ReportError(void)
+{
+    if (schedulerErrorHandler != NULL) {
+        schedulerErrorHandler();
+    }
+}
+
+// Program the timer for the earliest deadline, or disarm it when nothing is scheduled. Only touches the timer
+// when the earliest deadline actually changed.
+// The deadline the timer is armed for, or 0 when disarmed, is kept in the event data, where the event loop
+// reads it to keep low-priority work out of the way of the next step
+static int ProgramTimer(void)
+{
+    if (heapSize == 0) {
+        if (schedulerEventData.deadlineNs == 0) {
+            return 0;
+        }
+        schedulerEventData.deadlineNs = 0;
+        return DisarmTimerFd(schedulerTimerFd);
+    }
+
+    uint64_t deadlineNs = heap[0]->deadlineNs;
+    if (deadlineNs == schedulerEventData.deadlineNs) {
+        return 0;
+    }
+    schedulerEventData.deadlineNs = deadlineNs;
+
+    // Armed at the deadline itself, so the time spent getting here does not shift it
+    struct timespec deadline = {(time_t)(deadlineNs / 1000000000u), (long)(deadlineNs % 1000000000u)};
+    return SetTimerFdToAbsoluteExpiry(schedulerTimerFd, &deadline);
+}
+
+// Put a new timerfd in place of one that failed. The tasks and their deadlines live in the heap, so the next
+// ProgramTimer arms the new fd for exactly the step that was pending.
+static int RebuildTimer(int error)
+{
+    if (!Recovery_Allow(&schedulerRecovery, error)) {
+        return -1;
+    }
+    schedulerTimerFd = ReplaceTimerFd(schedulerEpollFd, schedulerTimerFd, &schedulerEventData);
+    schedulerEventData.deadlineNs = 0;
+    return schedulerTimerFd < 0 ? -1 : 0;
+}
+
+static int ArmTimer(void)
+{
+    if (ProgramTimer() == 0) {
+        return 0;
+    }
+    schedulerEventData.deadlineNs = 0;
+    if (RebuildTimer(errno) != 0) {
+        return -1;
+    }
+    return ProgramTimer();
+}
+
+static void StepSchedulerEventHandler(EventData *eventData)
+{
+    if (ConsumeTimerFdEvent(schedulerTimerFd) != 0 && RebuildTimer(errno) != 0) {
+        ReportError();
+        return;
+    }
+    schedulerEventData.deadlineNs = 0;
+
+    uint64_t nowNs = StepScheduler_Now();
+    dispatching = true;
+    while (heapSize > 0 && heap[0]->deadlineNs <= nowNs + STEP_SCHEDULER_COALESCE_NS) {
+        StepSchedulerTask *task = heap[0];
+        HeapRemove(task);
+        // Tasks pulled forward by coalescing count as on time
+        LatencyHistogram_Record(&schedulerStats.wakeupLatency,
+                                nowNs > task->deadlineNs ? nowNs - task->deadlineNs : 0);
+        task->handler(task, nowNs);
+    }
+    dispatching = false;
+
+    if (ArmTimer() != 0) {
+        ReportError();
+    }
+}
+
+int StepScheduler_Init(int epollFd, StepSchedulerErrorHandler errorHandler)
+{
+    schedulerErrorHandler = errorHandler;
+    schedulerEpollFd = epollFd;
+    heapSize = 0;
+    schedulerEventData.deadlineNs = 0;
+    EventLatencyStats_Clear(&schedulerStats);
+
+    static const struct timespec disarmed = {0, 0};
+    schedulerTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &disarmed, &schedulerEventData, EPOLLIN);
+    return schedulerTimerFd < 0 ? -1 : 0;
+}
+
+void StepScheduler_Close(void)
+{
+    for (uint32_t i = 0; i < heapSize; ++i) {
+        heap[i]->heapIndex = STEP_SCHEDULER_NOT_SCHEDULED;
+    }
+    heapSize = 0;
+    schedulerEventData.deadlineNs = 0;
+    CloseFdAndPrintError(schedulerTimerFd, "Step scheduler timer");
+    schedulerTimerFd = -1;
+}
+
+void StepScheduler_InitTask(StepSchedulerTask *task, StepSchedulerTaskHandler handler)
+{
+    task->deadlineNs = 0;
+    task->handler = handler;
+    task->heapIndex = STEP_SCHEDULER_NOT_SCHEDULED;
+}
+
+int StepScheduler_Schedule(StepSchedulerTask *task, uint64_t deadlineNs)
+{
+    if (task->heapIndex == STEP_SCHEDULER_NOT_SCHEDULED) {
+        if (heapSize == STEP_SCHEDULER_MAX_TASKS) {
+            Log_Debug("ERROR: Step scheduler is full.\n");
+            return -1;
+        }
+        task->deadlineNs = deadlineNs;
+        task->heapIndex = heapSize;
+        heap[heapSize++] = task;
+        HeapSiftUp(task->heapIndex);
+    } else {
+        task->deadlineNs = deadlineNs;
+        HeapSiftDown(task->heapIndex);
+        HeapSiftUp(task->heapIndex);
+    }
+
+    return dispatching ? 0 : ArmTimer();
+}
+
+void StepScheduler_Cancel(StepSchedulerTask *task)
+{
+    if (task->heapIndex == STEP_SCHEDULER_NOT_SCHEDULED) {
+        return;
+    }
+    HeapRemove(task);
+    if (!dispatching && ArmTimer() != 0) {
+        ReportError();
+    }
+}
+
+uint64_t StepScheduler_Now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+const EventLatencyStats *StepScheduler_GetStats(void)
+{
+    return &schedulerStats;
+}
+
+void StepClock_Start(StepClock *clock, uint64_t nowNs)
+{
+    clock->deadlineNs = nowNs;
+}
+
+uint64_t StepClock_Advance(StepClock *clock, uint32_t intervalNs)
+{
+    clock->deadlineNs += intervalNs;
+    return clock->deadlineNs;
+}
+
+uint64_t StepClock_Resync(StepClock *clock, uint64_t nowNs, uint32_t intervalNs)
+{
+    if (clock->deadlineNs > nowNs) {
+        return 0;
+    }
+    // Skip whole intervals so the next tick is the first one on the same grid that is still ahead
+    uint64_t missed = (nowNs - clock->deadlineNs) / intervalNs + 1;
+    clock->deadlineNs += missed * intervalNs;
+    return missed;
+}
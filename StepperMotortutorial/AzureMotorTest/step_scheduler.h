@@ -0,0 +1,119 @@
+/*
+Shared step scheduler.
+Every motor (and anything else that needs step-accurate callbacks) registers a task with an absolute
+CLOCK_MONOTONIC deadline. The tasks are kept in a binary min-heap and one timerfd is armed for the earliest
+deadline, so running many axes costs one file descriptor and one wakeup per distinct step time instead of one
+timer per motor. Tasks that fall due within STEP_SCHEDULER_COALESCE_NS of each other run in the same wakeup.
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include "latency_stats.h"
+
+/// <summary>Maximum number of tasks that can be scheduled at the same time.</summary>
+#define STEP_SCHEDULER_MAX_TASKS 16
+
+/// <summary>Tasks due within this window after the earliest one run in the same wakeup.</summary>
+#define STEP_SCHEDULER_COALESCE_NS 20000u
+
+/// <summary>Value of heapIndex for a task that is not scheduled.</summary>
+#define STEP_SCHEDULER_NOT_SCHEDULED UINT32_MAX
+
+struct StepSchedulerTask;
+
+/// <summary>
+///     Function signature for task callbacks. The task has already been removed from the schedule when it runs;
+///     call <see cref="StepScheduler_Schedule" /> from the callback to run again.
+/// </summary>
+/// <param name="task">The task, with deadlineNs set to the deadline it was due at</param>
+/// <param name="nowNs">Time the scheduler woke up</param>
+typedef void (*StepSchedulerTaskHandler)(struct StepSchedulerTask *task, uint64_t nowNs);
+
+/// <summary>
+///     A schedulable task. Embed it in the owner's state and initialize it with
+///     <see cref="StepScheduler_InitTask" />.
+/// </summary>
+typedef struct StepSchedulerTask {
+    /// <summary>Absolute CLOCK_MONOTONIC deadline in nanoseconds.</summary>
+    uint64_t deadlineNs;
+    /// <summary>Function called at the deadline.</summary>
+    StepSchedulerTaskHandler handler;
+    /// <summary>Position in the heap, or STEP_SCHEDULER_NOT_SCHEDULED.</summary>
+    uint32_t heapIndex;
+} StepSchedulerTask;
+
+/// <summary>
+///     A deadline-tracking step clock. Every deadline is the previous deadline plus the next interval rather than
+///     now plus the interval, so handler latency never shifts the ticks after it and the mean tick rate is exactly
+///     the one the intervals ask for, however late each tick runs.
+/// </summary>
+typedef struct {
+    /// <summary>Absolute CLOCK_MONOTONIC time of the latest tick in nanoseconds.</summary>
+    uint64_t deadlineNs;
+} StepClock;
+
+/// <summary>
+///     Function signature for the error callback, called when the scheduler timer fails.
+/// </summary>
+typedef void (*StepSchedulerErrorHandler)(void);
+
+/// <summary>
+///     Creates the scheduler timer and registers it with epoll at real-time priority.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="errorHandler">Function called if the timer cannot be read or armed</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int StepScheduler_Init(int epollFd, StepSchedulerErrorHandler errorHandler);
+
+/// <summary>
+///     Closes the scheduler timer. Scheduled tasks are dropped.
+/// </summary>
+void StepScheduler_Close(void);
+
+/// <summary>
+///     Prepares a task for scheduling.
+/// </summary>
+void StepScheduler_InitTask(StepSchedulerTask *task, StepSchedulerTaskHandler handler);
+
+/// <summary>
+///     Schedules a task, or moves it if it is already scheduled.
+/// </summary>
+/// <param name="task">The task</param>
+/// <param name="deadlineNs">Absolute CLOCK_MONOTONIC deadline in nanoseconds</param>
+/// <returns>0 on success, or -1 if the schedule is full or the timer could not be armed</returns>
+int StepScheduler_Schedule(StepSchedulerTask *task, uint64_t deadlineNs);
+
+/// <summary>
+///     Removes a task from the schedule. Does nothing if it is not scheduled.
+/// </summary>
+void StepScheduler_Cancel(StepSchedulerTask *task);
+
+/// <summary>
+///     Returns the current CLOCK_MONOTONIC time in nanoseconds.
+/// </summary>
+uint64_t StepScheduler_Now(void);
+
+/// <summary>
+///     Returns the scheduler's latency figures: how late each task ran after its deadline, and how long each
+///     wakeup took to run its tasks.
+/// </summary>
+const EventLatencyStats *StepScheduler_GetStats(void);
+
+/// <summary>
+///     Starts a step clock with its latest tick at nowNs.
+/// </summary>
+void StepClock_Start(StepClock *clock, uint64_t nowNs);
+
+/// <summary>
+///     Moves a step clock on by one interval.
+/// </summary>
+/// <returns>The new deadline, to pass to <see cref="StepScheduler_Schedule" /></returns>
+uint64_t StepClock_Advance(StepClock *clock, uint32_t intervalNs);
+
+/// <summary>
+///     Brings a step clock whose deadline has already passed back ahead of nowNs by skipping whole intervals,
+///     which keeps the ticks on the same time grid. Does nothing if the deadline is still ahead.
+/// </summary>
+/// <returns>The number of ticks skipped</returns>
+uint64_t StepClock_Resync(StepClock *clock, uint64_t nowNs, uint32_t intervalNs);
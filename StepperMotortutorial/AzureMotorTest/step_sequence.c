@@ -0,0 +1,81 @@
+#include "step_sequence.h"
+
+static const uint8_t waveDriveMasks[] = {COIL_IN1, COIL_IN2, COIL_IN3, COIL_IN4};
+
+static const uint8_t fullStepMasks[] = {COIL_IN1 | COIL_IN2, COIL_IN2 | COIL_IN3,
+                                        COIL_IN3 | COIL_IN4, COIL_IN4 | COIL_IN1};
+
+static const uint8_t halfStepMasks[] = {COIL_IN1,           COIL_IN1 | COIL_IN2, COIL_IN2,
+                                        COIL_IN2 | COIL_IN3, COIL_IN3,           COIL_IN3 | COIL_IN4,
+                                        COIL_IN4,           COIL_IN4 | COIL_IN1};
+
+static const StepSequence sequences[StepMode_Count] = {
+    [StepMode_Wave] = {.coilMasks = waveDriveMasks, .length = sizeof(waveDriveMasks)},
+    [StepMode_FullStep] = {.coilMasks = fullStepMasks, .length = sizeof(fullStepMasks)},
+    [StepMode_HalfStep] = {.coilMasks = halfStepMasks, .length = sizeof(halfStepMasks)},
+};
+
+const StepSequence *StepSequence_Get(StepMode mode)
+{
+    if ((unsigned)mode >= StepMode_Count) {
+        mode = StepMode_Wave;
+    }
+    return &sequences[mode];
+}
+
+// Index of a coil mask in the half step sequence, which has every mask of the other two
+static int HalfStepIndexOf(uint8_t coilMask)
+{
+    for (int index = 0; index < (int)sizeof(halfStepMasks); ++index) {
+        if (halfStepMasks[index] == coilMask) {
+            return index;
+        }
+    }
+    return 0;
+}
+
+static int IndexOf(const StepSequence *sequence, uint8_t coilMask)
+{
+    for (int index = 0; index < sequence->length; ++index) {
+        if (sequence->coilMasks[index] == coilMask) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+// Half steps from position 0 of the half step sequence to a position of another sequence. Phase 0 of each
+// sequence sits where its coil mask is in the half step sequence, half a step in for full stepping.
+static int64_t ToHalfSteps(const StepSequence *sequence, int32_t position)
+{
+    return (int64_t)position * ((int)sizeof(halfStepMasks) / sequence->length) +
+           HalfStepIndexOf(sequence->coilMasks[0]);
+}
+
+// The position of a sequence at or just before a number of half steps
+static int32_t FromHalfSteps(const StepSequence *sequence, int64_t halfSteps)
+{
+    int64_t halfStepsPerStep = (int)sizeof(halfStepMasks) / sequence->length;
+    int64_t offset = halfSteps - HalfStepIndexOf(sequence->coilMasks[0]);
+    int64_t position = offset / halfStepsPerStep;
+    return (int32_t)(offset % halfStepsPerStep < 0 ? position - 1 : position);
+}
+
+void StepSequence_ChangeMode(StepMode from, StepMode to, int32_t *position, uint32_t *phase)
+{
+    const StepSequence *oldSequence = StepSequence_Get(from);
+    const StepSequence *newSequence = StepSequence_Get(to);
+    int halfSteps = (int)sizeof(halfStepMasks);
+    int halfStep = HalfStepIndexOf(oldSequence->coilMasks[*phase % oldSequence->length]);
+
+    // The same coils if the new mode has them, otherwise half a step back
+    int shift = 0;
+    int newPhase = IndexOf(newSequence, halfStepMasks[halfStep]);
+    if (newPhase < 0) {
+        shift = -1;
+        newPhase = IndexOf(newSequence, halfStepMasks[(halfStep + halfSteps - 1) % halfSteps]);
+    }
+
+    *position = FromHalfSteps(newSequence, ToHalfSteps(oldSequence, *position) + shift);
+    *phase = (uint32_t)newPhase;
+}
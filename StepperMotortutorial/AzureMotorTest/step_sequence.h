@@ -0,0 +1,58 @@
+/*
+Coil energizing sequences for a unipolar stepper driven through a ULN2003.
+Each entry is a bitmask of the coils that are energized for that phase, bit 0 is IN1 through bit 3 for IN4.
+The tables are compile-time constants so stepping is a table index plus a write.
+*/
+#pragma once
+
+#include <stdint.h>
+
+#define COIL_IN1 (1u << 0)
+#define COIL_IN2 (1u << 1)
+#define COIL_IN3 (1u << 2)
+#define COIL_IN4 (1u << 3)
+#define COIL_COUNT 4
+
+/// <summary>
+///     Stepping modes supported by <see cref="StepSequence_Get" />.
+/// </summary>
+typedef enum {
+    /// <summary>One coil at a time, four phases. Lowest current and torque.</summary>
+    StepMode_Wave = 0,
+    /// <summary>Two adjacent coils at a time, four phases. Roughly 40% more torque than wave drive.</summary>
+    StepMode_FullStep = 1,
+    /// <summary>Alternates one and two coils, eight phases. Twice the resolution of the full step modes.</summary>
+    StepMode_HalfStep = 2,
+    StepMode_Count
+} StepMode;
+
+/// <summary>
+///     A cyclic sequence of coil masks.
+/// </summary>
+typedef struct {
+    /// <summary>Coil mask for each phase.</summary>
+    const uint8_t *coilMasks;
+    /// <summary>Number of phases in the cycle.</summary>
+    uint8_t length;
+} StepSequence;
+
+/// <summary>
+///     Returns the phase table for a stepping mode.
+/// </summary>
+/// <param name="mode">The stepping mode; out of range values select wave drive</param>
+/// <returns>A pointer to a constant sequence, never NULL</returns>
+const StepSequence *StepSequence_Get(StepMode mode);
+
+/// <summary>
+///     Converts a position and the phase the rotor is in from one stepping mode to another. The phase maps to the
+///     phase of the new mode that drives the same coils. Wave and full step phases sit half a step apart, so
+///     between those two no phase drives the same coils and the phase half a step back is taken. The position
+///     moves by the same half step. Phase 0 of each mode is where its coils sit in half stepping, so when the
+///     position and phase agree in the old mode they agree in the new one; otherwise the position is rounded
+///     down to a whole step of the new mode.
+/// </summary>
+/// <param name="from">Stepping mode the position and phase are in</param>
+/// <param name="to">Stepping mode to convert them to</param>
+/// <param name="position">Position in steps, converted in place</param>
+/// <param name="phase">Index into the sequence, converted in place</param>
+void StepSequence_ChangeMode(StepMode from, StepMode to, int32_t *position, uint32_t *phase);
@@ -0,0 +1,69 @@
+#include "step_trace.h"
+
+#if STEP_TRACE_ENABLED
+
+#include <applibs/log.h>
+
+StepTraceRecord stepTraceBuffer[STEP_TRACE_CAPACITY];
+atomic_uint_fast32_t stepTraceHead = 0;
+
+void StepTrace_RecordEvent(StepTraceKind kind, uint8_t axis, uint8_t phase, int32_t value)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint_fast32_t head = atomic_load_explicit(&stepTraceHead, memory_order_relaxed);
+    StepTraceRecord *record = &stepTraceBuffer[head & (STEP_TRACE_CAPACITY - 1)];
+    record->timestampNs = (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+    record->kind = (uint8_t)kind;
+    record->phase = phase;
+    record->coilMask = 0;
+    record->axis = axis;
+    record->value = value;
+    atomic_store_explicit(&stepTraceHead, head + 1, memory_order_release);
+}
+
+void StepTrace_Dump(void)
+{
+    uint_fast32_t head = atomic_load_explicit(&stepTraceHead, memory_order_acquire);
+    uint_fast32_t count = head < STEP_TRACE_CAPACITY ? head : STEP_TRACE_CAPACITY;
+
+    Log_Debug("Step trace: %lu of %lu records buffered.\n", (unsigned long)count,
+              (unsigned long)head);
+
+    uint64_t previousNs = 0;
+    for (uint_fast32_t i = head - count; i != head; ++i) {
+        const StepTraceRecord *record = &stepTraceBuffer[i & (STEP_TRACE_CAPACITY - 1)];
+        unsigned long long timestampNs = record->timestampNs;
+        switch ((StepTraceKind)record->kind) {
+        case StepTraceKind_Step: {
+            uint64_t deltaNs = previousNs == 0 ? 0 : record->timestampNs - previousNs;
+            previousNs = record->timestampNs;
+            Log_Debug("STEP %lu t=%llu dt=%llu phase=%u coils=0x%x\n", (unsigned long)i, timestampNs,
+                      (unsigned long long)deltaNs, record->phase, record->coilMask);
+            break;
+        }
+        case StepTraceKind_Origin:
+            Log_Debug("ORIGIN %lu t=%llu axis=%u position=%ld phase=%u\n", (unsigned long)i, timestampNs,
+                      record->axis, (long)record->value, record->phase);
+            break;
+        case StepTraceKind_MoveTo:
+            Log_Debug("MOVE %lu t=%llu axis=%u target=%ld\n", (unsigned long)i, timestampNs, record->axis,
+                      (long)record->value);
+            break;
+        case StepTraceKind_Stop:
+            Log_Debug("STOP %lu t=%llu\n", (unsigned long)i, timestampNs);
+            break;
+        case StepTraceKind_Missed:
+            Log_Debug("MISS %lu t=%llu ticks=%ld\n", (unsigned long)i, timestampNs, (long)record->value);
+            break;
+        }
+    }
+}
+
+void StepTrace_Clear(void)
+{
+    atomic_store_explicit(&stepTraceHead, 0, memory_order_release);
+}
+
+#endif
@@ -0,0 +1,124 @@
+/*
+Fixed-size binary trace of step events.
+Recording a step is a timestamp read and a 16 byte store into a ring buffer, so it can sit in
+StepperMotorEventHandler without costing the step timing that formatted Log_Debug output does.
+The buffer is only decoded when StepTrace_Dump is called.
+Besides the steps, the trace holds the planner moves that caused them and the ticks the step tasks ran too late
+for, so a dump is a recording of a motion session that HostBench/replay.c can run again and compare against.
+Tracing is compiled in when STEP_TRACE_ENABLED is non-zero, which by default is every build without NDEBUG.
+In release builds every call below expands to nothing.
+
+Dump lines, one per record, all times CLOCK_MONOTONIC in nanoseconds:
+    STEP index t=time dt=time since the previous step phase=index coils=0xmask
+    ORIGIN index t=time axis=axis position=steps phase=index   a planned move started from rest, from here
+    MOVE index t=time axis=axis target=steps                   a planned move was queued, one line per axis
+    STOP index t=time                                          the planned moves were stopped
+    MISS index t=time ticks=count                              ticks a step task skipped because it ran late
+*/
+#pragma once
+
+#include <stdint.h>
+
+#ifndef STEP_TRACE_ENABLED
+#ifdef NDEBUG
+#define STEP_TRACE_ENABLED 0
+#else
+#define STEP_TRACE_ENABLED 1
+#endif
+#endif
+
+/// <summary>
+///     Number of records kept; older records are overwritten. Must be a power of two. Define it larger to record
+///     a longer session for replay.
+/// </summary>
+#ifndef STEP_TRACE_CAPACITY
+#define STEP_TRACE_CAPACITY 1024
+#endif
+
+/// <summary>
+///     What a record is of.
+/// </summary>
+typedef enum {
+    StepTraceKind_Step,
+    /// <summary>A planned move starts from rest; value is the position of the axis and phase its phase.</summary>
+    StepTraceKind_Origin,
+    /// <summary>A planned move was queued; value is the target of the axis.</summary>
+    StepTraceKind_MoveTo,
+    StepTraceKind_Stop,
+    /// <summary>A step task ran late; value is the number of ticks it skipped.</summary>
+    StepTraceKind_Missed
+} StepTraceKind;
+
+/// <summary>
+///     One traced step or event.
+/// </summary>
+typedef struct {
+    /// <summary>CLOCK_MONOTONIC time of the step or event in nanoseconds.</summary>
+    uint64_t timestampNs;
+    /// <summary>A StepTraceKind.</summary>
+    uint8_t kind;
+    /// <summary>Index of the phase that was driven, or that an origin is in.</summary>
+    uint8_t phase;
+    /// <summary>Energized coils after the step, bit 0 is IN1 through bit 3 for IN4.</summary>
+    uint8_t coilMask;
+    /// <summary>Planner axis of an origin or a move.</summary>
+    uint8_t axis;
+    /// <summary>Position, target or tick count of an event.</summary>
+    int32_t value;
+} StepTraceRecord;
+
+#if STEP_TRACE_ENABLED
+
+#include <stdatomic.h>
+#include <time.h>
+
+extern StepTraceRecord stepTraceBuffer[STEP_TRACE_CAPACITY];
+extern atomic_uint_fast32_t stepTraceHead;
+
+/// <summary>
+///     Appends a step to the trace. The event loop is the only writer; the head is published
+///     with release ordering so a reader never sees a slot before it is filled.
+/// </summary>
+/// <param name="phase">Phase index that was driven</param>
+/// <param name="coilMask">Energized coils after the step</param>
+static inline void StepTrace_Record(uint8_t phase, uint8_t coilMask)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint_fast32_t head = atomic_load_explicit(&stepTraceHead, memory_order_relaxed);
+    StepTraceRecord *record = &stepTraceBuffer[head & (STEP_TRACE_CAPACITY - 1)];
+    record->timestampNs = (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+    record->kind = StepTraceKind_Step;
+    record->phase = phase;
+    record->coilMask = coilMask;
+    atomic_store_explicit(&stepTraceHead, head + 1, memory_order_release);
+}
+
+/// <summary>
+///     Appends an event other than a step to the trace.
+/// </summary>
+/// <param name="kind">What happened; not StepTraceKind_Step</param>
+/// <param name="axis">Planner axis of an origin or a move, otherwise 0</param>
+/// <param name="phase">Phase of an origin, otherwise 0</param>
+/// <param name="value">Position, target or tick count</param>
+void StepTrace_RecordEvent(StepTraceKind kind, uint8_t axis, uint8_t phase, int32_t value);
+
+/// <summary>
+///     Writes the buffered records, oldest first, to the debug log.
+/// </summary>
+void StepTrace_Dump(void);
+
+/// <summary>
+///     Discards all buffered records.
+/// </summary>
+void StepTrace_Clear(void);
+
+#else
+
+#define StepTrace_Record(phase, coilMask) ((void)0)
+#define StepTrace_RecordEvent(kind, axis, phase, value) ((void)0)
+#define StepTrace_Dump() ((void)0)
+#define StepTrace_Clear() ((void)0)
+
+#endif
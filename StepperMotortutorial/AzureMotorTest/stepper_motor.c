@@ -0,0 +1,444 @@
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "step_trace.h"
+#include "stepper_motor.h"
+
+// Write a coil mask to the motor driver inputs. Holding a phase (or staying stopped) costs no GPIO calls at all,
+// and a write that fails is retried on the next call.
+static void WriteCoils(StepperMotor *motor, uint8_t coilMask)
+{
+    CoilBank_Write(&motor->coils, coilMask);
+}
+
+static int PhaseOf(int32_t stepPosition, const StepSequence *sequence)
+{
+    int phase = stepPosition % sequence->length;
+    return phase < 0 ? phase + sequence->length : phase;
+}
+
+static struct timespec TicksToTimespec(uint32_t ticks)
+{
+    uint64_t ns = (uint64_t)ticks * TIMER_WHEEL_TICK_NS;
+    return (struct timespec){(time_t)(ns / 1000000000u), (long)(ns % 1000000000u)};
+}
+
+static bool IsChoppedHold(const HoldPolicy *hold)
+{
+    return hold->mode == HoldMode_Reduced && hold->dutyOffTicks > 0;
+}
+
+static uint32_t DutyTicks(uint8_t ticks)
+{
+    return ticks > 0 ? ticks : 1;
+}
+
+static uint32_t ReleaseTicks(const HoldPolicy *hold)
+{
+    return (uint32_t)((uint64_t)hold->releaseAfterMs * 1000000u / TIMER_WHEEL_TICK_NS);
+}
+
+// Stop holding without touching the coils; the caller writes whatever comes next.
+static void EndHold(StepperMotor *motor)
+{
+    SoftTimer_Stop(&motor->holdTimer);
+    motor->holdCoilMask = 0;
+}
+
+static void ReleaseHeldCoils(StepperMotor *motor)
+{
+    EndHold(motor);
+    WriteCoils(motor, 0);
+}
+
+// Standstill. A reduced hold switches the held phase on for dutyOnTicks and off for dutyOffTicks, and the
+// winding's inductance smooths that into a lower average current. The MT3620 PWM blocks are on GPIO0-11 and the
+// coils are not, so the switching runs on the timer wheel at its 1 ms tick, at most two GPIO writes per edge.
+// The timer only runs while a phase is held and there is switching to do or a release timeout to wait for.
+static void HoldTimerHandler(SoftTimer *timer)
+{
+    StepperMotor *motor = (StepperMotor *)((char *)timer - offsetof(StepperMotor, holdTimer));
+    const HoldPolicy *hold = &motor->hold;
+
+    if (!IsChoppedHold(hold)) {
+        // The release timeout of a full hold
+        ReleaseHeldCoils(motor);
+        return;
+    }
+
+    bool wasOn = CoilBank_GetMask(&motor->coils) != 0;
+    motor->holdTicks += DutyTicks(wasOn ? hold->dutyOnTicks : hold->dutyOffTicks);
+    if (hold->releaseAfterMs > 0 && motor->holdTicks >= ReleaseTicks(hold)) {
+        ReleaseHeldCoils(motor);
+        return;
+    }
+
+    WriteCoils(motor, wasOn ? 0 : motor->holdCoilMask);
+    struct timespec next = TicksToTimespec(DutyTicks(wasOn ? hold->dutyOffTicks : hold->dutyOnTicks));
+    if (SoftTimer_Start(&motor->holdTimer, &next, NULL) != 0) {
+        ReleaseHeldCoils(motor);
+    }
+}
+
+// The motor has stopped in its current phase: apply the hold policy to it. If the hold timer cannot be started
+// the coils are released, which is always safe.
+static void StartHold(StepperMotor *motor)
+{
+    const HoldPolicy *hold = &motor->hold;
+    EndHold(motor);
+    if (hold->mode == HoldMode_Release) {
+        WriteCoils(motor, 0);
+        return;
+    }
+
+    const StepSequence *sequence = StepSequence_Get(motor->stepMode);
+    motor->holdCoilMask = sequence->coilMasks[PhaseOf(motor->position + motor->phaseOffset, sequence)];
+    motor->holdTicks = 0;
+    WriteCoils(motor, motor->holdCoilMask);
+
+    uint32_t ticks;
+    if (IsChoppedHold(hold)) {
+        ticks = DutyTicks(hold->dutyOnTicks);
+    } else if (hold->releaseAfterMs > 0) {
+        ticks = ReleaseTicks(hold);
+    } else {
+        return;
+    }
+    struct timespec delay = TicksToTimespec(ticks);
+    if (SoftTimer_Start(&motor->holdTimer, &delay, NULL) != 0) {
+        ReleaseHeldCoils(motor);
+    }
+}
+
+static void Notify(StepperMotor *motor, StepperMotorEvent event)
+{
+    if (motor->callback != NULL) {
+        motor->callback(motor, event);
+    }
+}
+
+static void ReportError(StepperMotor *motor)
+{
+    motor->isMoving = false;
+    motor->pendingMove = PendingMove_None;
+    StepScheduler_Cancel(&motor->task);
+    ReleaseHeldCoils(motor);
+    Notify(motor, StepperMotorEvent_Error);
+}
+
+// Start a move from standstill in the given direction. The first step is due one start interval from now, counted
+// from after the callback has heard of the move, so whatever it does first does not eat into that interval.
+static void StartMove(StepperMotor *motor, int newDirection, uint32_t steps)
+{
+    EndHold(motor);
+    motor->direction = newDirection;
+    MotionRamp_Start(&motor->ramp, &motor->profile, steps);
+    motor->isMoving = true;
+    Notify(motor, StepperMotorEvent_MoveStarting);
+    StepClock_Start(&motor->clock, StepScheduler_Now());
+    uint64_t deadlineNs = StepClock_Advance(&motor->clock, MotionRamp_NextIntervalNs(&motor->ramp));
+    if (StepScheduler_Schedule(&motor->task, deadlineNs) != 0) {
+        ReportError(motor);
+    }
+}
+
+// Move to an absolute position without any wrapping.
+static void MoveToPosition(StepperMotor *motor, int32_t target)
+{
+    if (!motor->isMoving) {
+        int32_t delta = target - motor->position;
+        if (delta == 0) {
+            Notify(motor, StepperMotorEvent_MoveComplete);
+            return;
+        }
+        StartMove(motor, delta > 0 ? 1 : -1, (uint32_t)(delta > 0 ? delta : -delta));
+        return;
+    }
+
+    // Already moving: keep going if the target lies ahead of the point where we could stop, otherwise
+    // brake and come back to it. The scheduled step plus one per ramp level is the shortest stop.
+    int64_t ahead = ((int64_t)target - motor->position) * motor->direction;
+    if (ahead >= motor->ramp.level + 1) {
+        MotionRamp_Extend(&motor->ramp, (uint32_t)ahead);
+        motor->pendingMove = PendingMove_None;
+        return;
+    }
+    MotionRamp_RequestStop(&motor->ramp);
+    motor->pendingMove = PendingMove_Target;
+    motor->pendingTarget = target;
+}
+
+// The ramp has run out: start whatever was queued behind it, or hold the phase and go idle.
+static void MoveFinished(StepperMotor *motor)
+{
+    motor->isMoving = false;
+
+    PendingMoveKind next = motor->pendingMove;
+    motor->pendingMove = PendingMove_None;
+    if (next == PendingMove_Target && motor->pendingTarget != motor->position) {
+        MoveToPosition(motor, motor->pendingTarget);
+        return;
+    }
+    if (next == PendingMove_Jog) {
+        StartMove(motor, motor->pendingDirection, MOTION_STEPS_UNBOUNDED);
+        return;
+    }
+
+    StartHold(motor);
+    Notify(motor, StepperMotorEvent_MoveComplete);
+}
+
+// Drive the motor one step in the current direction.
+static void TakeStep(StepperMotor *motor, const StepSequence *sequence)
+{
+    motor->position += motor->direction;
+    int phase = PhaseOf(motor->position + motor->phaseOffset, sequence);
+    uint8_t coilMask = sequence->coilMasks[phase];
+    WriteCoils(motor, coilMask);
+    StepTrace_Record((uint8_t)phase, coilMask);
+    ++motor->stepsTaken;
+}
+
+// The step task runs once per step. The step clock makes each deadline the previous one plus the interval the
+// ramp picks, so the motor starts at a speed it can pull in from, accelerates to cruise and decelerates along the
+// same ramp before it stops exactly where the move ends, and a late wakeup does not push back the steps after it.
+// If the scheduler ran us so late that further steps are already due, only the one step is taken and the others
+// are counted as missed while the clock skips ahead on the same time grid. Driving the owed phases back to back
+// would get nowhere: the rotor cannot follow a change of phase with no dwell, so the position counter would run
+// ahead of it. stepsTaken + missedSteps matches the number of steps that were scheduled.
+static void StepperMotorTaskHandler(StepSchedulerTask *task, uint64_t nowNs)
+{
+    StepperMotor *motor = (StepperMotor *)task;
+
+    if (!motor->isMoving) {
+        return;
+    }
+    if (MotionRamp_IsDone(&motor->ramp)) {
+        // A stop requested at standstill
+        MoveFinished(motor);
+        return;
+    }
+
+    TakeStep(motor, StepSequence_Get(motor->stepMode));
+    if (!MotionRamp_StepTaken(&motor->ramp)) {
+        MoveFinished(motor);
+        return;
+    }
+
+    uint32_t intervalNs = MotionRamp_NextIntervalNs(&motor->ramp);
+    StepClock_Advance(&motor->clock, intervalNs);
+    uint64_t missed = StepClock_Resync(&motor->clock, nowNs, intervalNs);
+    if (missed > 0) {
+        motor->missedSteps += missed;
+        StepTrace_RecordEvent(StepTraceKind_Missed, 0, 0, (int32_t)missed);
+    }
+    if (StepScheduler_Schedule(task, motor->clock.deadlineNs) != 0) {
+        ReportError(motor);
+    }
+}
+
+int StepperMotor_Open(StepperMotor *motor, const StepperMotorConfig *config, StepperMotorCallback callback)
+{
+    StepScheduler_InitTask(&motor->task, &StepperMotorTaskHandler);
+    motor->callback = callback;
+    motor->stepMode = config->stepMode;
+    motor->fullStepsPerRevolution = config->fullStepsPerRevolution;
+    motor->isMoving = false;
+    motor->position = 0;
+    motor->phaseOffset = 0;
+    motor->direction = 1;
+    motor->pendingMove = PendingMove_None;
+    motor->stepsTaken = 0;
+    motor->missedSteps = 0;
+    motor->hold = config->hold;
+    motor->holdCoilMask = 0;
+    SoftTimer_Init(&motor->holdTimer, &HoldTimerHandler);
+
+    if (CoilBank_Open(&motor->coils, config->coilGpios) != 0) {
+        return -1;
+    }
+
+    if (MotionProfile_Init(&motor->profile, config->profileShape, config->startIntervalNs,
+                           config->cruiseIntervalNs, config->accelerationStepsPerSec2) != 0) {
+        Log_Debug("ERROR: Invalid stepper motion profile.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void StepperMotor_Close(StepperMotor *motor)
+{
+    StepScheduler_Cancel(&motor->task);
+    EndHold(motor);
+    motor->isMoving = false;
+    CoilBank_Close(&motor->coils);
+}
+
+void StepperMotor_Jog(StepperMotor *motor, int newDirection)
+{
+    newDirection = newDirection < 0 ? -1 : 1;
+
+    if (!motor->isMoving) {
+        StartMove(motor, newDirection, MOTION_STEPS_UNBOUNDED);
+    } else if (newDirection == motor->direction) {
+        // Accelerate back up from the current speed, even if a stop was under way
+        MotionRamp_Extend(&motor->ramp, MOTION_STEPS_UNBOUNDED);
+        motor->pendingMove = PendingMove_None;
+    } else {
+        MotionRamp_RequestStop(&motor->ramp);
+        motor->pendingMove = PendingMove_Jog;
+        motor->pendingDirection = newDirection;
+    }
+}
+
+void StepperMotor_Stop(StepperMotor *motor)
+{
+    motor->pendingMove = PendingMove_None;
+    if (motor->isMoving) {
+        MotionRamp_RequestStop(&motor->ramp);
+    }
+}
+
+void StepperMotor_Halt(StepperMotor *motor)
+{
+    motor->pendingMove = PendingMove_None;
+    motor->isMoving = false;
+    StepScheduler_Cancel(&motor->task);
+    ReleaseHeldCoils(motor);
+}
+
+void StepperMotor_MoveTo(StepperMotor *motor, int32_t target)
+{
+    const StepSequence *sequence = StepSequence_Get(motor->stepMode);
+    int32_t stepsPerRevolution = (int32_t)(motor->fullStepsPerRevolution * sequence->length / 4);
+
+    if (stepsPerRevolution > 0) {
+        // Rotary axis: go the shorter way round to the nearest position that is congruent with the target
+        int32_t delta = (target - motor->position) % stepsPerRevolution;
+        if (delta > stepsPerRevolution / 2) {
+            delta -= stepsPerRevolution;
+        } else if (delta < -stepsPerRevolution / 2) {
+            delta += stepsPerRevolution;
+        }
+        target = motor->position + delta;
+    }
+
+    MoveToPosition(motor, target);
+}
+
+void StepperMotor_MoveBy(StepperMotor *motor, int32_t delta)
+{
+    int32_t from = motor->position;
+    if (motor->pendingMove == PendingMove_Target) {
+        from = motor->pendingTarget;
+    } else if (motor->isMoving && motor->ramp.stepsRemaining != MOTION_STEPS_UNBOUNDED) {
+        from = motor->position + motor->direction * (int32_t)motor->ramp.stepsRemaining;
+    }
+    MoveToPosition(motor, from + delta);
+}
+
+int StepperMotor_Step(StepperMotor *motor, int direction)
+{
+    if (motor->isMoving) {
+        return -1;
+    }
+    EndHold(motor);
+    motor->direction = direction < 0 ? -1 : 1;
+    TakeStep(motor, StepSequence_Get(motor->stepMode));
+    return 0;
+}
+
+void StepperMotor_ReleaseCoils(StepperMotor *motor)
+{
+    if (!motor->isMoving) {
+        ReleaseHeldCoils(motor);
+    }
+}
+
+void StepperMotor_Hold(StepperMotor *motor)
+{
+    if (!motor->isMoving) {
+        StartHold(motor);
+    }
+}
+
+int32_t StepperMotor_GetPosition(const StepperMotor *motor)
+{
+    return motor->position;
+}
+
+StepMode StepperMotor_GetStepMode(const StepperMotor *motor)
+{
+    return motor->stepMode;
+}
+
+uint32_t StepperMotor_GetStepsPerFullStep(const StepperMotor *motor)
+{
+    return StepSequence_Get(motor->stepMode)->length / 4u;
+}
+
+bool StepperMotor_IsMoving(const StepperMotor *motor)
+{
+    return motor->isMoving;
+}
+
+int StepperMotor_SetPosition(StepperMotor *motor, int32_t position)
+{
+    if (motor->isMoving) {
+        return -1;
+    }
+    const StepSequence *sequence = StepSequence_Get(motor->stepMode);
+    motor->phaseOffset = PhaseOf(motor->position + motor->phaseOffset - position, sequence);
+    motor->position = position;
+    return 0;
+}
+
+uint32_t StepperMotor_GetPhase(const StepperMotor *motor)
+{
+    return (uint32_t)PhaseOf(motor->position + motor->phaseOffset, StepSequence_Get(motor->stepMode));
+}
+
+int StepperMotor_SetPhase(StepperMotor *motor, uint32_t phase)
+{
+    if (motor->isMoving) {
+        return -1;
+    }
+    const StepSequence *sequence = StepSequence_Get(motor->stepMode);
+    motor->phaseOffset = PhaseOf((int32_t)(phase % sequence->length) - motor->position, sequence);
+    if (motor->holdCoilMask != 0) {
+        StartHold(motor);
+    }
+    return 0;
+}
+
+void StepperMotor_SetSpeedLimit(StepperMotor *motor, uint32_t intervalNs)
+{
+    MotionProfile_SetSpeedLimit(&motor->profile, intervalNs);
+}
+
+void StepperMotor_SetHoldPolicy(StepperMotor *motor, const HoldPolicy *hold)
+{
+    bool wasChopped = IsChoppedHold(&motor->hold);
+    motor->hold = *hold;
+    // A chopped hold that stays chopped picks up the new duty and release timeout on its next edge by itself.
+    // Any other hold starts over in the same phase.
+    if (motor->holdCoilMask != 0 && !(wasChopped && IsChoppedHold(hold))) {
+        StartHold(motor);
+    }
+}
+
+uint64_t StepperMotor_GetCoilOnTimeNs(const StepperMotor *motor)
+{
+    return CoilBank_GetOnTimeNs(&motor->coils);
+}
+
+void StepperMotor_GetStepCounts(const StepperMotor *motor, uint64_t *taken, uint64_t *missed)
+{
+    *taken = motor->stepsTaken;
+    *missed = motor->missedSteps;
+}
@@ -0,0 +1,265 @@
+/*
+Stepper motor driven through a ULN2003.
+Each StepperMotor holds its pins, position and acceleration profile, and steps from a task on the shared step
+scheduler, so any number of motors share one timer. The motor keeps an absolute position counter in steps of the
+active step mode. The driven phase is derived from that position, so the rotor is re-energized in the phase it was
+left in and the counter stays meaningful across stops. Setting the position, for example at home, moves the phase
+origin along with it so the rotor stays where it is. Moves are either jogs that run until stopped, or moves to a
+target that follow the acceleration profile and stop exactly on the target.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <applibs/gpio.h>
+
+#include "coil_bank.h"
+#include "epoll_timerfd_utilities.h"
+#include "motion_profile.h"
+#include "step_scheduler.h"
+#include "step_sequence.h"
+
+/// <summary>Full steps per output shaft revolution of a 28BYJ-48 (32 steps times the 64:1 gearbox).</summary>
+#define STEPPER_28BYJ48_FULL_STEPS_PER_REVOLUTION 2048
+
+/// <summary>
+///     Events reported by the motor.
+/// </summary>
+typedef enum {
+    /// <summary>A move from standstill is about to start; its first step has not been scheduled yet.</summary>
+    StepperMotorEvent_MoveStarting,
+    /// <summary>The motor came to a stop and no further move is pending.</summary>
+    StepperMotorEvent_MoveComplete,
+    /// <summary>The step could not be scheduled; the motor is stopped.</summary>
+    StepperMotorEvent_Error
+} StepperMotorEvent;
+
+struct StepperMotor;
+
+/// <summary>
+///     Function signature for motor event callbacks.
+/// </summary>
+typedef void (*StepperMotorCallback)(struct StepperMotor *motor, StepperMotorEvent event);
+
+/// <summary>
+///     What the coils do while the motor stands still.
+/// </summary>
+typedef enum {
+    /// <summary>Switch every coil off as soon as the motor stops. The rotor is only held by the gearbox.</summary>
+    HoldMode_Release,
+    /// <summary>Keep the last phase energized at full current.</summary>
+    HoldMode_Full,
+    /// <summary>Keep the last phase energized at reduced average current by switching it on and off from the
+    /// timer wheel.</summary>
+    HoldMode_Reduced
+} HoldMode;
+
+/// <summary>
+///     Coil policy at standstill. The zero value releases the coils at once.
+/// </summary>
+typedef struct {
+    HoldMode mode;
+    /// <summary>Time at standstill after which a held phase is released, or 0 to hold until the next move.</summary>
+    uint32_t releaseAfterMs;
+    /// <summary>For HoldMode_Reduced: timer wheel ticks the phase is on and then off per cycle. 1 on and 2 off
+    /// holds at a third of the current.</summary>
+    uint8_t dutyOnTicks;
+    uint8_t dutyOffTicks;
+} HoldPolicy;
+
+/// <summary>
+///     Static configuration of the motor.
+/// </summary>
+typedef struct {
+    /// <summary>GPIOs wired to IN1 through IN4 of the driver.</summary>
+    GPIO_Id coilGpios[COIL_COUNT];
+    /// <summary>Initial stepping mode.</summary>
+    StepMode stepMode;
+    /// <summary>Shape of the acceleration ramp.</summary>
+    MotionProfileShape profileShape;
+    /// <summary>Step interval the motor can start at without stalling.</summary>
+    uint32_t startIntervalNs;
+    /// <summary>Step interval at cruise speed.</summary>
+    uint32_t cruiseIntervalNs;
+    /// <summary>Acceleration limit in steps per second squared.</summary>
+    uint32_t accelerationStepsPerSec2;
+    /// <summary>Full steps per revolution for a rotary axis, or 0 for a linear axis.</summary>
+    uint32_t fullStepsPerRevolution;
+    /// <summary>Coil policy at standstill. Holding uses the timer wheel, so <see cref="TimerWheel_Init" /> must
+    /// have been called unless the mode is HoldMode_Release.</summary>
+    HoldPolicy hold;
+} StepperMotorConfig;
+
+// What to do once the current move has decelerated to a stop.
+typedef enum { PendingMove_None, PendingMove_Target, PendingMove_Jog } PendingMoveKind;
+
+/// <summary>
+///     State of one motor. Treat the members as private to stepper_motor.c.
+/// </summary>
+typedef struct StepperMotor {
+    /// <summary>Step task on the shared scheduler; must stay the first member.</summary>
+    StepSchedulerTask task;
+    /// <summary>Deadline of the latest step.</summary>
+    StepClock clock;
+    StepperMotorCallback callback;
+    /// <summary>Free for the owner to use, for example to tell motors apart in the callback.</summary>
+    void *context;
+    CoilBank coils;
+    StepMode stepMode;
+    uint32_t fullStepsPerRevolution;
+    MotionProfile profile;
+    MotionRamp ramp;
+    bool isMoving;
+    int32_t position;
+    /// <summary>Added to the position to give the phase, so that the position can be set without moving the
+    /// rotor.</summary>
+    int32_t phaseOffset;
+    int direction;
+    PendingMoveKind pendingMove;
+    int32_t pendingTarget;
+    int pendingDirection;
+    uint64_t stepsTaken;
+    uint64_t missedSteps;
+    HoldPolicy hold;
+    /// <summary>Switches a reduced hold on and off and ends the hold after releaseAfterMs.</summary>
+    SoftTimer holdTimer;
+    /// <summary>Phase being held, or 0 if the coils are released.</summary>
+    uint8_t holdCoilMask;
+    /// <summary>Ticks of the hold so far, for the release timeout.</summary>
+    uint32_t holdTicks;
+} StepperMotor;
+
+/// <summary>
+///     Opens the coil GPIOs. <see cref="StepScheduler_Init" /> must have been called; the motor only has a
+///     task scheduled while it moves.
+/// </summary>
+/// <param name="motor">Motor state; must stay in memory until <see cref="StepperMotor_Close" /></param>
+/// <param name="config">Motor configuration</param>
+/// <param name="callback">Function called when a move starts or completes, or the motor fails; may be
+/// NULL</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int StepperMotor_Open(StepperMotor *motor, const StepperMotorConfig *config, StepperMotorCallback callback);
+
+/// <summary>
+///     Stops stepping, releases the coils and closes the GPIOs.
+/// </summary>
+void StepperMotor_Close(StepperMotor *motor);
+
+/// <summary>
+///     Turns the motor until <see cref="StepperMotor_Stop" /> is called.
+/// </summary>
+/// <param name="direction">1 to count the position up, -1 to count it down</param>
+void StepperMotor_Jog(StepperMotor *motor, int direction);
+
+/// <summary>
+///     Decelerates along the ramp to a stop and cancels any pending move.
+/// </summary>
+void StepperMotor_Stop(StepperMotor *motor);
+
+/// <summary>
+///     Stops at once, without decelerating, cancels any pending move and releases the coils, even if held. For when the rotor
+///     is known not to be following the steps, so there is nothing to decelerate. No event is reported.
+/// </summary>
+void StepperMotor_Halt(StepperMotor *motor);
+
+/// <summary>
+///     Moves to an absolute position. On a rotary axis the target is taken modulo one revolution and the motor
+///     takes the shorter way round; on a linear axis it goes straight there. A move that arrives while the
+///     motor is running the other way, or too fast to stop in time, first decelerates and then reverses.
+/// </summary>
+/// <param name="target">Target position in steps of the active step mode</param>
+void StepperMotor_MoveTo(StepperMotor *motor, int32_t target);
+
+/// <summary>
+///     Moves relative to the target of the current move, or to the current position when stopped.
+///     The delta is never wrapped, so a rotary axis can be turned more than one revolution.
+/// </summary>
+/// <param name="delta">Distance in steps of the active step mode</param>
+void StepperMotor_MoveBy(StepperMotor *motor, int32_t delta);
+
+/// <summary>
+///     Takes one step right away, without any timing of its own. This is how a planner that coordinates several
+///     motors drives them; leave the coils energized between steps and call <see cref="StepperMotor_Hold" /> or
+///     <see cref="StepperMotor_ReleaseCoils" /> when the move is over.
+/// </summary>
+/// <param name="direction">1 to count the position up, -1 to count it down</param>
+/// <returns>0 on success, or -1 if the motor is running a move of its own</returns>
+int StepperMotor_Step(StepperMotor *motor, int direction);
+
+/// <summary>
+///     Switches every coil off. Ignored while the motor is running a move of its own.
+/// </summary>
+void StepperMotor_ReleaseCoils(StepperMotor *motor);
+
+/// <summary>
+///     Applies the hold policy to the phase the motor was left in, as at the end of the motor's own moves. For
+///     a planner that drives the motor with <see cref="StepperMotor_Step" />. Ignored while the motor is running a
+///     move of its own.
+/// </summary>
+void StepperMotor_Hold(StepperMotor *motor);
+
+/// <summary>
+///     Returns the absolute position in steps of the active step mode.
+/// </summary>
+int32_t StepperMotor_GetPosition(const StepperMotor *motor);
+
+/// <summary>
+///     Returns the active step mode.
+/// </summary>
+StepMode StepperMotor_GetStepMode(const StepperMotor *motor);
+
+/// <summary>
+///     Returns the number of steps of the active step mode per full step: 2 in half stepping, otherwise 1.
+/// </summary>
+uint32_t StepperMotor_GetStepsPerFullStep(const StepperMotor *motor);
+
+/// <summary>
+///     Returns true while the motor is moving.
+/// </summary>
+bool StepperMotor_IsMoving(const StepperMotor *motor);
+
+/// <summary>
+///     Sets the position counter without stepping, for a position that is known some other way, such as the
+///     home position or one restored from a checkpoint. The phase stays as it is. Ignored while the motor is
+///     moving.
+/// </summary>
+/// <param name="position">Position in steps of the active step mode</param>
+/// <returns>0 on success, or -1 if the motor is moving</returns>
+int StepperMotor_SetPosition(StepperMotor *motor, int32_t position);
+
+/// <summary>
+///     Returns the phase the motor is in, as an index into the sequence of the active step mode.
+/// </summary>
+uint32_t StepperMotor_GetPhase(const StepperMotor *motor);
+
+/// <summary>
+///     Sets the phase the next step continues from, for a rotor known to be in that phase, without changing the
+///     position. A held phase is re-energized in the new one. Ignored while the motor is moving.
+/// </summary>
+/// <param name="phase">Index into the sequence of the active step mode</param>
+/// <returns>0 on success, or -1 if the motor is moving</returns>
+int StepperMotor_SetPhase(StepperMotor *motor, uint32_t phase);
+
+/// <summary>
+///     Limits the speed of the motor's own moves to that of a step interval; a move running faster slows down to
+///     it along the ramp.
+/// </summary>
+/// <param name="intervalNs">Shortest step interval, or 0 to run up to the configured cruise speed again</param>
+void StepperMotor_SetSpeedLimit(StepperMotor *motor, uint32_t intervalNs);
+
+/// <summary>
+///     Changes the coil policy at standstill. A phase that is being held carries on with the new duty, or is
+///     released if the new policy releases.
+/// </summary>
+void StepperMotor_SetHoldPolicy(StepperMotor *motor, const HoldPolicy *hold);
+
+/// <summary>
+///     Returns the time the motor's coils have been on since it was opened, added up over the coils.
+/// </summary>
+uint64_t StepperMotor_GetCoilOnTimeNs(const StepperMotor *motor);
+
+/// <summary>
+///     Reports the number of steps taken and the number missed because the handler ran late.
+/// </summary>
+void StepperMotor_GetStepCounts(const StepperMotor *motor, uint64_t *taken, uint64_t *missed);
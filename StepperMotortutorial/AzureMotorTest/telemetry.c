@@ -0,0 +1,212 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "telemetry.h"
+
+// Header plus time and values of every sample, at most 10 bytes per varint
+#define DATAGRAM_MAX_BYTES (6 + 10 + TELEMETRY_BATCH_SAMPLES * (1 + TelemetryField_Count) * 10)
+// A datagram must fit one Ethernet frame, so that it is never fragmented
+_Static_assert(DATAGRAM_MAX_BYTES <= 1472, "Telemetry batch too large for one frame");
+
+static void SocketEventHandler(EventData *eventData);
+static void SampleTimerHandler(SoftTimer *timer);
+
+static EventData socketEventData = {.eventHandler = &SocketEventHandler, .priority = EventPriority_Low};
+static SoftTimer sampleTimer;
+static int telemetryEpollFd = -1;
+static int telemetryFd = -1;
+static TelemetrySampler telemetrySampler = NULL;
+
+// Samples not encoded yet, oldest at ringHead
+static TelemetrySample ring[TELEMETRY_RING_SAMPLES];
+static uint32_t ringHead = 0;
+static uint32_t ringCount = 0;
+static uint32_t droppedSamples = 0;
+
+// Encoded batch waiting to be sent, or datagramLength 0
+static uint8_t datagram[DATAGRAM_MAX_BYTES];
+static size_t datagramLength = 0;
+// Set while the socket is registered for EPOLLOUT
+static bool waitingForSocket = false;
+// Last send error logged, so that a network that stays down is logged once
+static int lastSendError = 0;
+
+static size_t PutVarint(uint8_t *out, uint64_t value)
+{
+    size_t length = 0;
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        out[length++] = value != 0 ? (uint8_t)(byte | 0x80) : byte;
+    } while (value != 0);
+    return length;
+}
+
+static uint64_t ZigZag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+// Move up to one batch from the ring into the datagram buffer
+static void EncodeBatch(void)
+{
+    uint32_t count = ringCount < TELEMETRY_BATCH_SAMPLES ? ringCount : TELEMETRY_BATCH_SAMPLES;
+    size_t length = 0;
+    datagram[length++] = 'S';
+    datagram[length++] = 'T';
+    datagram[length++] = TELEMETRY_VERSION;
+    datagram[length++] = (uint8_t)count;
+    datagram[length++] = TelemetryField_Count;
+    length += PutVarint(&datagram[length], droppedSamples);
+
+    const TelemetrySample *previous = NULL;
+    for (uint32_t i = 0; i < count; ++i) {
+        const TelemetrySample *sample = &ring[(ringHead + i) % TELEMETRY_RING_SAMPLES];
+        uint64_t timeMs = previous == NULL ? sample->timeMs : sample->timeMs - previous->timeMs;
+        length += PutVarint(&datagram[length], timeMs);
+        for (int field = 0; field < TelemetryField_Count; ++field) {
+            int64_t value = sample->values[field];
+            int64_t delta = previous == NULL ? value : value - previous->values[field];
+            length += PutVarint(&datagram[length], ZigZag(delta));
+        }
+        previous = sample;
+    }
+
+    ringHead = (ringHead + count) % TELEMETRY_RING_SAMPLES;
+    ringCount -= count;
+    datagramLength = length;
+}
+
+static void WaitForSocket(bool wait)
+{
+    if (wait == waitingForSocket) {
+        return;
+    }
+    if (wait) {
+        if (RegisterEventHandlerToEpoll(telemetryEpollFd, telemetryFd, &socketEventData, EPOLLOUT) == 0) {
+            waitingForSocket = true;
+        }
+    } else if (UnregisterEventHandlerFromEpoll(telemetryEpollFd, telemetryFd) == 0) {
+        waitingForSocket = false;
+    }
+}
+
+// Send every full batch the socket takes without blocking. A batch that cannot go out stays encoded for the
+// next try: when the socket is writable again, or at the next sample if the network refused it.
+static void SendBatches(void)
+{
+    for (;;) {
+        if (datagramLength == 0) {
+            if (ringCount < TELEMETRY_BATCH_SAMPLES) {
+                break;
+            }
+            EncodeBatch();
+        }
+
+        if (send(telemetryFd, datagram, datagramLength, MSG_DONTWAIT) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                WaitForSocket(true);
+                return;
+            }
+            if (errno != lastSendError) {
+                lastSendError = errno;
+                Log_Debug("ERROR: Could not send telemetry: %s (%d).\n", strerror(errno), errno);
+            }
+            break;
+        }
+        lastSendError = 0;
+        datagramLength = 0;
+        // The socket is still writable, so the rest goes out on the next wakeup
+        if (EventLoop_ShouldYield()) {
+            WaitForSocket(true);
+            return;
+        }
+    }
+    WaitForSocket(false);
+}
+
+static void SocketEventHandler(EventData *eventData)
+{
+    SendBatches();
+}
+
+static void SampleTimerHandler(SoftTimer *timer)
+{
+    if (ringCount == TELEMETRY_RING_SAMPLES) {
+        // Keep the most recent data when the uplink cannot keep up
+        ringHead = (ringHead + 1) % TELEMETRY_RING_SAMPLES;
+        --ringCount;
+        ++droppedSamples;
+    }
+    TelemetrySample *sample = &ring[(ringHead + ringCount) % TELEMETRY_RING_SAMPLES];
+    ++ringCount;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    memset(sample, 0, sizeof(*sample));
+    sample->timeMs = (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+    telemetrySampler(sample);
+
+    if (!waitingForSocket) {
+        SendBatches();
+    }
+}
+
+int Telemetry_Open(int epollFd, const TelemetryConfig *config, TelemetrySampler sampler)
+{
+    if (config->address == 0) {
+        return 0;
+    }
+    if (config->periodMs == 0) {
+        Log_Debug("ERROR: Telemetry period must not be 0.\n");
+        return -1;
+    }
+
+    telemetryEpollFd = epollFd;
+    telemetrySampler = sampler;
+    ringHead = 0;
+    ringCount = 0;
+    droppedSamples = 0;
+    datagramLength = 0;
+    waitingForSocket = false;
+    lastSendError = 0;
+
+    // A connected UDP socket only sets the default destination, so nothing here waits on the network
+    telemetryFd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (telemetryFd < 0) {
+        Log_Debug("ERROR: Could not create telemetry socket: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    struct sockaddr_in collector = {
+        .sin_family = AF_INET, .sin_port = htons(config->port), .sin_addr.s_addr = config->address};
+    if (connect(telemetryFd, (const struct sockaddr *)&collector, sizeof(collector)) != 0) {
+        Log_Debug("ERROR: Could not connect telemetry socket: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    SoftTimer_Init(&sampleTimer, &SampleTimerHandler);
+    struct timespec period = {(time_t)(config->periodMs / 1000u), (long)(config->periodMs % 1000u) * 1000000L};
+    return SoftTimer_Start(&sampleTimer, &period, &period);
+}
+
+void Telemetry_Close(void)
+{
+    SoftTimer_Stop(&sampleTimer);
+    if (telemetryFd >= 0) {
+        CloseFdAndPrintError(telemetryFd, "Telemetry socket");
+        telemetryFd = -1;
+    }
+    waitingForSocket = false;
+}
+
+uint32_t Telemetry_GetDroppedSamples(void)
+{
+    return droppedSamples;
+}
@@ -0,0 +1,90 @@
+/*
+Telemetry uplink.
+A timer wheel timer takes a sample of the motor counters and latency figures every period and stores it in a
+preallocated ring. Once a batch has built up it is compressed and sent as one UDP datagram to a collector: the
+first sample of a batch is sent in full and every later one as the difference from the one before, each value as
+a zig-zag varint, so counters that barely move cost a byte each.
+Everything runs at low priority off the timer wheel and the socket never blocks. If the network is slow or down,
+samples wait in the ring (the oldest are overwritten once it is full), so a network stall can never hold up a step.
+The collector is given as a numeric IPv4 address, since a name lookup would block, and has to be listed in the
+AllowedConnections of the manifest.
+
+Datagram layout, all multi-byte values as unsigned LEB128 varints:
+    'S' 'T' version(1) sampleCount fieldCount droppedSamples
+    per sample: timeMs then fieldCount values; absolute for the first sample, zig-zag deltas for the rest
+*/
+#pragma once
+
+#include <stdint.h>
+
+/// <summary>Samples kept while waiting to be sent.</summary>
+#define TELEMETRY_RING_SAMPLES 64
+/// <summary>Samples per datagram: the most that fit one unfragmented datagram on a 1500 byte MTU, whatever the
+/// values. A varint takes at most 10 bytes, so a sample takes at most 110 and 13 of them with the 10 byte header
+/// come to 1440 of the 1472 bytes of UDP payload; 14 would not fit.</summary>
+#define TELEMETRY_BATCH_SAMPLES 13
+/// <summary>Version byte of the datagram layout.</summary>
+#define TELEMETRY_VERSION 1
+
+/// <summary>
+///     Values in a sample, in the order they are sent.
+/// </summary>
+typedef enum {
+    TelemetryField_StepsTaken,
+    TelemetryField_MissedSteps,
+    TelemetryField_Position,
+    TelemetryField_SchedulerWakeupP99Ns,
+    TelemetryField_SchedulerWakeupMaxNs,
+    TelemetryField_SchedulerExecutionP99Ns,
+    TelemetryField_ButtonWakeupP99Ns,
+    TelemetryField_TimeToFirstStepUs,
+    TelemetryField_Recoveries,
+    TelemetryField_MotorRiseDeciC,
+    TelemetryField_Count
+} TelemetryField;
+
+/// <summary>
+///     One sample.
+/// </summary>
+typedef struct {
+    /// <summary>CLOCK_MONOTONIC time of the sample in milliseconds.</summary>
+    uint64_t timeMs;
+    int64_t values[TelemetryField_Count];
+} TelemetrySample;
+
+/// <summary>
+///     Function that fills in a sample. Called from the timer wheel, so it must not block.
+/// </summary>
+typedef void (*TelemetrySampler)(TelemetrySample *sample);
+
+/// <summary>
+///     Where and how often to send telemetry.
+/// </summary>
+typedef struct {
+    /// <summary>IPv4 address of the collector in network byte order, or 0 to leave telemetry off.</summary>
+    uint32_t address;
+    /// <summary>UDP port of the collector.</summary>
+    uint16_t port;
+    /// <summary>Time between samples.</summary>
+    uint32_t periodMs;
+} TelemetryConfig;
+
+/// <summary>
+///     Opens the uplink socket and starts sampling. Does nothing if no collector is configured.
+///     <see cref="TimerWheel_Init" /> must have been called.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor the socket waits on when it cannot send</param>
+/// <param name="config">Collector and period</param>
+/// <param name="sampler">Function that fills in each sample</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Telemetry_Open(int epollFd, const TelemetryConfig *config, TelemetrySampler sampler);
+
+/// <summary>
+///     Stops sampling and closes the socket. Samples not sent yet are dropped.
+/// </summary>
+void Telemetry_Close(void);
+
+/// <summary>
+///     Returns the number of samples overwritten before they could be sent.
+/// </summary>
+uint32_t Telemetry_GetDroppedSamples(void);
@@ -0,0 +1,207 @@
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "thermal_governor.h"
+
+// Temperature coefficient of the resistance of copper, per degree C
+#define COPPER_TEMPERATURE_COEFFICIENT 0.00393
+
+// How hard the hold is being cut back, for logging the changes only
+typedef enum { HoldLevel_Full, HoldLevel_Reduced, HoldLevel_Released } HoldLevel;
+
+typedef struct {
+    uint64_t onTimeNs;
+    double riseC;
+    HoldPolicy hold;
+    HoldLevel holdLevel;
+} AxisState;
+
+static void SampleTimerHandler(SoftTimer *timer);
+
+static StepperMotor *const *governedMotors = NULL;
+static uint32_t axisCount = 0;
+static MovePlanner *governedPlanner = NULL;
+static uint32_t coldCruiseIntervalNs;
+static HoldPolicy coldHold;
+static ThermalGovernorConfig governorConfig;
+static AxisState axes[THERMAL_GOVERNOR_MAX_AXES];
+static uint64_t sampledNs;
+static SoftTimer sampleTimer;
+
+static uint64_t NowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// Winding resistance relative to its resistance at ambient
+static double ResistanceRatio(double riseC)
+{
+    return 1.0 + COPPER_TEMPERATURE_COEFFICIENT * riseC;
+}
+
+// Average power into the windings of an axis over the last period, from the coil-seconds per second it ran
+static double WindingPowerW(double coilsOn, double riseC)
+{
+    double volts = (governorConfig.supplyMillivolts - governorConfig.driverDropMillivolts) / 1000.0;
+    double ohms = governorConfig.coilResistanceMilliohms / 1000.0 * ResistanceRatio(riseC);
+    return coilsOn * volts * volts / ohms;
+}
+
+static void UpdateRise(AxisState *state, uint64_t onTimeNs, double periodS)
+{
+    double coilsOn = (double)(onTimeNs - state->onTimeNs) / 1e9 / periodS;
+    state->onTimeNs = onTimeNs;
+    double settledC = WindingPowerW(coilsOn, state->riseC) * governorConfig.thermalResistanceMilliCPerW / 1000.0;
+    // Backward Euler step of d(rise)/dt = (settled - rise) / timeConstant: stable for any period, and no exp()
+    state->riseC += (settledC - state->riseC) * periodS / (governorConfig.timeConstantS + periodS);
+}
+
+// The cold hold with its duty cut back by 'derate', from none at 0 to releasing at 1. The on ticks stay as they
+// are, so the winding current still rises as far on every pulse, and the off ticks stretch.
+static HoldPolicy DerateHold(double derate)
+{
+    if (coldHold.mode == HoldMode_Release || derate <= 0.0) {
+        return coldHold;
+    }
+    HoldPolicy hold = coldHold;
+    if (derate >= 1.0) {
+        hold.mode = HoldMode_Release;
+        return hold;
+    }
+
+    bool chopped = coldHold.mode == HoldMode_Reduced && coldHold.dutyOffTicks > 0;
+    double onTicks = coldHold.dutyOnTicks > 0 ? coldHold.dutyOnTicks : 1;
+    double coldDuty = chopped ? onTicks / (onTicks + coldHold.dutyOffTicks) : 1.0;
+    double duty = coldDuty * (1.0 - derate);
+    double offTicks = onTicks * (1.0 - duty) / duty;
+    hold.mode = HoldMode_Reduced;
+    hold.dutyOnTicks = (uint8_t)onTicks;
+    hold.dutyOffTicks = offTicks >= UINT8_MAX ? UINT8_MAX : (uint8_t)(offTicks + 0.999);
+    return hold;
+}
+
+static bool IsSameHold(const HoldPolicy *a, const HoldPolicy *b)
+{
+    return a->mode == b->mode && a->releaseAfterMs == b->releaseAfterMs && a->dutyOnTicks == b->dutyOnTicks &&
+           a->dutyOffTicks == b->dutyOffTicks;
+}
+
+static void LogHoldLevel(uint32_t axis, AxisState *state, HoldLevel level)
+{
+    if (level == state->holdLevel) {
+        return;
+    }
+    static const char *const changes[] = {"hold current back to normal", "reducing hold current",
+                                          "releasing the coils at standstill"};
+    Log_Debug("Thermal: axis %u estimated %ld.%ld C above ambient, %s.\n", axis, (long)(state->riseC),
+              (long)(state->riseC * 10) % 10, changes[level]);
+    state->holdLevel = level;
+}
+
+static void GovernAxis(uint32_t axis, AxisState *state)
+{
+    StepperMotor *motor = governedMotors[axis];
+
+    double derate = (state->riseC - governorConfig.derateFromRiseC) /
+                    (double)(governorConfig.maxRiseC - governorConfig.derateFromRiseC);
+    HoldPolicy hold = DerateHold(derate);
+    // Only a policy that changed is applied, as starting a hold over restarts its release timeout
+    if (!IsSameHold(&hold, &state->hold)) {
+        StepperMotor_SetHoldPolicy(motor, &hold);
+        state->hold = hold;
+    }
+    LogHoldLevel(axis, state, derate >= 1.0 ? HoldLevel_Released
+                                            : (derate > 0.0 ? HoldLevel_Reduced : HoldLevel_Full));
+}
+
+static uint32_t SpeedLimitNs(double riseC)
+{
+    return (uint32_t)(coldCruiseIntervalNs * ResistanceRatio(riseC > 0.0 ? riseC : 0.0));
+}
+
+static void SampleTimerHandler(SoftTimer *timer)
+{
+    uint64_t nowNs = NowNs();
+    double periodS = (double)(nowNs - sampledNs) / 1e9;
+    sampledNs = nowNs;
+    if (periodS <= 0.0) {
+        return;
+    }
+
+    double hottestC = 0.0;
+    for (uint32_t axis = 0; axis < axisCount; ++axis) {
+        AxisState *state = &axes[axis];
+        UpdateRise(state, StepperMotor_GetCoilOnTimeNs(governedMotors[axis]), periodS);
+        StepperMotor_SetSpeedLimit(governedMotors[axis], SpeedLimitNs(state->riseC));
+        GovernAxis(axis, state);
+        if (state->riseC > hottestC) {
+            hottestC = state->riseC;
+        }
+    }
+    // Every axis of a planned move keeps in step with the one that moves furthest, so the hottest sets the pace
+    if (governedPlanner != NULL) {
+        MovePlanner_SetSpeedLimit(governedPlanner, SpeedLimitNs(hottestC));
+    }
+}
+
+int ThermalGovernor_Open(StepperMotor *const *motors, uint32_t count, MovePlanner *planner,
+                         uint32_t cruiseIntervalNs, const HoldPolicy *hold, const ThermalGovernorConfig *config)
+{
+    if (count > THERMAL_GOVERNOR_MAX_AXES) {
+        Log_Debug("ERROR: At most %d axes can be governed.\n", THERMAL_GOVERNOR_MAX_AXES);
+        return -1;
+    }
+    if (config->supplyMillivolts <= config->driverDropMillivolts || config->coilResistanceMilliohms == 0 ||
+        config->timeConstantS == 0 || config->maxRiseC <= config->derateFromRiseC) {
+        Log_Debug("ERROR: Invalid thermal governor configuration.\n");
+        return -1;
+    }
+
+    governedMotors = motors;
+    axisCount = count;
+    governedPlanner = planner;
+    coldCruiseIntervalNs = cruiseIntervalNs;
+    coldHold = *hold;
+    governorConfig = *config;
+    sampledNs = NowNs();
+    for (uint32_t axis = 0; axis < count; ++axis) {
+        axes[axis] = (AxisState){.onTimeNs = StepperMotor_GetCoilOnTimeNs(motors[axis]),
+                                 .riseC = 0.0,
+                                 .hold = coldHold,
+                                 .holdLevel = HoldLevel_Full};
+    }
+
+    // Two coils on all the time, as in a full step hold, with the motor cold
+    double worstW = WindingPowerW(2.0, 0.0);
+    Log_Debug("Thermal: up to %ld mW per axis, settling %ld C above ambient.\n", (long)(worstW * 1000),
+              (long)(worstW * config->thermalResistanceMilliCPerW / 1000));
+
+    SoftTimer_Init(&sampleTimer, &SampleTimerHandler);
+    static const struct timespec period = {THERMAL_GOVERNOR_PERIOD_MS / 1000,
+                                           (THERMAL_GOVERNOR_PERIOD_MS % 1000) * 1000000L};
+    return SoftTimer_Start(&sampleTimer, &period, &period);
+}
+
+void ThermalGovernor_Close(void)
+{
+    SoftTimer_Stop(&sampleTimer);
+    for (uint32_t axis = 0; axis < axisCount; ++axis) {
+        StepperMotor_SetSpeedLimit(governedMotors[axis], 0);
+        if (!IsSameHold(&axes[axis].hold, &coldHold)) {
+            StepperMotor_SetHoldPolicy(governedMotors[axis], &coldHold);
+        }
+    }
+    if (governedPlanner != NULL) {
+        MovePlanner_SetSpeedLimit(governedPlanner, 0);
+    }
+    axisCount = 0;
+}
+
+int32_t ThermalGovernor_GetRiseDeciC(uint32_t axis)
+{
+    return axis < axisCount ? (int32_t)(axes[axis].riseC * 10) : 0;
+}
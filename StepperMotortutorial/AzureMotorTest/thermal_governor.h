@@ -0,0 +1,71 @@
+/*
+Power and thermal governor.
+The board has no temperature sensor on the motors, so the winding temperature of each axis is estimated from what
+its coils do. Every THERMAL_GOVERNOR_PERIOD_MS, at low priority off the timer wheel, the coil on time the coil bank
+has added up since the last sample gives the power put into the windings at the supply voltage, less the drop of
+the ULN2003, and the copper resistance at the estimated temperature. That power drives a first-order model of
+the motor's temperature rise over its surroundings, with the thermal resistance and time constant of the motor as
+mounted. Counting every coil-on nanosecond at the full DC current overestimates the power, since at speed the
+winding inductance keeps the current from reaching it, so the model errs on the hot side.
+Two things are governed from the estimate. The copper resistance rises with temperature, so at the same supply
+a hot winding carries less current and gives less torque; the cruise speed of the motor and of the planner is
+lowered in proportion, which keeps the torque margin the speed was tuned with when cold. Holding at standstill runs
+the coils for as long as the motor stands still, whatever it is doing, so that is where the heat is cut: from
+derateFromRiseC the hold duty is reduced in proportion, down to releasing the coils at maxRiseC.
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include "move_planner.h"
+#include "stepper_motor.h"
+
+/// <summary>Axes that can be governed.</summary>
+#define THERMAL_GOVERNOR_MAX_AXES 4
+/// <summary>Time between samples of the coil on time.</summary>
+#define THERMAL_GOVERNOR_PERIOD_MS 1000
+
+/// <summary>
+///     Electrical and thermal figures of the motors and their supply, the same for every axis.
+/// </summary>
+typedef struct {
+    /// <summary>Motor supply voltage at the driver.</summary>
+    uint32_t supplyMillivolts;
+    /// <summary>Voltage lost across a driver output that is on.</summary>
+    uint32_t driverDropMillivolts;
+    /// <summary>Resistance of one winding at the ambient temperature.</summary>
+    uint32_t coilResistanceMilliohms;
+    /// <summary>Temperature rise of the motor per watt it dissipates, once it has settled, as mounted.</summary>
+    uint32_t thermalResistanceMilliCPerW;
+    /// <summary>Time the motor takes to get to 63% of its settled rise.</summary>
+    uint32_t timeConstantS;
+    /// <summary>Rise from which the hold current is reduced.</summary>
+    uint32_t derateFromRiseC;
+    /// <summary>Rise at which the coils are released at standstill; must be above derateFromRiseC.</summary>
+    uint32_t maxRiseC;
+} ThermalGovernorConfig;
+
+/// <summary>
+///     Starts estimating and governing. <see cref="TimerWheel_Init" /> must have been called. The motors start
+///     out at ambient temperature.
+/// </summary>
+/// <param name="motors">Motors to govern; must stay in memory until <see cref="ThermalGovernor_Close" /></param>
+/// <param name="count">Number of motors, at most THERMAL_GOVERNOR_MAX_AXES</param>
+/// <param name="planner">Planner driving the motors, whose speed is limited to that of the hottest motor, or
+/// NULL</param>
+/// <param name="cruiseIntervalNs">Step interval at cruise speed with the motors cold</param>
+/// <param name="hold">Hold policy with the motors cold</param>
+/// <param name="config">Motor and supply figures</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int ThermalGovernor_Open(StepperMotor *const *motors, uint32_t count, MovePlanner *planner,
+                         uint32_t cruiseIntervalNs, const HoldPolicy *hold, const ThermalGovernorConfig *config);
+
+/// <summary>
+///     Stops governing and gives the motors and the planner back their cold speed and hold policy.
+/// </summary>
+void ThermalGovernor_Close(void);
+
+/// <summary>
+///     Returns the estimated temperature rise of an axis over its surroundings, in tenths of a degree C.
+/// </summary>
+int32_t ThermalGovernor_GetRiseDeciC(uint32_t axis);
@@ -0,0 +1,191 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "intercore.h"
+#include "mt3620_m4.h"
+
+// Mailbox commands the A7 sends while setting up the shared buffers.
+#define MBOX_CMD_OUTBOUND_BUFFER 0xba5e0001u
+#define MBOX_CMD_INBOUND_BUFFER 0xba5e0002u
+#define MBOX_CMD_END_OF_SETUP 0xba5e0003u
+
+// Software interrupt port that tells the other core a buffer was updated.
+#define MBOX_PORT_BUFFER_UPDATED (1u << 1)
+
+// Messages are stored as a 32 bit length followed by a header and the payload, each block padded to 8 bytes.
+#define BLOCK_ALIGNMENT 8u
+
+typedef struct {
+    volatile uint32_t writePosition;
+    volatile uint32_t readPosition;
+    uint32_t reserved[14];
+} BufferHeader;
+
+typedef struct {
+    uint8_t componentId[16];
+    uint32_t reserved;
+} MessageHeader;
+
+static BufferHeader *outbound = NULL;
+static BufferHeader *inbound = NULL;
+static uint32_t outboundSize = 0;
+static uint32_t inboundSize = 0;
+static MessageHeader outboundHeader;
+
+static void MboxDequeue(uint32_t *cmd, uint32_t *data)
+{
+    while (ReadReg32(MT3620_MBOX_BASE, MBOX_FIFO_POP_CNT) == 0) {
+        // wait for the A7
+    }
+    *data = ReadReg32(MT3620_MBOX_BASE, MBOX_DATA_ACQUIRE);
+    *cmd = ReadReg32(MT3620_MBOX_BASE, MBOX_CMD_ACQUIRE);
+}
+
+// A buffer descriptor is the header address with log2 of the buffer size in its low five bits.
+static void DecodeBufferDescriptor(uint32_t descriptor, BufferHeader **header, uint32_t *size)
+{
+    *header = (BufferHeader *)(uintptr_t)(descriptor & ~0x1Fu);
+    *size = (1u << (descriptor & 0x1Fu)) - (uint32_t)sizeof(BufferHeader);
+}
+
+static uint8_t *DataArea(BufferHeader *header)
+{
+    return (uint8_t *)header + sizeof(BufferHeader);
+}
+
+static uint8_t HexNibble(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return (uint8_t)(c - '0');
+    }
+    return (uint8_t)((c | 0x20) - 'a' + 10);
+}
+
+// Component IDs travel in binary GUID order: the first three groups little endian, the rest as written.
+static void ParseComponentId(const char *text, uint8_t id[16])
+{
+    static const uint8_t order[16] = {3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15};
+    uint8_t bytes[16];
+    int count = 0;
+    for (const char *p = text; *p != '\0' && count < 16; ++p) {
+        if (*p == '-') {
+            continue;
+        }
+        bytes[count++] = (uint8_t)(HexNibble(p[0]) << 4 | HexNibble(p[1]));
+        ++p;
+    }
+    for (int i = 0; i < 16; ++i) {
+        id[i] = bytes[order[i]];
+    }
+}
+
+static uint32_t RoundUp(uint32_t value, uint32_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void CopyToRing(uint8_t *ring, uint32_t ringSize, uint32_t position, const void *src,
+                       uint32_t size)
+{
+    uint32_t first = ringSize - position < size ? ringSize - position : size;
+    memcpy(ring + position, src, first);
+    memcpy(ring, (const uint8_t *)src + first, size - first);
+}
+
+static void CopyFromRing(const uint8_t *ring, uint32_t ringSize, uint32_t position, void *dst,
+                         uint32_t size)
+{
+    uint32_t first = ringSize - position < size ? ringSize - position : size;
+    memcpy(dst, ring + position, first);
+    memcpy((uint8_t *)dst + first, ring, size - first);
+}
+
+int Intercore_Init(const char *peerComponentId)
+{
+    ParseComponentId(peerComponentId, outboundHeader.componentId);
+    outboundHeader.reserved = 0;
+
+    uint32_t cmd, data;
+    MboxDequeue(&cmd, &data);
+    if (cmd != MBOX_CMD_OUTBOUND_BUFFER) {
+        return -1;
+    }
+    DecodeBufferDescriptor(data, &outbound, &outboundSize);
+
+    MboxDequeue(&cmd, &data);
+    if (cmd != MBOX_CMD_INBOUND_BUFFER) {
+        return -1;
+    }
+    DecodeBufferDescriptor(data, &inbound, &inboundSize);
+
+    MboxDequeue(&cmd, &data);
+    return cmd == MBOX_CMD_END_OF_SETUP ? 0 : -1;
+}
+
+int Intercore_Send(const void *payload, uint32_t size)
+{
+    if (outbound == NULL || size > INTERCORE_MAX_PAYLOAD_SIZE) {
+        return -1;
+    }
+
+    uint32_t messageSize = (uint32_t)sizeof(MessageHeader) + size;
+    uint32_t blockSize = RoundUp((uint32_t)sizeof(uint32_t) + messageSize, BLOCK_ALIGNMENT);
+    uint32_t writePosition = outbound->writePosition;
+    uint32_t readPosition = outbound->readPosition;
+    uint32_t used = (writePosition + outboundSize - readPosition) % outboundSize;
+    // Keep one alignment unit free so a full buffer is distinguishable from an empty one.
+    if (used + blockSize >= outboundSize) {
+        return -1;
+    }
+
+    uint8_t *ring = DataArea(outbound);
+    CopyToRing(ring, outboundSize, writePosition, &messageSize, sizeof(messageSize));
+    writePosition = (writePosition + sizeof(messageSize)) % outboundSize;
+    CopyToRing(ring, outboundSize, writePosition, &outboundHeader, sizeof(outboundHeader));
+    writePosition = (writePosition + sizeof(outboundHeader)) % outboundSize;
+    CopyToRing(ring, outboundSize, writePosition, payload, size);
+
+    // Publish the message only after its contents are in memory, then tell the A7.
+    __asm__ volatile("dmb" ::: "memory");
+    outbound->writePosition = (outbound->writePosition + blockSize) % outboundSize;
+    __asm__ volatile("dmb" ::: "memory");
+    WriteReg32(MT3620_MBOX_BASE, MBOX_SW_TX_INT_PORT, MBOX_PORT_BUFFER_UPDATED);
+    return 0;
+}
+
+int Intercore_Receive(void *payload, uint32_t *size)
+{
+    if (inbound == NULL) {
+        return -1;
+    }
+
+    uint32_t readPosition = inbound->readPosition;
+    uint32_t writePosition = inbound->writePosition;
+    if (readPosition == writePosition) {
+        return -1;
+    }
+    __asm__ volatile("dmb" ::: "memory");
+
+    const uint8_t *ring = DataArea(inbound);
+    uint32_t messageSize;
+    CopyFromRing(ring, inboundSize, readPosition, &messageSize, sizeof(messageSize));
+    uint32_t blockSize = RoundUp((uint32_t)sizeof(uint32_t) + messageSize, BLOCK_ALIGNMENT);
+
+    int result = -1;
+    if (messageSize >= sizeof(MessageHeader)) {
+        uint32_t payloadSize = messageSize - (uint32_t)sizeof(MessageHeader);
+        uint32_t payloadPosition =
+            (readPosition + sizeof(uint32_t) + sizeof(MessageHeader)) % inboundSize;
+        if (payloadSize <= *size) {
+            CopyFromRing(ring, inboundSize, payloadPosition, payload, payloadSize);
+            *size = payloadSize;
+            result = 0;
+        }
+    }
+
+    // Oversized or malformed messages are dropped rather than left blocking the buffer.
+    __asm__ volatile("dmb" ::: "memory");
+    inbound->readPosition = (readPosition + blockSize) % inboundSize;
+    WriteReg32(MT3620_MBOX_BASE, MBOX_SW_TX_INT_PORT, MBOX_PORT_BUFFER_UPDATED);
+    return result;
+}
@@ -0,0 +1,35 @@
+/*
+Message transport between this real-time app and the high-level app on the A7 core.
+At start-up the A7 posts the addresses of two shared ring buffers through the mailbox; after that, messages are
+copied in and out of those buffers and the mailbox is only used to tell the other core that a buffer changed.
+The framing follows the Azure Sphere inter-core protocol, so the high-level side uses a plain Application_Connect
+socket and sees one datagram per message.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// <summary>Largest payload accepted by <see cref="Intercore_Send" /> and <see cref="Intercore_Receive" />.</summary>
+#define INTERCORE_MAX_PAYLOAD_SIZE 1024
+
+/// <summary>
+///     Waits for the high-level core to publish the shared buffers.
+/// </summary>
+/// <param name="peerComponentId">Component ID of the high-level app, in its textual form</param>
+/// <returns>0 on success, or -1 if the mailbox sequence was not understood</returns>
+int Intercore_Init(const char *peerComponentId);
+
+/// <summary>
+///     Queues a message for the high-level app and notifies it.
+/// </summary>
+/// <returns>0 on success, or -1 if the outbound buffer is full</returns>
+int Intercore_Send(const void *payload, uint32_t size);
+
+/// <summary>
+///     Takes the next message from the high-level app, if there is one.
+/// </summary>
+/// <param name="payload">Receives the payload</param>
+/// <param name="size">In: size of payload. Out: size of the message</param>
+/// <returns>0 if a message was received, or -1 if there was none</returns>
+int Intercore_Receive(void *payload, uint32_t *size);
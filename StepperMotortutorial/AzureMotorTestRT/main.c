@@ -0,0 +1,357 @@
+/*
+Real-time step engine for the 28BYJ-48 on the MT3620 IO M4 core.
+This app owns the ULN2003 inputs (GPIO 31-34) and produces every step from the Cortex-M4 SysTick interrupt, so
+step edges land within a few core cycles of their schedule instead of depending on Linux timer wakeups.
+The high-level AzureMotorTest app sends Configure, MoveTo, Jog and Stop commands over the inter-core buffers
+(see step_engine_protocol.h) and gets a status message back whenever a move starts or ends.
+
+The four coil inputs are bits of one GPIO block, so a phase change is a single register store and the driver
+never sees an intermediate coil pattern. The SysTick reload value is always programmed one step ahead, which
+makes each interval exact: the counter reloads in hardware at the moment the step fires.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "intercore.h"
+#include "mt3620_m4.h"
+#include "../AzureMotorTest/motion_profile.h"
+#include "../AzureMotorTest/step_engine_protocol.h"
+#include "../AzureMotorTest/step_sequence.h"
+
+extern uint32_t StackTop;
+extern uint32_t __data_start__, __data_end__, __data_load__, __bss_start__, __bss_end__;
+extern const uintptr_t ExceptionVectorTable[16];
+
+// The driver's IN1..IN4 are wired to GPIO 32, 33, 31 and 34, which are bits 1, 2, 0 and 3 of the ISU1 block.
+static const uint32_t coilBlockBits[COIL_COUNT] = {1u << 1, 1u << 2, 1u << 0, 1u << 3};
+#define COIL_BLOCK_MASK 0x0Fu
+
+// Rate of the SysTick interrupt while no move is running; it only wakes the command loop.
+#define IDLE_TICK_NS 1000000u
+
+static MotionProfile motionProfile;
+static MotionRamp motionRamp;
+static StepMode stepMode = StepMode_FullStep;
+
+// GPIO block value for each phase of the active sequence. A coil is energized by driving its input Low.
+static uint32_t phaseOutputs[8];
+static uint8_t phaseCount = 4;
+
+// Shared with the SysTick handler; only changed by the command loop with interrupts masked.
+static volatile bool moving = false;
+static volatile bool moveFinished = false;
+static volatile int32_t position = 0;
+static volatile uint32_t stepsTaken = 0;
+static volatile uint32_t lateSteps = 0;
+static int direction = 1;
+// Steps that have an interval programmed into SysTick but have not fired yet (at most two).
+static volatile uint32_t committedSteps = 0;
+
+// What to start once the current move has decelerated to a stop.
+static enum { PendingMove_None, PendingMove_Target, PendingMove_Jog } pendingMove = PendingMove_None;
+static int32_t pendingTarget = 0;
+static int pendingDirection = 1;
+
+static inline void DisableInterrupts(void)
+{
+    __asm__ volatile("cpsid i" ::: "memory");
+}
+
+static inline void EnableInterrupts(void)
+{
+    __asm__ volatile("cpsie i" ::: "memory");
+}
+
+static uint32_t NsToTicks(uint32_t ns)
+{
+    uint64_t ticks = ((uint64_t)ns * MT3620_M4_CORE_CLOCK_HZ) / 1000000000u;
+    if (ticks < 2) {
+        ticks = 2;
+    }
+    return ticks - 1 > SYST_RVR_MAX ? SYST_RVR_MAX : (uint32_t)(ticks - 1);
+}
+
+static void BuildPhaseOutputs(StepMode mode)
+{
+    const StepSequence *sequence = StepSequence_Get(mode);
+    phaseCount = sequence->length;
+    for (int phase = 0; phase < phaseCount; ++phase) {
+        uint32_t output = COIL_BLOCK_MASK;
+        for (int coil = 0; coil < COIL_COUNT; ++coil) {
+            if ((sequence->coilMasks[phase] & (1u << coil)) != 0) {
+                output &= ~coilBlockBits[coil];
+            }
+        }
+        phaseOutputs[phase] = output;
+    }
+}
+
+static void WriteCoilOutputs(uint32_t output)
+{
+    // GPIO 35 shares the block; keep whatever level it has.
+    uint32_t dout = ReadReg32(MT3620_GPIO_ISU1_BASE, GPIO_DOUT);
+    WriteReg32(MT3620_GPIO_ISU1_BASE, GPIO_DOUT, (dout & ~COIL_BLOCK_MASK) | output);
+}
+
+// Commit one more step to the SysTick schedule: pick its interval from the ramp and program it as the next
+// reload value. Returns false when the ramp has no steps left, in which case the idle period is programmed.
+static bool CommitNextStep(void)
+{
+    if (MotionRamp_IsDone(&motionRamp)) {
+        WriteReg32(SCS_BASE, SYST_RVR, NsToTicks(IDLE_TICK_NS));
+        return false;
+    }
+    WriteReg32(SCS_BASE, SYST_RVR, NsToTicks(MotionRamp_NextIntervalNs(&motionRamp)));
+    MotionRamp_StepTaken(&motionRamp);
+    ++committedSteps;
+    return true;
+}
+
+static void SysTickHandler(void)
+{
+    if (committedSteps == 0) {
+        return;
+    }
+
+    int32_t newPosition = position + direction;
+    int phase = newPosition % phaseCount;
+    if (phase < 0) {
+        phase += phaseCount;
+    }
+    WriteCoilOutputs(phaseOutputs[phase]);
+    position = newPosition;
+    ++stepsTaken;
+    --committedSteps;
+
+    // The counter has already reloaded with this step's successor; program the one after it.
+    if (committedSteps == 1) {
+        CommitNextStep();
+    } else if (committedSteps == 0) {
+        WriteReg32(SCS_BASE, SYST_RVR, NsToTicks(IDLE_TICK_NS));
+        moving = false;
+        moveFinished = true;
+    }
+
+    // Another tick pending already means this handler ran more than one interval late.
+    if ((ReadReg32(SCS_BASE, SCB_ICSR) & SCB_ICSR_PENDSTSET) != 0) {
+        ++lateSteps;
+    }
+}
+
+static void SendStatus(void)
+{
+    StepEngineStatusMessage status = {
+        .type = StepEngineMessage_Status,
+        .moving = moving ? 1 : 0,
+        .position = position,
+        .stepsTaken = stepsTaken,
+        .lateSteps = lateSteps,
+    };
+    Intercore_Send(&status, sizeof(status));
+}
+
+// Start a move from standstill. Must be called with interrupts masked.
+static void StartMove(int newDirection, uint32_t steps)
+{
+    direction = newDirection;
+    MotionRamp_Start(&motionRamp, &motionProfile, steps);
+    moving = true;
+    moveFinished = false;
+
+    // Restart the counter on the first interval, wait until it has been loaded, then queue the second.
+    WriteReg32(SCS_BASE, SYST_RVR, NsToTicks(MotionRamp_NextIntervalNs(&motionRamp)));
+    MotionRamp_StepTaken(&motionRamp);
+    committedSteps = 1;
+    WriteReg32(SCS_BASE, SYST_CVR, 0);
+    while (ReadReg32(SCS_BASE, SYST_CVR) == 0) {
+    }
+    CommitNextStep();
+}
+
+// Steps still to be committed after the ones already in the SysTick schedule, if the motor is to end at target.
+static int64_t StepsAheadTo(int32_t target)
+{
+    return ((int64_t)target - position) * direction - committedSteps;
+}
+
+// Decelerate as soon as possible. The ramp's own stop counts the step it last scheduled as still to come, but
+// here that step is already committed, so the ramp is cut one step shorter.
+static void RequestStop(void)
+{
+    if (motionRamp.stepsRemaining > (uint32_t)motionRamp.level) {
+        motionRamp.stepsRemaining = (uint32_t)motionRamp.level;
+    }
+}
+
+static void MoveTo(int32_t target)
+{
+    DisableInterrupts();
+    if (!moving) {
+        int32_t delta = target - position;
+        if (delta != 0) {
+            StartMove(delta > 0 ? 1 : -1, (uint32_t)(delta > 0 ? delta : -delta));
+        }
+        pendingMove = PendingMove_None;
+    } else {
+        int64_t ahead = StepsAheadTo(target);
+        if (ahead >= motionRamp.level) {
+            MotionRamp_Extend(&motionRamp, (uint32_t)ahead);
+            pendingMove = PendingMove_None;
+        } else {
+            RequestStop();
+            pendingMove = PendingMove_Target;
+            pendingTarget = target;
+        }
+    }
+    EnableInterrupts();
+}
+
+static void Jog(int newDirection)
+{
+    DisableInterrupts();
+    if (!moving) {
+        StartMove(newDirection, MOTION_STEPS_UNBOUNDED);
+        pendingMove = PendingMove_None;
+    } else if (newDirection == direction) {
+        MotionRamp_Extend(&motionRamp, MOTION_STEPS_UNBOUNDED);
+        pendingMove = PendingMove_None;
+    } else {
+        RequestStop();
+        pendingMove = PendingMove_Jog;
+        pendingDirection = newDirection;
+    }
+    EnableInterrupts();
+}
+
+static void Stop(void)
+{
+    DisableInterrupts();
+    pendingMove = PendingMove_None;
+    if (moving) {
+        RequestStop();
+    }
+    EnableInterrupts();
+}
+
+static void Configure(const StepEngineConfigureMessage *message)
+{
+    if (moving || message->stepMode >= StepMode_Count) {
+        return;
+    }
+    if (MotionProfile_Init(&motionProfile, (MotionProfileShape)message->profileShape,
+                           message->startIntervalNs, message->cruiseIntervalNs,
+                           message->accelerationStepsPerSec2) != 0) {
+        return;
+    }
+    stepMode = (StepMode)message->stepMode;
+    BuildPhaseOutputs(stepMode);
+}
+
+static void HandleMessage(const uint8_t *message, uint32_t size)
+{
+    if (size == sizeof(StepEngineConfigureMessage) && message[0] == StepEngineMessage_Configure) {
+        Configure((const StepEngineConfigureMessage *)message);
+    } else if (size == sizeof(StepEngineMotionMessage)) {
+        const StepEngineMotionMessage *motion = (const StepEngineMotionMessage *)message;
+        switch (motion->type) {
+        case StepEngineMessage_MoveTo:
+            MoveTo(motion->target);
+            break;
+        case StepEngineMessage_Jog:
+            Jog(motion->target < 0 ? -1 : 1);
+            break;
+        case StepEngineMessage_Stop:
+            Stop();
+            break;
+        default:
+            return;
+        }
+    } else {
+        return;
+    }
+    SendStatus();
+}
+
+// The move has come to a stop: start the one queued behind it or release the coils.
+static void FinishMove(void)
+{
+    moveFinished = false;
+    if (pendingMove == PendingMove_Target) {
+        MoveTo(pendingTarget);
+    } else if (pendingMove == PendingMove_Jog) {
+        Jog(pendingDirection);
+    } else {
+        WriteCoilOutputs(COIL_BLOCK_MASK);
+    }
+    SendStatus();
+}
+
+static _Noreturn void RTCoreMain(void)
+{
+    WriteReg32(SCS_BASE, SCB_VTOR, (uint32_t)(uintptr_t)ExceptionVectorTable);
+
+    // Coil inputs are outputs, High (coil off) until the first step.
+    WriteCoilOutputs(COIL_BLOCK_MASK);
+    WriteReg32(MT3620_GPIO_ISU1_BASE, GPIO_OE_SET, COIL_BLOCK_MASK);
+
+    // Fall back to the high-level app's default profile until it sends its own.
+    MotionProfile_Init(&motionProfile, MotionProfileShape_SCurve, 2048000, 1200000, 2000);
+    BuildPhaseOutputs(stepMode);
+
+    WriteReg32(SCS_BASE, SYST_RVR, NsToTicks(IDLE_TICK_NS));
+    WriteReg32(SCS_BASE, SYST_CVR, 0);
+    WriteReg32(SCS_BASE, SYST_CSR, SYST_CSR_ENABLE | SYST_CSR_TICKINT | SYST_CSR_CLKSOURCE_CORE);
+
+    if (Intercore_Init(STEP_ENGINE_HL_COMPONENT_ID) != 0) {
+        for (;;) {
+            __asm__ volatile("wfi");
+        }
+    }
+
+    for (;;) {
+        uint8_t message[INTERCORE_MAX_PAYLOAD_SIZE];
+        uint32_t size = sizeof(message);
+        while (Intercore_Receive(message, &size) == 0) {
+            HandleMessage(message, size);
+            size = sizeof(message);
+        }
+        if (moveFinished) {
+            FinishMove();
+        }
+        __asm__ volatile("wfi");
+    }
+}
+
+static _Noreturn void DefaultExceptionHandler(void)
+{
+    for (;;) {
+        __asm__ volatile("wfi");
+    }
+}
+
+static _Noreturn void ResetHandler(void)
+{
+    const uint32_t *src = &__data_load__;
+    for (uint32_t *dst = &__data_start__; dst < &__data_end__;) {
+        *dst++ = *src++;
+    }
+    for (uint32_t *dst = &__bss_start__; dst < &__bss_end__;) {
+        *dst++ = 0;
+    }
+    RTCoreMain();
+}
+
+// Cortex-M4 core exceptions. No peripheral interrupts are enabled, so the table stops after SysTick.
+__attribute__((section(".vector_table"), used)) const uintptr_t ExceptionVectorTable[16] = {
+    [0] = (uintptr_t)&StackTop,
+    [1] = (uintptr_t)ResetHandler,
+    [2] = (uintptr_t)DefaultExceptionHandler,  // NMI
+    [3] = (uintptr_t)DefaultExceptionHandler,  // HardFault
+    [4] = (uintptr_t)DefaultExceptionHandler,  // MemManage
+    [5] = (uintptr_t)DefaultExceptionHandler,  // BusFault
+    [6] = (uintptr_t)DefaultExceptionHandler,  // UsageFault
+    [11] = (uintptr_t)DefaultExceptionHandler, // SVCall
+    [12] = (uintptr_t)DefaultExceptionHandler, // DebugMonitor
+    [14] = (uintptr_t)DefaultExceptionHandler, // PendSV
+    [15] = (uintptr_t)SysTickHandler,
+};
@@ -0,0 +1,56 @@
+/*
+Register definitions for the parts of the MT3620 IO M4 core that the step engine touches:
+the Cortex-M4 system timer and interrupt controller, the GPIO block that GPIO 31-35 belong to,
+and the mailbox the high-level core uses to set up inter-core buffers.
+*/
+#pragma once
+
+#include <stdint.h>
+
+/// <summary>Core clock of the IO M4 cores out of reset (the 26 MHz crystal).</summary>
+#define MT3620_M4_CORE_CLOCK_HZ 26000000u
+
+static inline uint32_t ReadReg32(uintptr_t base, uint32_t offset)
+{
+    return *(volatile uint32_t *)(base + offset);
+}
+
+static inline void WriteReg32(uintptr_t base, uint32_t offset, uint32_t value)
+{
+    *(volatile uint32_t *)(base + offset) = value;
+}
+
+// Cortex-M4 system control space
+#define SCS_BASE 0xE000E000u
+#define SYST_CSR 0x010u
+#define SYST_RVR 0x014u
+#define SYST_CVR 0x018u
+#define SCB_ICSR 0xD04u
+#define SCB_VTOR 0xD08u
+
+#define SYST_CSR_ENABLE (1u << 0)
+#define SYST_CSR_TICKINT (1u << 1)
+#define SYST_CSR_CLKSOURCE_CORE (1u << 2)
+#define SYST_RVR_MAX 0x00FFFFFFu
+#define SCB_ICSR_PENDSTSET (1u << 26)
+
+// GPIO 31-35 are the GPIO block of ISU1; GPIO 31 is bit 0 of the block through GPIO 35 as bit 4.
+#define MT3620_GPIO_ISU1_BASE 0x38080000u
+#define MT3620_GPIO_ISU1_FIRST_PIN 31
+#define GPIO_DIN 0x04u
+#define GPIO_DOUT 0x10u
+#define GPIO_DOUT_SET 0x14u
+#define GPIO_DOUT_RESET 0x18u
+#define GPIO_OE 0x20u
+#define GPIO_OE_SET 0x24u
+#define GPIO_OE_RESET 0x28u
+
+// Mailbox between the high-level A7 core and IO M4 core 0
+#define MT3620_MBOX_BASE 0x21050000u
+#define MBOX_CMD_POST 0x00u
+#define MBOX_DATA_POST 0x04u
+#define MBOX_CMD_ACQUIRE 0x10u
+#define MBOX_DATA_ACQUIRE 0x14u
+#define MBOX_SW_TX_INT_PORT 0x1Cu
+#define MBOX_FIFO_POP_CNT 0x58u
+#define MBOX_FIFO_PUSH_CNT 0x5Cu
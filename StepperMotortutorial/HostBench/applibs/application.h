@@ -0,0 +1,7 @@
+/*
+Host stand-in for the Azure Sphere applibs application API. There is no real-time core on the host, so
+connecting to one always fails with ECONNREFUSED.
+*/
+#pragma once
+
+int Application_Connect(const char *componentId);
@@ -0,0 +1,27 @@
+/*
+Host stand-in for the Azure Sphere applibs GPIO API. Every call is counted and every write is timestamped by
+mock_applibs.c; see mock_applibs.h for how to read them back.
+*/
+#pragma once
+
+#include <stdint.h>
+
+typedef int GPIO_Id;
+
+typedef uint32_t GPIO_OutputMode_Type;
+enum {
+    GPIO_OutputMode_PushPull = 0,
+    GPIO_OutputMode_OpenDrain = 1,
+    GPIO_OutputMode_OpenSource = 2
+};
+
+typedef uint32_t GPIO_Value_Type;
+enum {
+    GPIO_Value_Low = 0,
+    GPIO_Value_High = 1
+};
+
+int GPIO_OpenAsOutput(GPIO_Id gpioId, GPIO_OutputMode_Type outputMode, GPIO_Value_Type initialValue);
+int GPIO_OpenAsInput(GPIO_Id gpioId);
+int GPIO_SetValue(int gpioFd, GPIO_Value_Type value);
+int GPIO_GetValue(int gpioFd, GPIO_Value_Type *outValue);
@@ -0,0 +1,10 @@
+/*
+Host stand-in for the Azure Sphere applibs log API. Messages go to stderr so benchmark results on stdout stay
+machine readable.
+*/
+#pragma once
+
+#include <stdarg.h>
+
+int Log_Debug(const char *fmt, ...);
+int Log_DebugVarArgs(const char *fmt, va_list args);
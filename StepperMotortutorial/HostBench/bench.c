@@ -0,0 +1,110 @@
+/*
+Host benchmark of the stepper loop.
+Runs one move per stepping mode through the real step scheduler, stepper and epoll code against the mock
+applibs layer, and reports step rate, system calls per step and scheduler wakeup jitter.
+Usage: bench [steps [cruise interval in us]]
+*/
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "latency_stats.h"
+#include "mock_applibs.h"
+#include "step_scheduler.h"
+#include "stepper_motor.h"
+
+static bool moveDone = false;
+static bool failed = false;
+
+static void MotorEventHandler(StepperMotor *motor, StepperMotorEvent event)
+{
+    moveDone = moveDone || event != StepperMotorEvent_MoveStarting;
+    failed = failed || event == StepperMotorEvent_Error;
+}
+
+static void SchedulerErrorHandler(void)
+{
+    failed = true;
+}
+
+static uint64_t Micros(uint64_t ns)
+{
+    return (ns + 500) / 1000;
+}
+
+static int RunMode(int epollFd, StepMode mode, const char *name, uint32_t steps, uint32_t cruiseIntervalNs)
+{
+    static const StepperMotorConfig baseConfig = {.coilGpios = {32, 33, 31, 34},
+                                                  .profileShape = MotionProfileShape_SCurve,
+                                                  .startIntervalNs = 2048000,
+                                                  .accelerationStepsPerSec2 = 20000,
+                                                  .fullStepsPerRevolution = 0};
+    StepperMotorConfig config = baseConfig;
+    config.stepMode = mode;
+    config.cruiseIntervalNs = cruiseIntervalNs;
+
+    StepperMotor motor;
+    if (StepScheduler_Init(epollFd, &SchedulerErrorHandler) != 0 ||
+        StepperMotor_Open(&motor, &config, &MotorEventHandler) != 0) {
+        return -1;
+    }
+
+    Mock_Reset();
+    moveDone = false;
+    uint64_t startNs = StepScheduler_Now();
+    StepperMotor_MoveBy(&motor, (int32_t)steps);
+    while (!moveDone && !failed) {
+        if (WaitForEventsAndCallHandlers(epollFd, EPOLL_MAX_EVENTS_PER_WAIT) < 0) {
+            failed = true;
+        }
+    }
+    uint64_t elapsedNs = StepScheduler_Now() - startNs;
+
+    uint64_t taken, missed;
+    StepperMotor_GetStepCounts(&motor, &taken, &missed);
+    const MockCallCounts *calls = Mock_GetCallCounts();
+    uint64_t syscalls = calls->gpioWrites + calls->epollWaits + calls->reads + calls->timerSettings +
+                        calls->timerQueries;
+    const LatencyHistogram *latency = &StepScheduler_GetStats()->wakeupLatency;
+    double perStep = taken > 0 ? 1.0 / (double)taken : 0.0;
+
+    printf("%-9s %7llu %6llu %9.1f %7.2f %6.2f %6.2f %6.2f %8llu %8llu %8llu\n", name,
+           (unsigned long long)taken, (unsigned long long)missed, taken * 1e9 / (double)elapsedNs,
+           syscalls * perStep, calls->gpioWrites * perStep, calls->epollWaits * perStep,
+           calls->timerSettings * perStep,
+           (unsigned long long)Micros(LatencyHistogram_PercentileNs(latency, 50)),
+           (unsigned long long)Micros(LatencyHistogram_PercentileNs(latency, 99)),
+           (unsigned long long)Micros(latency->maxNs));
+
+    StepperMotor_Close(&motor);
+    StepScheduler_Close();
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t steps = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 2000;
+    uint32_t cruiseIntervalNs = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) * 1000 : 1000000;
+
+    int epollFd = CreateEpollFd();
+    if (epollFd < 0) {
+        return 1;
+    }
+
+    printf("%u steps per mode, cruise interval %u us\n", steps, cruiseIntervalNs / 1000);
+    printf("%-9s %7s %6s %9s %7s %6s %6s %6s %8s %8s %8s\n", "mode", "steps", "missed", "steps/s",
+           "sys/st", "gpio", "epoll", "timer", "p50(us)", "p99(us)", "max(us)");
+
+    static const struct {
+        StepMode mode;
+        const char *name;
+    } modes[] = {{StepMode_Wave, "wave"}, {StepMode_FullStep, "full"}, {StepMode_HalfStep, "half"}};
+    int result = 0;
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]) && result == 0; ++i) {
+        result = RunMode(epollFd, modes[i].mode, modes[i].name, steps, cruiseIntervalNs);
+    }
+
+    CloseFdAndPrintError(epollFd, "Epoll");
+    return result == 0 ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include <applibs/application.h>
+#include <applibs/log.h>
+
+#include "mock_applibs.h"
+
+// Highest file descriptor a mock GPIO can get
+#define MAX_GPIO_FDS 1024
+
+static MockCallCounts counts;
+static MockGpioWrite gpioWrites[MOCK_GPIO_WRITE_LOG_CAPACITY];
+static uint32_t gpioWriteCount = 0;
+static GPIO_Value_Type inputLevel = GPIO_Value_High;
+static GPIO_Id gpioIdOfFd[MAX_GPIO_FDS];
+
+static uint64_t NowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+void Mock_Reset(void)
+{
+    memset(&counts, 0, sizeof(counts));
+    gpioWriteCount = 0;
+}
+
+const MockCallCounts *Mock_GetCallCounts(void)
+{
+    return &counts;
+}
+
+const MockGpioWrite *Mock_GetGpioWrites(uint32_t *count)
+{
+    *count = gpioWriteCount;
+    return gpioWrites;
+}
+
+void Mock_SetInputLevel(GPIO_Value_Type value)
+{
+    inputLevel = value;
+}
+
+int Log_DebugVarArgs(const char *fmt, va_list args)
+{
+    return vfprintf(stderr, fmt, args);
+}
+
+int Log_Debug(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int result = Log_DebugVarArgs(fmt, args);
+    va_end(args);
+    return result;
+}
+
+// A GPIO is backed by a real file descriptor so that the code under test can close it as usual.
+static int OpenGpio(GPIO_Id gpioId)
+{
+    int fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (fd >= MAX_GPIO_FDS) {
+        close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+    if (fd >= 0) {
+        gpioIdOfFd[fd] = gpioId;
+    }
+    return fd;
+}
+
+int GPIO_OpenAsOutput(GPIO_Id gpioId, GPIO_OutputMode_Type outputMode, GPIO_Value_Type initialValue)
+{
+    return OpenGpio(gpioId);
+}
+
+int GPIO_OpenAsInput(GPIO_Id gpioId)
+{
+    return OpenGpio(gpioId);
+}
+
+int GPIO_SetValue(int gpioFd, GPIO_Value_Type value)
+{
+    if (gpioFd < 0 || gpioFd >= MAX_GPIO_FDS) {
+        errno = EBADF;
+        return -1;
+    }
+    ++counts.gpioWrites;
+    if (gpioWriteCount < MOCK_GPIO_WRITE_LOG_CAPACITY) {
+        gpioWrites[gpioWriteCount++] =
+            (MockGpioWrite){.timestampNs = NowNs(), .gpioId = gpioIdOfFd[gpioFd], .value = value};
+    }
+    return 0;
+}
+
+int GPIO_GetValue(int gpioFd, GPIO_Value_Type *outValue)
+{
+    if (gpioFd < 0 || gpioFd >= MAX_GPIO_FDS) {
+        errno = EBADF;
+        return -1;
+    }
+    ++counts.gpioReads;
+    *outValue = inputLevel;
+    return 0;
+}
+
+int Application_Connect(const char *componentId)
+{
+    errno = ECONNREFUSED;
+    return -1;
+}
+
+// System calls of the event loop, wrapped with -Wl,--wrap so they can be counted.
+int __real_epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout);
+ssize_t __real_read(int fd, void *buf, size_t count);
+int __real_timerfd_settime(int fd, int flags, const struct itimerspec *new_value,
+                           struct itimerspec *old_value);
+int __real_timerfd_gettime(int fd, struct itimerspec *curr_value);
+
+int __wrap_epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+    ++counts.epollWaits;
+    return __real_epoll_wait(epfd, events, maxevents, timeout);
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+    ++counts.reads;
+    return __real_read(fd, buf, count);
+}
+
+int __wrap_timerfd_settime(int fd, int flags, const struct itimerspec *new_value,
+                           struct itimerspec *old_value)
+{
+    ++counts.timerSettings;
+    return __real_timerfd_settime(fd, flags, new_value, old_value);
+}
+
+int __wrap_timerfd_gettime(int fd, struct itimerspec *curr_value)
+{
+    ++counts.timerQueries;
+    return __real_timerfd_gettime(fd, curr_value);
+}
@@ -0,0 +1,56 @@
+/*
+Counters and pin write log kept by the host applibs stand-ins.
+GPIO calls are counted by the mock GPIO API. The event loop's own system calls are counted by wrapping them at
+link time (see the top-level README.md), so the real epoll_timerfd_utilities.c runs unchanged against the host kernel.
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include <applibs/gpio.h>
+
+/// <summary>Number of pin writes kept; later writes are counted but not logged.</summary>
+#define MOCK_GPIO_WRITE_LOG_CAPACITY 65536
+
+/// <summary>
+///     One logged pin write.
+/// </summary>
+typedef struct {
+    /// <summary>CLOCK_MONOTONIC time of the write.</summary>
+    uint64_t timestampNs;
+    GPIO_Id gpioId;
+    GPIO_Value_Type value;
+} MockGpioWrite;
+
+/// <summary>
+///     Calls made since the last <see cref="Mock_Reset" />. Each of these is one system call on the device.
+/// </summary>
+typedef struct {
+    uint64_t gpioWrites;
+    uint64_t gpioReads;
+    uint64_t epollWaits;
+    uint64_t reads;
+    uint64_t timerSettings;
+    uint64_t timerQueries;
+} MockCallCounts;
+
+/// <summary>
+///     Clears the counters and the pin write log.
+/// </summary>
+void Mock_Reset(void);
+
+/// <summary>
+///     Returns the counters.
+/// </summary>
+const MockCallCounts *Mock_GetCallCounts(void);
+
+/// <summary>
+///     Returns the pin write log.
+/// </summary>
+/// <param name="count">Receives the number of logged writes</param>
+const MockGpioWrite *Mock_GetGpioWrites(uint32_t *count);
+
+/// <summary>
+///     Sets the level every input pin reads back; High (button released) by default.
+/// </summary>
+void Mock_SetInputLevel(GPIO_Value_Type value);
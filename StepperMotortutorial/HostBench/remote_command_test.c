@@ -0,0 +1,173 @@
+/*
+Host test of the remote command stream against a real planner, motor and event loop on a loopback socket.
+It queues more moves than the planner takes, so that one is refused and parsing pauses, then sends a Stop and
+checks that the motor stops at once instead of after the refused moves, and that those moves are not run later.
+Usage: remote_command_test
+*/
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "move_planner.h"
+#include "remote_command.h"
+#include "step_scheduler.h"
+#include "stepper_motor.h"
+
+#define TEST_PORT 47321
+// Every move is this far past the one before, which takes about half a second at cruise
+#define MOVE_STEPS 400
+// More than the planner queue holds, so that the last ones are refused
+#define MOVE_COUNT (MOTION_QUEUE_CAPACITY + 8)
+// Long enough to brake from cruise; waiting for the refused moves would take seconds
+#define STOP_LIMIT_NS 1500000000u
+
+static bool failed = false;
+static unsigned failures = 0;
+static unsigned checks = 0;
+static SoftTimer wakeTimer;
+
+static void Check(bool ok, const char *what)
+{
+    ++checks;
+    if (!ok) {
+        ++failures;
+        printf("FAIL %s\n", what);
+    }
+}
+
+static void MovePlannerEventHandler(MovePlanner *planner, MovePlannerEvent event)
+{
+    failed = failed || event == MovePlannerEvent_Error;
+}
+
+static void SchedulerErrorHandler(void)
+{
+    failed = true;
+}
+
+// Only there to wake the event loop, so that it can be run for a while
+static void WakeTimerHandler(SoftTimer *timer)
+{
+}
+
+// Runs the event loop until the planner is at rest, if stopWhenIdle is set, or for the given time
+static void RunFor(int epollFd, MovePlanner *planner, uint64_t durationNs, bool stopWhenIdle)
+{
+    uint64_t endNs = StepScheduler_Now() + durationNs;
+    while (!failed && StepScheduler_Now() < endNs && !(stopWhenIdle && !MovePlanner_IsMoving(planner))) {
+        if (WaitForEventsAndCallHandlers(epollFd, EPOLL_MAX_EVENTS_PER_WAIT) < 0) {
+            failed = true;
+        }
+    }
+}
+
+static int SendAll(int fd, const uint8_t *bytes, size_t length)
+{
+    while (length > 0) {
+        ssize_t sent = send(fd, bytes, length, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            perror("send");
+            return -1;
+        }
+        bytes += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+static int ConnectClient(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in address = {
+        .sin_family = AF_INET, .sin_port = htons(TEST_PORT), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if (fd < 0 || connect(fd, (const struct sockaddr *)&address, sizeof(address)) != 0) {
+        perror("connect");
+        return -1;
+    }
+    return fd;
+}
+
+int main(void)
+{
+    // The app's defaults
+    const StepperMotorConfig motorConfig = {.coilGpios = {32, 33, 31, 34},
+                                            .stepMode = StepMode_FullStep,
+                                            .profileShape = MotionProfileShape_SCurve,
+                                            .startIntervalNs = 2048000,
+                                            .cruiseIntervalNs = 1200000,
+                                            .accelerationStepsPerSec2 = 2000,
+                                            .fullStepsPerRevolution = 0};
+    const MovePlannerConfig plannerConfig = {.profileShape = motorConfig.profileShape,
+                                             .startIntervalNs = motorConfig.startIntervalNs,
+                                             .cruiseIntervalNs = motorConfig.cruiseIntervalNs,
+                                             .accelerationStepsPerSec2 = motorConfig.accelerationStepsPerSec2};
+
+    int epollFd = CreateEpollFd();
+    if (epollFd < 0 || TimerWheel_Init(epollFd) != 0 || StepScheduler_Init(epollFd, &SchedulerErrorHandler) != 0) {
+        return EXIT_FAILURE;
+    }
+    StepperMotor motor;
+    StepperMotor *axes[1] = {&motor};
+    MovePlanner planner;
+    if (StepperMotor_Open(&motor, &motorConfig, NULL) != 0 ||
+        MovePlanner_Init(&planner, axes, 1, &plannerConfig, &MovePlannerEventHandler) != 0 ||
+        RemoteCommand_Open(epollFd, TEST_PORT, &planner) != 0) {
+        return EXIT_FAILURE;
+    }
+    SoftTimer_Init(&wakeTimer, &WakeTimerHandler);
+    static const struct timespec wakePeriod = {0, 1000000};
+    SoftTimer_Start(&wakeTimer, &wakePeriod, &wakePeriod);
+
+    int client = ConnectClient();
+    if (client < 0) {
+        return EXIT_FAILURE;
+    }
+    uint8_t moves[MOVE_COUNT * 5];
+    for (int move = 0; move < MOVE_COUNT; ++move) {
+        uint32_t target = (uint32_t)((move + 1) * MOVE_STEPS);
+        uint8_t *command = &moves[move * 5];
+        command[0] = RemoteCommand_MoveTo;
+        for (int byte = 0; byte < 4; ++byte) {
+            command[1 + byte] = (uint8_t)(target >> (8 * byte));
+        }
+    }
+    if (SendAll(client, moves, sizeof(moves)) != 0) {
+        return EXIT_FAILURE;
+    }
+    // Long enough to take the moves the queue has room for and refuse the rest
+    RunFor(epollFd, &planner, 50000000u, false);
+    Check(MovePlanner_IsMoving(&planner), "the queued moves did not start");
+
+    const uint8_t stop = RemoteCommand_Stop;
+    if (SendAll(client, &stop, 1) != 0) {
+        return EXIT_FAILURE;
+    }
+    uint64_t stopNs = StepScheduler_Now();
+    RunFor(epollFd, &planner, STOP_LIMIT_NS, true);
+    Check(!MovePlanner_IsMoving(&planner), "the Stop waited behind the refused moves");
+    printf("Stopped %.0f ms after the Stop at position %ld\n", (StepScheduler_Now() - stopNs) / 1e6,
+           (long)StepperMotor_GetPosition(&motor));
+    Check(StepperMotor_GetPosition(&motor) < 2 * MOVE_STEPS, "the motor did not stop on the first move");
+
+    // The refused moves came before the Stop, so they are dropped and not retried
+    RunFor(epollFd, &planner, 100000000u, false);
+    Check(!MovePlanner_IsMoving(&planner), "the moves before the Stop ran after it");
+    Check(!failed, "the planner or the scheduler reported an error");
+
+    close(client);
+    SoftTimer_Stop(&wakeTimer);
+    RemoteCommand_Close();
+    MovePlanner_Close(&planner);
+    StepperMotor_Close(&motor);
+    StepScheduler_Close();
+    TimerWheel_Close();
+    CloseFdAndPrintError(epollFd, "Epoll");
+
+    printf("%u checks, %u failed\n", checks, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
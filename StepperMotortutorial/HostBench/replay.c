@@ -0,0 +1,450 @@
+/*
+Replay of a recorded motion session.
+Reads a step trace dump out of an app log (see step_trace.h), puts every axis where the first planned move from
+rest started and queues the recorded moves on a move planner at the times they were recorded, through the real step
+scheduler, planner, stepper and epoll code against the mock applibs layer. The replay traces its own steps as the
+device does, and once the last move is over they are compared with the recorded ones run by run, where a run is
+everything from one move from rest to the next and its steps are paired up in order. The report gives the steps and
+missed ticks of both, how far each step interval and each step's time since the start of its run are off the
+recording, the paired steps that drove different coils, and the scheduler's wakeup latency during the replay.
+A recording whose ring wrapped over starts at the oldest move from rest it still holds.
+The motor configuration is read from the "Motor:" line the app logs at startup, or the app's defaults without it.
+Usage: replay log
+*/
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "latency_stats.h"
+#include "mock_applibs.h"
+#include "move_planner.h"
+#include "step_scheduler.h"
+#include "step_trace.h"
+#include "stepper_motor.h"
+
+#if !STEP_TRACE_ENABLED
+#error The replay compares step traces, so it needs STEP_TRACE_ENABLED
+#endif
+
+// A move as recorded: the records of one MovePlanner_MoveTo, or a stop
+typedef struct {
+    uint64_t timestampNs;
+    bool isStop;
+    bool fromRest;
+    int32_t origins[MOVE_PLANNER_MAX_AXES];
+    uint8_t originPhases[MOVE_PLANNER_MAX_AXES];
+    int32_t targets[MOVE_PLANNER_MAX_AXES];
+} RecordedMove;
+
+// Steps and missed ticks of one trace, from its first move from rest on
+typedef struct {
+    const StepTraceRecord *records;
+    size_t count;
+    uint32_t runs;
+    uint64_t steps;
+    uint64_t missedTicks;
+} TraceSummary;
+
+static bool failed = false;
+static SoftTimer wakeTimer;
+
+static void MovePlannerEventHandler(MovePlanner *planner, MovePlannerEvent event)
+{
+    failed = failed || event == MovePlannerEvent_Error;
+}
+
+static void SchedulerErrorHandler(void)
+{
+    failed = true;
+}
+
+// Only there to wake the event loop when the next move is due
+static void WakeTimerHandler(SoftTimer *timer)
+{
+}
+
+static uint64_t Micros(uint64_t ns)
+{
+    return (ns + 500) / 1000;
+}
+
+static int AppendRecord(StepTraceRecord **records, size_t *count, size_t *capacity, const StepTraceRecord *record)
+{
+    if (*count == *capacity) {
+        size_t grown = *capacity == 0 ? 4096 : *capacity * 2;
+        StepTraceRecord *larger = realloc(*records, grown * sizeof(**records));
+        if (larger == NULL) {
+            return -1;
+        }
+        *records = larger;
+        *capacity = grown;
+    }
+    (*records)[(*count)++] = *record;
+    return 0;
+}
+
+// The dump lines of step_trace.h, which may be prefixed by whatever collected the log
+static bool ParseTraceLine(const char *line, StepTraceRecord *record)
+{
+    unsigned long long timestampNs;
+    unsigned int phase, coils, axis;
+    long value;
+    memset(record, 0, sizeof(*record));
+    if (sscanf(line, " STEP %*s t=%llu dt=%*s phase=%u coils=%x", &timestampNs, &phase, &coils) == 3) {
+        record->kind = StepTraceKind_Step;
+        record->phase = (uint8_t)phase;
+        record->coilMask = (uint8_t)coils;
+    } else if (sscanf(line, " ORIGIN %*s t=%llu axis=%u position=%ld phase=%u", &timestampNs, &axis, &value,
+                      &phase) == 4) {
+        record->kind = StepTraceKind_Origin;
+        record->axis = (uint8_t)axis;
+        record->phase = (uint8_t)phase;
+    } else if (sscanf(line, " MOVE %*s t=%llu axis=%u target=%ld", &timestampNs, &axis, &value) == 3) {
+        record->kind = StepTraceKind_MoveTo;
+        record->axis = (uint8_t)axis;
+    } else if (sscanf(line, " STOP %*s t=%llu", &timestampNs) == 1) {
+        record->kind = StepTraceKind_Stop;
+        value = 0;
+    } else if (sscanf(line, " MISS %*s t=%llu ticks=%ld", &timestampNs, &value) == 2) {
+        record->kind = StepTraceKind_Missed;
+    } else {
+        return false;
+    }
+    record->timestampNs = timestampNs;
+    record->value = (int32_t)value;
+    return true;
+}
+
+static int ReadLog(const char *path, StepperMotorConfig *motor, StepTraceRecord **records, size_t *count)
+{
+    FILE *log = fopen(path, "r");
+    if (log == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    size_t capacity = 0;
+    *records = NULL;
+    *count = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), log) != NULL) {
+        const char *text = strstr(line, "Motor: ");
+        int stepMode, profile;
+        unsigned long start, cruise, acceleration;
+        StepTraceRecord record;
+        if (text != NULL && sscanf(text, "Motor: step mode %d, profile %d, start %lu ns, cruise %lu ns, "
+                                         "acceleration %lu",
+                                   &stepMode, &profile, &start, &cruise, &acceleration) == 5) {
+            motor->stepMode = (StepMode)stepMode;
+            motor->profileShape = (MotionProfileShape)profile;
+            motor->startIntervalNs = (uint32_t)start;
+            motor->cruiseIntervalNs = (uint32_t)cruise;
+            motor->accelerationStepsPerSec2 = (uint32_t)acceleration;
+        } else if (ParseTraceLine(line, &record) && AppendRecord(records, count, &capacity, &record) != 0) {
+            fclose(log);
+            return -1;
+        }
+    }
+    fclose(log);
+    return 0;
+}
+
+// Group the records of each move from the first move from rest on. A move from rest starts with the origin of
+// axis 0, a queued move with the target of axis 0.
+static size_t CollectMoves(const StepTraceRecord *records, size_t count, RecordedMove *moves, uint32_t *axisCount)
+{
+    size_t moveCount = 0;
+    RecordedMove *move = NULL;
+    // The targets of a move from rest follow its origins
+    bool awaitingTargets = false;
+    *axisCount = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const StepTraceRecord *record = &records[i];
+        uint32_t axis = record->axis;
+        if (moveCount == 0 && record->kind != StepTraceKind_Origin) {
+            continue;
+        }
+        if (record->kind == StepTraceKind_Stop || (axis == 0 && record->kind == StepTraceKind_Origin) ||
+            (axis == 0 && record->kind == StepTraceKind_MoveTo && !awaitingTargets)) {
+            move = &moves[moveCount++];
+            *move = (RecordedMove){.timestampNs = record->timestampNs,
+                                   .isStop = record->kind == StepTraceKind_Stop,
+                                   .fromRest = record->kind == StepTraceKind_Origin};
+        }
+        if (record->kind == StepTraceKind_Origin) {
+            awaitingTargets = true;
+        } else if (record->kind == StepTraceKind_MoveTo) {
+            awaitingTargets = false;
+        }
+        if ((record->kind == StepTraceKind_Origin || record->kind == StepTraceKind_MoveTo) &&
+            axis < MOVE_PLANNER_MAX_AXES) {
+            if (record->kind == StepTraceKind_Origin) {
+                move->origins[axis] = record->value;
+                move->originPhases[axis] = record->phase;
+            } else {
+                move->targets[axis] = record->value;
+            }
+            if (axis + 1 > *axisCount) {
+                *axisCount = axis + 1;
+            }
+        }
+    }
+    return moveCount;
+}
+
+// Issue a move once it is due. A move from rest waits for the planner to come to rest, and a queued move for room
+// in the queue, as they did when they were recorded.
+static bool IssueMove(MovePlanner *planner, StepperMotor *motors, uint32_t axisCount, const RecordedMove *move)
+{
+    if (move->isStop) {
+        MovePlanner_Stop(planner);
+        return true;
+    }
+    if (move->fromRest) {
+        if (MovePlanner_IsMoving(planner)) {
+            return false;
+        }
+        for (uint32_t axis = 0; axis < axisCount; ++axis) {
+            StepperMotor_SetPosition(&motors[axis], move->origins[axis]);
+            StepperMotor_SetPhase(&motors[axis], move->originPhases[axis]);
+        }
+    }
+    return MovePlanner_MoveTo(planner, move->targets) == 0;
+}
+
+static int Replay(int epollFd, MovePlanner *planner, StepperMotor *motors, uint32_t axisCount,
+                  const RecordedMove *moves, size_t moveCount)
+{
+    StepTrace_Clear();
+    Mock_Reset();
+    SoftTimer_Init(&wakeTimer, &WakeTimerHandler);
+    uint64_t recordedStartNs = moves[0].timestampNs;
+    uint64_t startNs = StepScheduler_Now();
+    size_t next = 0;
+    while (!failed && (next < moveCount || MovePlanner_IsMoving(planner))) {
+        uint64_t nowNs = StepScheduler_Now();
+        while (next < moveCount && nowNs - startNs >= moves[next].timestampNs - recordedStartNs &&
+               IssueMove(planner, motors, axisCount, &moves[next])) {
+            ++next;
+        }
+        if (next < moveCount && !SoftTimer_IsRunning(&wakeTimer)) {
+            uint64_t dueNs = startNs + (moves[next].timestampNs - recordedStartNs);
+            uint64_t delayNs = dueNs > nowNs ? dueNs - nowNs : 0;
+            struct timespec delay = {(time_t)(delayNs / 1000000000u), (long)(delayNs % 1000000000u)};
+            SoftTimer_Start(&wakeTimer, &delay, NULL);
+        }
+        if (WaitForEventsAndCallHandlers(epollFd, EPOLL_MAX_EVENTS_PER_WAIT) < 0) {
+            failed = true;
+        }
+    }
+    SoftTimer_Stop(&wakeTimer);
+    return failed ? -1 : 0;
+}
+
+static TraceSummary Summarize(const StepTraceRecord *records, size_t count)
+{
+    TraceSummary summary = {.records = records, .count = count};
+    bool started = false;
+    for (size_t i = 0; i < count; ++i) {
+        const StepTraceRecord *record = &records[i];
+        if (record->kind == StepTraceKind_Origin && record->axis == 0) {
+            started = true;
+            ++summary.runs;
+        } else if (started && record->kind == StepTraceKind_Step) {
+            ++summary.steps;
+        } else if (started && record->kind == StepTraceKind_Missed) {
+            summary.missedTicks += (uint64_t)record->value;
+        }
+    }
+    return summary;
+}
+
+// Moves the cursor to the next step of the current run, or returns false at the end of the run
+static bool NextStep(const TraceSummary *trace, size_t *cursor)
+{
+    while (++*cursor < trace->count) {
+        uint8_t kind = trace->records[*cursor].kind;
+        if (kind == StepTraceKind_Step) {
+            return true;
+        }
+        if (kind == StepTraceKind_Origin && trace->records[*cursor].axis == 0) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// Moves the cursor to the origin record that starts the next run
+static bool NextRun(const TraceSummary *trace, size_t *cursor)
+{
+    while (*cursor < trace->count &&
+           !(trace->records[*cursor].kind == StepTraceKind_Origin && trace->records[*cursor].axis == 0)) {
+        ++*cursor;
+    }
+    return *cursor < trace->count;
+}
+
+static uint64_t Difference(uint64_t a, uint64_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+static void Compare(const TraceSummary *recorded, const TraceSummary *replayed)
+{
+    LatencyHistogram intervalError = {0};
+    LatencyHistogram driftError = {0};
+    uint64_t coilMismatches = 0;
+    uint64_t unpairedSteps = 0;
+
+    size_t recordedCursor = 0, replayedCursor = 0;
+    while (NextRun(recorded, &recordedCursor) && NextRun(replayed, &replayedCursor)) {
+        const StepTraceRecord *recordedFirst = NULL, *replayedFirst = NULL;
+        const StepTraceRecord *recordedPrevious = NULL, *replayedPrevious = NULL;
+        for (;;) {
+            bool haveRecorded = NextStep(recorded, &recordedCursor);
+            bool haveReplayed = NextStep(replayed, &replayedCursor);
+            if (!haveRecorded || !haveReplayed) {
+                // Count what is left of the longer run
+                while (haveRecorded && NextStep(recorded, &recordedCursor)) {
+                    ++unpairedSteps;
+                }
+                while (haveReplayed && NextStep(replayed, &replayedCursor)) {
+                    ++unpairedSteps;
+                }
+                unpairedSteps += (haveRecorded ? 1u : 0u) + (haveReplayed ? 1u : 0u);
+                break;
+            }
+
+            const StepTraceRecord *a = &recorded->records[recordedCursor];
+            const StepTraceRecord *b = &replayed->records[replayedCursor];
+            if (recordedFirst == NULL) {
+                recordedFirst = a;
+                replayedFirst = b;
+            } else {
+                LatencyHistogram_Record(&intervalError,
+                                        Difference(b->timestampNs - replayedPrevious->timestampNs,
+                                                   a->timestampNs - recordedPrevious->timestampNs));
+            }
+            LatencyHistogram_Record(&driftError, Difference(b->timestampNs - replayedFirst->timestampNs,
+                                                            a->timestampNs - recordedFirst->timestampNs));
+            coilMismatches += a->coilMask != b->coilMask ? 1u : 0u;
+            recordedPrevious = a;
+            replayedPrevious = b;
+        }
+    }
+
+    printf("%-9s %5s %9s %7s\n", "", "runs", "steps", "missed");
+    printf("%-9s %5u %9llu %7llu\n", "recorded", recorded->runs, (unsigned long long)recorded->steps,
+           (unsigned long long)recorded->missedTicks);
+    printf("%-9s %5u %9llu %7llu\n", "replayed", replayed->runs, (unsigned long long)replayed->steps,
+           (unsigned long long)replayed->missedTicks);
+    printf("%-9s %5d %9lld %7lld\n", "delta", (int)replayed->runs - (int)recorded->runs,
+           (long long)replayed->steps - (long long)recorded->steps,
+           (long long)replayed->missedTicks - (long long)recorded->missedTicks);
+    printf("unpaired steps %llu, paired steps driving other coils %llu\n", (unsigned long long)unpairedSteps,
+           (unsigned long long)coilMismatches);
+
+    const LatencyHistogram *wakeup = &StepScheduler_GetStats()->wakeupLatency;
+    printf("%-26s %8s %8s %8s\n", "", "p50(us)", "p99(us)", "max(us)");
+    printf("%-26s %8llu %8llu %8llu\n", "step interval error",
+           (unsigned long long)Micros(LatencyHistogram_PercentileNs(&intervalError, 50)),
+           (unsigned long long)Micros(LatencyHistogram_PercentileNs(&intervalError, 99)),
+           (unsigned long long)Micros(intervalError.maxNs));
+    printf("%-26s %8llu %8llu %8llu\n", "step time drift in run",
+           (unsigned long long)Micros(LatencyHistogram_PercentileNs(&driftError, 50)),
+           (unsigned long long)Micros(LatencyHistogram_PercentileNs(&driftError, 99)),
+           (unsigned long long)Micros(driftError.maxNs));
+    printf("%-26s %8llu %8llu %8llu\n", "replay scheduler wakeup",
+           (unsigned long long)Micros(LatencyHistogram_PercentileNs(wakeup, 50)),
+           (unsigned long long)Micros(LatencyHistogram_PercentileNs(wakeup, 99)),
+           (unsigned long long)Micros(wakeup->maxNs));
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s log\n", argv[0]);
+        return 1;
+    }
+
+    // The app's defaults, for a log without its "Motor:" line
+    StepperMotorConfig motorConfig = {.coilGpios = {32, 33, 31, 34},
+                                      .stepMode = StepMode_FullStep,
+                                      .profileShape = MotionProfileShape_SCurve,
+                                      .startIntervalNs = 2048000,
+                                      .cruiseIntervalNs = 1200000,
+                                      .accelerationStepsPerSec2 = 2000,
+                                      .fullStepsPerRevolution = 0};
+    StepTraceRecord *records;
+    size_t recordCount;
+    if (ReadLog(argv[1], &motorConfig, &records, &recordCount) != 0) {
+        return 1;
+    }
+
+    RecordedMove *moves = malloc((recordCount > 0 ? recordCount : 1) * sizeof(*moves));
+    uint32_t axisCount;
+    size_t moveCount = moves != NULL ? CollectMoves(records, recordCount, moves, &axisCount) : 0;
+    if (moveCount == 0) {
+        fprintf(stderr, "%s: no planned move from rest in the step trace\n", argv[1]);
+        return 1;
+    }
+    if (axisCount > MOVE_PLANNER_MAX_AXES) {
+        fprintf(stderr, "%s: more than %d axes\n", argv[1], MOVE_PLANNER_MAX_AXES);
+        return 1;
+    }
+
+    int epollFd = CreateEpollFd();
+    if (epollFd < 0 || TimerWheel_Init(epollFd) != 0 || StepScheduler_Init(epollFd, &SchedulerErrorHandler) != 0) {
+        return 1;
+    }
+    StepperMotor motors[MOVE_PLANNER_MAX_AXES];
+    StepperMotor *axes[MOVE_PLANNER_MAX_AXES];
+    for (uint32_t axis = 0; axis < axisCount; ++axis) {
+        StepperMotorConfig config = motorConfig;
+        for (int coil = 0; coil < COIL_COUNT; ++coil) {
+            config.coilGpios[coil] = (GPIO_Id)(motorConfig.coilGpios[coil] + 4 * axis);
+        }
+        if (StepperMotor_Open(&motors[axis], &config, NULL) != 0) {
+            return 1;
+        }
+        axes[axis] = &motors[axis];
+    }
+    const MovePlannerConfig plannerConfig = {.profileShape = motorConfig.profileShape,
+                                             .startIntervalNs = motorConfig.startIntervalNs,
+                                             .cruiseIntervalNs = motorConfig.cruiseIntervalNs,
+                                             .accelerationStepsPerSec2 = motorConfig.accelerationStepsPerSec2};
+    MovePlanner planner;
+    if (MovePlanner_Init(&planner, axes, axisCount, &plannerConfig, &MovePlannerEventHandler) != 0) {
+        return 1;
+    }
+
+    printf("%zu moves on %u axes, %.1f s\n", moveCount, axisCount,
+           (moves[moveCount - 1].timestampNs - moves[0].timestampNs) / 1e9);
+    int result = Replay(epollFd, &planner, motors, axisCount, moves, moveCount);
+    uint_fast32_t head = atomic_load_explicit(&stepTraceHead, memory_order_acquire);
+    if (result == 0 && head > STEP_TRACE_CAPACITY) {
+        fprintf(stderr, "The replay took more than the %d records the step trace holds; build with a larger "
+                        "STEP_TRACE_CAPACITY\n",
+                STEP_TRACE_CAPACITY);
+        result = -1;
+    }
+    if (result == 0) {
+        TraceSummary recorded = Summarize(records, recordCount);
+        TraceSummary replayed = Summarize(stepTraceBuffer, head);
+        Compare(&recorded, &replayed);
+    }
+
+    MovePlanner_Close(&planner);
+    for (uint32_t axis = 0; axis < axisCount; ++axis) {
+        StepperMotor_Close(&motors[axis]);
+    }
+    StepScheduler_Close();
+    TimerWheel_Close();
+    CloseFdAndPrintError(epollFd, "Epoll");
+    free(moves);
+    free(records);
+    return result == 0 ? 0 : 1;
+}
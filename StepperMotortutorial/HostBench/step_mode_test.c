@@ -0,0 +1,113 @@
+/*
+Host test of StepSequence_ChangeMode, the mapping a checkpoint restored in another step mode goes through.
+For every pair of modes, every phase and a run of positions either side of 0, it checks that the new phase drives
+the same coils or the ones half a step back, that the position moves by the same half step, and that a change that
+needs no rounding comes back to where it started.
+Usage: step_mode_test
+*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "step_sequence.h"
+
+#define POSITION_RANGE 20
+
+static const char *const modeNames[StepMode_Count] = {"wave", "full", "half"};
+static unsigned failures = 0;
+static unsigned checks = 0;
+
+static void Check(int ok, StepMode from, StepMode to, int32_t position, uint32_t phase, const char *what)
+{
+    ++checks;
+    if (!ok) {
+        ++failures;
+        printf("FAIL %s -> %s from position %ld phase %lu: %s\n", modeNames[from], modeNames[to], (long)position,
+               (unsigned long)phase, what);
+    }
+}
+
+static int Mod(int64_t value, int length)
+{
+    int remainder = (int)(value % length);
+    return remainder < 0 ? remainder + length : remainder;
+}
+
+// Index of a coil mask in the half step sequence
+static int HalfStepIndexOf(uint8_t coilMask)
+{
+    const StepSequence *half = StepSequence_Get(StepMode_HalfStep);
+    for (int index = 0; index < half->length; ++index) {
+        if (half->coilMasks[index] == coilMask) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+// Half steps from position 0 of half stepping, with phase 0 of every mode where its coils are in half stepping
+static int64_t HalfSteps(StepMode mode, int32_t position)
+{
+    const StepSequence *sequence = StepSequence_Get(mode);
+    return (int64_t)position * (8 / sequence->length) + HalfStepIndexOf(sequence->coilMasks[0]);
+}
+
+static void CheckChange(StepMode from, StepMode to, int32_t position, uint32_t phase)
+{
+    const StepSequence *oldSequence = StepSequence_Get(from);
+    const StepSequence *newSequence = StepSequence_Get(to);
+    int32_t newPosition = position;
+    uint32_t newPhase = phase;
+    StepSequence_ChangeMode(from, to, &newPosition, &newPhase);
+
+    if (newPhase >= newSequence->length) {
+        Check(0, from, to, position, phase, "phase out of range");
+        return;
+    }
+    int oldHalfStep = HalfStepIndexOf(oldSequence->coilMasks[phase]);
+    int newHalfStep = HalfStepIndexOf(newSequence->coilMasks[newPhase]);
+    int shift = Mod(newHalfStep - oldHalfStep, 8) == 0 ? 0 : -1;
+    Check(Mod(newHalfStep - oldHalfStep, 8) == Mod(shift, 8), from, to, position, phase,
+          "phase drives neither the same coils nor the ones half a step back");
+    // Modes that share the old coils must keep them
+    int sameCoils = 0;
+    for (int index = 0; index < newSequence->length; ++index) {
+        sameCoils = sameCoils || newSequence->coilMasks[index] == oldSequence->coilMasks[phase];
+    }
+    Check(sameCoils == (shift == 0), from, to, position, phase, "coils changed though the new mode has them");
+
+    int64_t target = HalfSteps(from, position) + shift;
+    int64_t moved = HalfSteps(to, newPosition);
+    if (Mod(position - phase, oldSequence->length) == 0) {
+        // Position and phase agree, so they must agree after the change and the position moves with the phase
+        Check(Mod(newPosition, newSequence->length) == (int)newPhase, from, to, position, phase,
+              "position and phase no longer agree");
+        Check(moved == target, from, to, position, phase, "position did not move with the phase");
+
+        int32_t backPosition = newPosition;
+        uint32_t backPhase = newPhase;
+        StepSequence_ChangeMode(to, from, &backPosition, &backPhase);
+        int exact = shift == 0 && oldSequence->length <= newSequence->length;
+        Check(!exact || (backPosition == position && backPhase == phase), from, to, position, phase,
+              "did not come back to the same position and phase");
+    } else {
+        Check(moved <= target && moved > target - 8 / newSequence->length, from, to, position, phase,
+              "position not rounded down to a whole step");
+    }
+}
+
+int main(void)
+{
+    for (int from = 0; from < StepMode_Count; ++from) {
+        uint8_t length = StepSequence_Get((StepMode)from)->length;
+        for (int to = 0; to < StepMode_Count; ++to) {
+            for (int32_t position = -POSITION_RANGE; position <= POSITION_RANGE; ++position) {
+                for (uint32_t phase = 0; phase < length; ++phase) {
+                    CheckChange((StepMode)from, (StepMode)to, position, phase);
+                }
+            }
+        }
+    }
+
+    printf("%u checks, %u failed\n", checks, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}